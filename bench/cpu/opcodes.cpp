@@ -0,0 +1,147 @@
+// Dependencies
+#include <chrono>
+#include <map>
+
+#include "../../src/core/platform.h"
+#include "../../src/core/instructions.h"
+#include "../../src/core/cpu.h"
+
+// Per-opcode dispatch microbenchmark. Every opcode is executed in isolation,
+// once through the flat instruction table (CPU::run) and once through the
+// std::map lookup that CPU::fetch used to do and the switch on the name that
+// CPU::exec used to do, so the two columns show the instructions per second
+// before and after the dispatch table.
+
+const int ITERATIONS = 200000;
+const int RELOAD_EVERY = 256;
+
+static std::map<uint8_t, instruction_t> legacySet;
+
+void place(CPU &cpu, uint8_t opcode) {
+    // Operands point to $00F0 so stores stay in the zero page
+    uint8_t program[] = { opcode, 0xF0, 0x00 };
+    cpu.memoryLoad(program, sizeof(program));
+    cpu.memoryWriteu16(0x00F0, 0x00F0);
+}
+
+// CPU::exec as it was before the table: a switch on the instruction's name
+void legacyExec(CPU &cpu, const instruction_t &instr, uint16_t arg) {
+    switch(instr.name) {
+        case INSTR_BRK: cpu.BRK(instr.mode, arg); break;
+
+        case INSTR_ADC: cpu.ADC(instr.mode, arg); break;
+        case INSTR_AND: cpu.AND(instr.mode, arg); break;
+        case INSTR_ASL: cpu.ASL(instr.mode, arg); break;
+        case INSTR_BCC: cpu.BCC(instr.mode, arg); break;
+        case INSTR_BCS: cpu.BCS(instr.mode, arg); break;
+        case INSTR_BEQ: cpu.BEQ(instr.mode, arg); break;
+        case INSTR_BIT: cpu.BIT(instr.mode, arg); break;
+        case INSTR_BMI: cpu.BMI(instr.mode, arg); break;
+        case INSTR_BNE: cpu.BNE(instr.mode, arg); break;
+        case INSTR_BPL: cpu.BPL(instr.mode, arg); break;
+        case INSTR_BVC: cpu.BVC(instr.mode, arg); break;
+        case INSTR_BVS: cpu.BVS(instr.mode, arg); break;
+        case INSTR_CLC: cpu.CLC(instr.mode, arg); break;
+        case INSTR_CLD: cpu.CLD(instr.mode, arg); break;
+        case INSTR_CLI: cpu.CLI(instr.mode, arg); break;
+        case INSTR_CLV: cpu.CLV(instr.mode, arg); break;
+        case INSTR_CMP: cpu.CMP(instr.mode, arg); break;
+        case INSTR_CPX: cpu.CPX(instr.mode, arg); break;
+        case INSTR_CPY: cpu.CPY(instr.mode, arg); break;
+        case INSTR_DEC: cpu.DEC(instr.mode, arg); break;
+        case INSTR_DEX: cpu.DEX(instr.mode, arg); break;
+        case INSTR_DEY: cpu.DEY(instr.mode, arg); break;
+        case INSTR_EOR: cpu.EOR(instr.mode, arg); break;
+        case INSTR_INC: cpu.INC(instr.mode, arg); break;
+        case INSTR_INX: cpu.INX(instr.mode, arg); break;
+        case INSTR_INY: cpu.INY(instr.mode, arg); break;
+        case INSTR_JMP: cpu.JMP(instr.mode, arg); break;
+        case INSTR_JSR: cpu.JSR(instr.mode, arg); break;
+        case INSTR_LDA: cpu.LDA(instr.mode, arg); break;
+        case INSTR_LDX: cpu.LDX(instr.mode, arg); break;
+        case INSTR_LDY: cpu.LDY(instr.mode, arg); break;
+        case INSTR_LSR: cpu.LSR(instr.mode, arg); break;
+        case INSTR_NOP: cpu.NOP(instr.mode, arg); break;
+        case INSTR_ORA: cpu.ORA(instr.mode, arg); break;
+        case INSTR_PHA: cpu.PHA(instr.mode, arg); break;
+        case INSTR_PHP: cpu.PHP(instr.mode, arg); break;
+        case INSTR_PLA: cpu.PLA(instr.mode, arg); break;
+        case INSTR_PLP: cpu.PLP(instr.mode, arg); break;
+        case INSTR_ROL: cpu.ROL(instr.mode, arg); break;
+        case INSTR_ROR: cpu.ROR(instr.mode, arg); break;
+        case INSTR_RTI: cpu.RTI(instr.mode, arg); break;
+        case INSTR_RTS: cpu.RTS(instr.mode, arg); break;
+        case INSTR_SBC: cpu.SBC(instr.mode, arg); break;
+        case INSTR_SEC: cpu.SEC(instr.mode, arg); break;
+        case INSTR_SED: cpu.SED(instr.mode, arg); break;
+        case INSTR_SEI: cpu.SEI(instr.mode, arg); break;
+        case INSTR_STA: cpu.STA(instr.mode, arg); break;
+        case INSTR_STX: cpu.STX(instr.mode, arg); break;
+        case INSTR_STY: cpu.STY(instr.mode, arg); break;
+        case INSTR_TAX: cpu.TAX(instr.mode, arg); break;
+        case INSTR_TAY: cpu.TAY(instr.mode, arg); break;
+        case INSTR_TSX: cpu.TSX(instr.mode, arg); break;
+        case INSTR_TXA: cpu.TXA(instr.mode, arg); break;
+        case INSTR_TXS: cpu.TXS(instr.mode, arg); break;
+        case INSTR_TYA: cpu.TYA(instr.mode, arg); break;
+
+        default: return;
+    }
+}
+
+void legacyRun(CPU &cpu) {
+    uint8_t opcode = cpu.memoryRead(cpu.registers.PC);
+    uint8_t arg0 = cpu.memoryRead(cpu.registers.PC + 1);
+    uint8_t arg1 = cpu.memoryRead(cpu.registers.PC + 2);
+
+    instruction_t instr = legacySet.at(opcode);
+    uint16_t arg = cpu.decode(arg0, arg1, instr.mode);
+
+    cpu.registers.PC += instr.bytes;
+    legacyExec(cpu, instr, arg);
+}
+
+template <typename Step>
+double measure(uint8_t opcode, Step step) {
+    CPU cpu;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < ITERATIONS; i++) {
+        if(i % RELOAD_EVERY == 0) place(cpu, opcode);
+
+        cpu.registers.PC = MEM_PROGRAM_START;
+        cpu.registers.SP = 0xFF;
+        step(cpu);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    return ITERATIONS / seconds;
+}
+
+int main() {
+    for(size_t opcode = 0; opcode < instructionSet.size(); opcode++) {
+        if(instructionSet[opcode].name != INSTR_ILL) legacySet[opcode] = instructionSet[opcode];
+    }
+
+    double totalTable = 0;
+    double totalLegacy = 0;
+
+    platformLog("opcode   table (instr/s)  legacy (instr/s)   speedup");
+    for(auto &entry : legacySet) {
+        uint8_t opcode = entry.first;
+
+        double table = measure(opcode, [](CPU &cpu) { cpu.run(nullptr); });
+        double legacy = measure(opcode, legacyRun);
+
+        totalTable += table;
+        totalLegacy += legacy;
+
+        platformLog("  0x%02X  %16.0f  %16.0f     %.2fx", opcode, table, legacy, table / legacy);
+    }
+
+    platformLog("average %16.0f  %16.0f     %.2fx",
+        totalTable / legacySet.size(), totalLegacy / legacySet.size(), totalTable / totalLegacy);
+
+    return 0;
+}
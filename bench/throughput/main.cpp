@@ -0,0 +1,380 @@
+// Dependencies
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "../../src/core/platform.h"
+#include "../../src/core/cpu.h"
+#include "../../src/core/cartridge.h"
+#include "../../src/core/machine.h"
+#include "../../src/core/apu.h"
+#include "../../src/core/env.h"
+
+// Whole-program throughput benchmark. Runs synthetic hot loops and, when
+// given their paths, Klaus Dormann's 6502 functional test and nestest.nes in
+// automation mode, then prints one JSON document on stdout:
+//
+//   bench-throughput [--klaus 6502_functional_test.bin] [--nestest nestest.nes]
+//
+// Each result has MIPS, emulated MHz and ns per instruction so runs can be
+// compared commit to commit. The synthetic loops run on every CPU core, the
+// ROMs on whichever one runCycles was built with.
+
+const uint64_t LOOP_CYCLES = 50000000;
+
+const int APU_FRAMES = 3600;
+
+const uint32_t ENV_COUNT = 16;
+const int      ENV_STEPS = 300;
+
+const uint64_t KLAUS_MAX_CYCLES = 200000000;
+const uint16_t KLAUS_START      = 0x0400;
+const uint16_t KLAUS_SUCCESS    = 0x3469;
+
+const uint16_t NESTEST_START        = 0xC000;
+const uint64_t NESTEST_INSTRUCTIONS = 8991; // Length of the automated run
+const int      NESTEST_REPEAT       = 500;
+
+typedef struct result {
+    const char *name;
+    uint64_t instructions;
+    uint64_t cycles;
+    double seconds;
+    const char *extra; // Additional JSON members, may be null
+} result_t;
+
+static std::vector<result_t> results;
+static char extras[4][128];
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &data) {
+    FILE *file = fopen(path, "rb");
+    if(!file) return false;
+
+    uint8_t block[4096];
+    size_t size;
+    while((size = fread(block, 1, sizeof(block), file)) > 0) {
+        data.insert(data.end(), block, block + size);
+    }
+
+    fclose(file);
+    return true;
+}
+
+typedef uint64_t (CPU::*core_t)(uint64_t budget);
+
+static void benchCore(const char *name, core_t core, uint8_t *program, size_t size, void (*setup)(CPU &)) {
+    CPU cpu;
+    cpu.load(program, size);
+    if(setup) setup(cpu);
+
+    double start = now();
+    (cpu.*core)(LOOP_CYCLES);
+    double seconds = now() - start;
+
+    results.push_back({ name, cpu.instructions, cpu.cycles, seconds, nullptr });
+}
+
+// Run a raw program from MEM_PROGRAM_START for LOOP_CYCLES on each CPU core
+static void benchLoop(const char *name, uint8_t *program, size_t size, void (*setup)(CPU &)) {
+    static char names[32][64];
+    static int used = 0;
+
+    snprintf(names[used], sizeof(names[used]), "%s/switch", name);
+    benchCore(names[used++], &CPU::runSwitched, program, size, setup);
+
+#if THREADED_SUPPORTED
+    snprintf(names[used], sizeof(names[used]), "%s/threaded", name);
+    benchCore(names[used++], &CPU::runThreaded, program, size, setup);
+#endif
+
+    snprintf(names[used], sizeof(names[used]), "%s/cached", name);
+    benchCore(names[used++], &CPU::runCached, program, size, setup);
+
+#if DYNAREC_SUPPORTED
+    snprintf(names[used], sizeof(names[used]), "%s/dynarec", name);
+    benchCore(names[used++], &CPU::runDynarec, program, size, setup);
+#endif
+}
+
+// Decrement X to zero over and over: one taken branch every two instructions
+static void benchBranches() {
+    uint8_t program[] = {
+        0xA2, 0x00, // LDX #$00
+        0xCA,       // DEX
+        0xD0, 0xFD, // BNE -3
+        0xC8,       // INY
+        0x4C, 0x00, 0x06, // JMP $0600
+    };
+
+    benchLoop("branches", program, sizeof(program), nullptr);
+}
+
+// LDA (zp),Y across a page, the addressing mode with the most work in decode
+static void benchIndirectIndexed() {
+    uint8_t program[] = {
+        0xA0, 0x00, // LDY #$00
+        0xB1, 0x10, // LDA ($10),Y
+        0xC8,       // INY
+        0xD0, 0xFB, // BNE -5
+        0x4C, 0x00, 0x06, // JMP $0600
+    };
+
+    benchLoop("indirect_indexed", program, sizeof(program), [](CPU &cpu) {
+        cpu.memoryWriteu16(0x0010, 0x0280); // Crosses into $0300 half way
+    });
+}
+
+// Nested subroutine calls with a push and pull in each
+static void benchSubroutines() {
+    uint8_t program[] = {
+        0x20, 0x09, 0x06, // JSR $0609
+        0x20, 0x09, 0x06, // JSR $0609
+        0x4C, 0x00, 0x06, // JMP $0600
+        0x48,             // PHA
+        0x20, 0x0F, 0x06, // JSR $060F
+        0x68,             // PLA
+        0x60,             // RTS
+        0x08,             // PHP
+        0x28,             // PLP
+        0x60,             // RTS
+    };
+
+    benchLoop("subroutines", program, sizeof(program), nullptr);
+}
+
+// Flag-heavy arithmetic: every instruction but the branch and jump writes flags
+static void benchArithmetic() {
+    uint8_t program[] = {
+        0xA2, 0x00, // LDX #$00
+        0x18,       // CLC
+        0x69, 0x37, // ADC #$37
+        0xE9, 0x11, // SBC #$11
+        0xC9, 0x40, // CMP #$40
+        0x49, 0xFF, // EOR #$FF
+        0x2A,       // ROL A
+        0xE8,       // INX
+        0xD0, 0xF3, // BNE -13
+        0x4C, 0x00, 0x06, // JMP $0600
+    };
+
+    benchLoop("arithmetic", program, sizeof(program), nullptr);
+}
+
+// Step ENV_COUNT environments on one thread, one frame per step with the
+// 32x32 screen at $0200 as the observation. Every environment runs the same
+// code, so one lone machine gives the instruction count.
+static void benchEnv() {
+    static uint8_t program[] = {
+        0xA5, 0xFF,       // LDA $FF
+        0x9D, 0x00, 0x02, // STA $0200,X
+        0x9D, 0x00, 0x03, // STA $0300,X
+        0xE8,             // INX
+        0xD0, 0xF6,       // BNE -10
+        0xEE, 0x00, 0x04, // INC $0400
+        0x4C, 0x00, 0x06, // JMP $0600
+    };
+
+    env_config_t config = {};
+    config.image = program;
+    config.size = sizeof(program);
+    config.count = ENV_COUNT;
+    config.threads = 1;
+    config.framesPerStep = 1;
+    config.observation = ENV_OBSERVE_RAM;
+    config.ramAddress = 0x0200;
+    config.ramSize = 32 * 32;
+    config.rewardAddress = 0x0400;
+    config.rewardSize = 1;
+
+    env_t *env = envCreate(&config, nullptr);
+    std::vector<uint8_t> observations(ENV_COUNT * envObservationSize(env));
+    uint8_t actions[ENV_COUNT];
+    float rewards[ENV_COUNT];
+
+    double start = now();
+    for(int step = 0; step < ENV_STEPS; step++) {
+        memset(actions, step, sizeof(actions));
+        envStep(env, actions, observations.data(), rewards);
+    }
+    double seconds = now() - start;
+    envDestroy(env);
+
+    Machine machine;
+    machine.load(program, sizeof(program));
+    machine.runFrames(ENV_STEPS);
+
+    snprintf(extras[2], sizeof(extras[2]), "\"steps_per_second\": %.0f", ENV_COUNT * ENV_STEPS / seconds);
+    results.push_back({ "env_step", machine.cpu.instructions * ENV_COUNT, machine.cpu.cycles * ENV_COUNT, seconds, extras[2] });
+}
+
+// All five APU channels playing for a minute of emulated time. The CPU runs
+// without the APU attached and the APU catches up once per frame on its own,
+// so only its time is measured, reported as a share of a 60 Hz frame. The
+// samples are drained each frame as the audio device would.
+static void benchAPU() {
+    static uint8_t program[] = {
+        0x4C, 0x00, 0x06, // JMP $0600
+    };
+    static const uint8_t writes[][2] = {
+        { 0x15, 0x1F },                                 // All channels on
+        { 0x00, 0xBF }, { 0x02, 0xFD }, { 0x03, 0x08 }, // Pulses
+        { 0x04, 0x7F }, { 0x06, 0xAB }, { 0x07, 0x09 },
+        { 0x08, 0xFF }, { 0x0A, 0x00 }, { 0x0B, 0x09 }, // Triangle
+        { 0x0C, 0x38 }, { 0x0E, 0x03 }, { 0x0F, 0x08 }, // Noise, decaying
+        { 0x10, 0x4F }, { 0x12, 0x00 }, { 0x13, 0xFF }, // DMC, looping
+        { 0x15, 0x1F },
+    };
+
+    CPU cpu;
+    cpu.load(program, sizeof(program));
+    APU apu;
+    apu.attach(cpu);
+    for(auto &write : writes) cpu.memoryWrite(0x4000 | write[0], write[1]);
+    cpu.apu = nullptr;
+
+    double seconds = 0;
+    int16_t sample;
+    for(int frame = 0; frame < APU_FRAMES; frame++) {
+        cpu.runFrame();
+
+        double start = now();
+        apu.run(cpu.cycles);
+        seconds += now() - start;
+
+        while(apu.samples.pop(sample)) {}
+    }
+
+    snprintf(extras[3], sizeof(extras[3]), "\"frame_percent\": %.3f, \"dropped\": %llu",
+        seconds / APU_FRAMES * 60 * 100, (unsigned long long) apu.dropped);
+    results.push_back({ "apu", 0, cpu.cycles, seconds, extras[3] });
+}
+
+// The functional test reports failure by jumping to itself, and success by
+// doing the same at KLAUS_SUCCESS
+static bool benchKlaus(const char *path) {
+    std::vector<uint8_t> image;
+    if(!readFile(path, image) || image.size() != 0x10000) {
+        platformLog("bench: %s is not a 64 KB functional test image", path);
+        return false;
+    }
+
+    CPU cpu;
+    cpu.bus.mapFlat();
+    for(size_t i = 0; i < image.size(); i++) {
+        cpu.memoryWrite(i, image[i]);
+    }
+    cpu.registers.PC = KLAUS_START;
+
+    double start = now();
+    uint16_t trap = 0;
+    while(cpu.cycles < KLAUS_MAX_CYCLES) {
+        cpu.runCycles(100000);
+
+        uint16_t pc = cpu.registers.PC;
+        cpu.step();
+        if(cpu.registers.PC == pc) {
+            trap = pc;
+            break;
+        }
+    }
+    double seconds = now() - start;
+
+    snprintf(extras[0], sizeof(extras[0]), "\"trap\": %u, \"passed\": %s", trap, trap == KLAUS_SUCCESS ? "true" : "false");
+    results.push_back({ "klaus_functional", cpu.instructions, cpu.cycles, seconds, extras[0] });
+    return true;
+}
+
+// Automation mode starts at $C000 and needs no PPU. Results are left at $02
+// and $03, zero when every test passed.
+static bool benchNestest(const char *path) {
+    Cartridge cartridge;
+    if(!cartridge.open(path)) {
+        platformLog("bench: %s: %s", path, cartridge.error);
+        return false;
+    }
+
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    uint8_t status = 0;
+
+    double start = now();
+    for(int i = 0; i < NESTEST_REPEAT; i++) {
+        CPU cpu;
+        cartridge.attach(cpu.bus);
+        cpu.registers.PC = NESTEST_START;
+        cpu.registers.SP = 0xFD;
+        cpu.registers.P  = 0x24;
+
+        while(cpu.instructions < NESTEST_INSTRUCTIONS) cpu.step();
+
+        instructions += cpu.instructions;
+        cycles += cpu.cycles;
+        status = cpu.memoryRead(0x0002) | cpu.memoryRead(0x0003);
+    }
+    double seconds = now() - start;
+
+    snprintf(extras[1], sizeof(extras[1]), "\"status\": %u, \"passed\": %s", status, status ? "false" : "true");
+    results.push_back({ "nestest", instructions, cycles, seconds, extras[1] });
+    return true;
+}
+
+static void printResults() {
+    printf("{\n  \"trace\": %s,\n  \"dispatch\": \"%s\",\n  \"benchmarks\": [\n",
+        TRACE_ENABLED ? "true" : "false", THREADED_DISPATCH ? "threaded" : CACHED_DISPATCH ? "cached" : DYNAREC_DISPATCH ? "dynarec" : "switch");
+
+    for(size_t i = 0; i < results.size(); i++) {
+        const result_t &r = results[i];
+
+        printf("    { \"name\": \"%s\", \"instructions\": %llu, \"cycles\": %llu, \"seconds\": %.6f, "
+               "\"mips\": %.3f, \"emulated_mhz\": %.3f, \"ns_per_instruction\": %.3f%s%s }%s\n",
+            r.name,
+            (unsigned long long) r.instructions,
+            (unsigned long long) r.cycles,
+            r.seconds,
+            r.instructions / r.seconds / 1e6,
+            r.cycles / r.seconds / 1e6,
+            r.instructions ? r.seconds * 1e9 / r.instructions : 0,
+            r.extra ? ", " : "",
+            r.extra ? r.extra : "",
+            i + 1 < results.size() ? "," : "");
+    }
+
+    printf("  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+    const char *klaus = nullptr;
+    const char *nestest = nullptr;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--klaus") && i + 1 < argc) {
+            klaus = argv[++i];
+        } else if(!strcmp(argv[i], "--nestest") && i + 1 < argc) {
+            nestest = argv[++i];
+        } else {
+            fprintf(stderr, "usage: bench-throughput [--klaus FILE] [--nestest FILE]\n");
+            return 2;
+        }
+    }
+
+    benchBranches();
+    benchIndirectIndexed();
+    benchSubroutines();
+    benchArithmetic();
+    benchEnv();
+    benchAPU();
+
+    bool ok = true;
+    if(klaus) ok &= benchKlaus(klaus);
+    if(nestest) ok &= benchNestest(nestest);
+
+    printResults();
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,755 @@
+#include "apu.h"
+#include "cpu.h"
+
+#include <math.h>
+#include <string.h>
+
+static const uint8_t LENGTHS[32] = {
+    10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+    12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+static const uint8_t DUTIES[4][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 1, 1, 0, 0, 0 },
+    { 1, 0, 0, 1, 1, 1, 1, 1 },
+};
+
+static const uint8_t TRIANGLE[32] = {
+    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+};
+
+// NTSC timer periods in CPU cycles
+static const uint16_t NOISE_PERIODS[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+};
+
+static const uint16_t DMC_RATES[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
+};
+
+// Frame counter steps, in CPU cycles from the start of the sequence
+static const uint32_t FOUR_STEP[4] = { 7457, 14913, 22371, 29829 };
+static const uint32_t FIVE_STEP[5] = { 7457, 14913, 22371, 29829, 37281 };
+static const uint32_t FOUR_STEP_PERIOD = 29830;
+static const uint32_t FIVE_STEP_PERIOD = 37282;
+
+static uint8_t registerRead(void *device, uint16_t address) {
+    return ((APU *) device)->readStatus();
+}
+
+static void registerWrite(void *device, uint16_t address, uint8_t value) {
+    ((APU *) device)->writeRegister(address, value);
+}
+
+// Band-limited steps
+
+BlepBuffer::BlepBuffer() {
+    // Windowed sinc a little below Nyquist, centred between the middle taps
+    // at phase 0. Each phase sums to one so a step settles at its full height.
+    const double cutoff = 0.9;
+    const double half = BLEP_TAPS / 2;
+
+    for(int phase = 0; phase < BLEP_PHASES; phase++) {
+        double offset = (double) phase / BLEP_PHASES;
+        double sum = 0;
+
+        for(int tap = 0; tap < BLEP_TAPS; tap++) {
+            double x = tap - (half - 1) - offset;
+            double sinc = x == 0 ? 1 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            double window = 0.42 + 0.5 * cos(M_PI * x / half) + 0.08 * cos(2 * M_PI * x / half);
+
+            kernel[phase][tap] = sinc * window;
+            sum += kernel[phase][tap];
+        }
+
+        for(int tap = 0; tap < BLEP_TAPS; tap++) kernel[phase][tap] /= sum;
+    }
+
+    rate = APU_SAMPLE_RATE / CPU_CLOCK_HZ;
+    setRatio(1.0);
+
+    reset(0);
+}
+
+void BlepBuffer::reset(uint64_t cycle) {
+    memset(buffer, 0, sizeof(buffer));
+
+    start = cycle;
+    fraction = 0;
+
+    level = 0;
+    previous = 0;
+    filtered = 0;
+}
+
+void BlepBuffer::setRatio(double ratio) {
+    step = (uint64_t) (rate * ratio * 4294967296.0);
+}
+
+void BlepBuffer::add(uint64_t cycle, float delta) {
+    uint64_t position = fraction + (cycle - start) * step;
+    size_t index = position >> 32;
+    const float *impulse = kernel[(position >> (32 - 5)) & (BLEP_PHASES - 1)];
+
+    float *out = buffer + index;
+    for(int tap = 0; tap < BLEP_TAPS; tap++) out[tap] += delta * impulse[tap];
+}
+
+size_t BlepBuffer::flush(uint64_t cycle, SpscRing<int16_t> &ring) {
+    uint64_t position = fraction + (cycle - start) * step;
+    size_t count = position >> 32;
+    size_t dropped = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        level += buffer[i];
+
+        // One pole high-pass at about 40 Hz
+        filtered = level - previous + 0.995f * filtered;
+        previous = level;
+
+        float sample = filtered * 28000.0f;
+        if(sample > 32767.0f) sample = 32767.0f;
+        if(sample < -32768.0f) sample = -32768.0f;
+
+        if(!ring.push((int16_t) sample)) dropped++;
+    }
+
+    // Keep the tails of impulses that reach past the last complete sample
+    size_t size = BLEP_BUFFER_SIZE + BLEP_TAPS;
+    memmove(buffer, buffer + count, (size - count) * sizeof(float));
+    memset(buffer + size - count, 0, count * sizeof(float));
+
+    start = cycle;
+    fraction = position & 0xFFFFFFFF;
+    return dropped;
+}
+
+// APU
+
+APU::APU() : output(true), samples(APU_RING_SIZE), cpu(nullptr) {
+    // Nonlinear mixer, as lookup tables over the summed channel levels
+    pulseTable[0] = 0;
+    for(int i = 1; i < 31; i++) pulseTable[i] = 95.52f / (8128.0f / i + 100.0f);
+
+    tndTable[0] = 0;
+    for(int i = 1; i < 203; i++) tndTable[i] = 163.67f / (24329.0f / i + 100.0f);
+
+    reset();
+}
+
+void APU::reset() {
+    memset(pulse, 0, sizeof(pulse));
+    memset(&triangle, 0, sizeof(triangle));
+    memset(&noise, 0, sizeof(noise));
+    memset(&dmc, 0, sizeof(dmc));
+
+    pulse[0].next = pulse[1].next = APU_NEVER;
+    triangle.next = APU_NEVER;
+    noise.next = APU_NEVER;
+    noise.shift = 1;
+    dmc.next = APU_NEVER;
+    dmc.bits = 8;
+    dmc.silence = true;
+
+    enabled = 0;
+    fiveStep = false;
+    irqInhibit = false;
+    frameIrq = false;
+    dmcIrq = false;
+    dropped = 0;
+
+    time = cpu ? cpu->cycles : 0;
+    frameStep = 0;
+    frameStart = time;
+
+    blep.reset(time);
+    mixing = output;
+    last = 0;
+
+    updateIRQs();
+    scheduleIRQs();
+}
+
+void APU::attach(CPU &cpu) {
+    this->cpu = &cpu;
+
+    for(uint16_t address = 0x4000; address <= 0x4013; address++) {
+        cpu.bus.mapRegister(address, this, nullptr, registerWrite);
+    }
+    cpu.bus.mapRegister(APU_STATUS, this, registerRead, registerWrite);
+    cpu.bus.mapRegister(APU_FRAME_COUNTER, this, nullptr, registerWrite);
+    cpu.apu = this;
+    cpu.events.setHandler(EVENT_APU_FRAME, this, irqEvent);
+    cpu.events.setHandler(EVENT_APU_DMC, this, irqEvent);
+
+    reset();
+}
+
+// Timing
+
+void APU::scheduleIRQs() {
+    if(!cpu) return;
+
+    // Step 3 of the four step sequence is always ahead: clockFrame moves
+    // frameStart on once it has passed
+    if(!fiveStep && !irqInhibit) cpu->events.schedule(EVENT_APU_FRAME, frameStart + FOUR_STEP[3]);
+    else cpu->events.cancel(EVENT_APU_FRAME);
+
+    // The last byte is fetched when the output unit empties its shift
+    // register for the remaining-th time
+    if(dmc.irqEnabled && !dmc.loop && dmc.remaining && dmc.next != APU_NEVER) {
+        uint64_t rate = DMC_RATES[dmc.rate];
+        cpu->events.schedule(EVENT_APU_DMC, dmc.next + (dmc.bits - 1) * rate + (dmc.remaining - 1) * 8 * rate);
+    } else {
+        cpu->events.cancel(EVENT_APU_DMC);
+    }
+}
+
+void APU::updateIRQs() {
+    if(!cpu) return;
+
+    cpu->setIRQ(IRQ_APU_FRAME, frameIrq);
+    cpu->setIRQ(IRQ_APU_DMC, dmcIrq);
+}
+
+void APU::irqEvent(void *device, uint64_t cycle) {
+    APU *apu = (APU *) device;
+
+    apu->run(cycle);
+    apu->updateIRQs();
+    apu->scheduleIRQs();
+}
+
+void APU::run(uint64_t cpuCycle) {
+    if(output != mixing) {
+        mixing = output;
+        blep.reset(time);
+        last = 0;
+    }
+
+    while(time < cpuCycle) {
+        uint64_t until = cpuCycle - time > APU_SLICE_CYCLES ? time + APU_SLICE_CYCLES : cpuCycle;
+        runSlice(until);
+
+        if(mixing) dropped += blep.flush(time, samples);
+    }
+}
+
+// Step from one event to the next until cycle until
+void APU::runSlice(uint64_t until) {
+    while(time < until) {
+        uint64_t frame = frameEvent();
+
+        uint64_t next = until;
+        if(frame < next) next = frame;
+        if(pulse[0].next < next) next = pulse[0].next;
+        if(pulse[1].next < next) next = pulse[1].next;
+        if(triangle.next < next) next = triangle.next;
+        if(noise.next < next) next = noise.next;
+        if(dmc.next < next) next = dmc.next;
+
+        time = next;
+
+        if(pulse[0].next == time) clockPulse(pulse[0]);
+        if(pulse[1].next == time) clockPulse(pulse[1]);
+        if(triangle.next == time) clockTriangle();
+        if(noise.next == time) clockNoise();
+        if(dmc.next == time) clockDMC();
+        if(frame == time) clockFrame();
+
+        updateLevel();
+    }
+}
+
+uint64_t APU::frameEvent() const {
+    return frameStart + (fiveStep ? FIVE_STEP[frameStep] : FOUR_STEP[frameStep]);
+}
+
+void APU::clockFrame() {
+    if(fiveStep) {
+        if(frameStep != 3) quarterFrame();
+        if(frameStep == 1 || frameStep == 4) halfFrame();
+
+        if(++frameStep == 5) {
+            frameStep = 0;
+            frameStart += FIVE_STEP_PERIOD;
+        }
+    } else {
+        quarterFrame();
+        if(frameStep == 1 || frameStep == 3) halfFrame();
+        if(frameStep == 3 && !irqInhibit) frameIrq = true;
+
+        if(++frameStep == 4) {
+            frameStep = 0;
+            frameStart += FOUR_STEP_PERIOD;
+        }
+    }
+
+    schedule();
+}
+
+static void clockEnvelope(apu_envelope_t &envelope) {
+    if(envelope.start) {
+        envelope.start = false;
+        envelope.decay = 15;
+        envelope.divider = envelope.volume;
+    } else if(envelope.divider == 0) {
+        envelope.divider = envelope.volume;
+        if(envelope.decay) envelope.decay--;
+        else if(envelope.loop) envelope.decay = 15;
+    } else {
+        envelope.divider--;
+    }
+}
+
+static uint8_t envelopeVolume(const apu_envelope_t &envelope) {
+    return envelope.constant ? envelope.volume : envelope.decay;
+}
+
+// Envelopes and the triangle's linear counter
+void APU::quarterFrame() {
+    clockEnvelope(pulse[0].envelope);
+    clockEnvelope(pulse[1].envelope);
+    clockEnvelope(noise.envelope);
+
+    if(triangle.linearReload) {
+        triangle.linear = triangle.linearPeriod;
+    } else if(triangle.linear) {
+        triangle.linear--;
+    }
+    if(!triangle.control) triangle.linearReload = false;
+}
+
+// Length counters and sweeps
+void APU::halfFrame() {
+    for(int i = 0; i < 2; i++) {
+        apu_pulse_t &channel = pulse[i];
+        if(!channel.envelope.loop && channel.length) channel.length--;
+
+        if(!channel.sweepDivider && channel.sweepEnabled && channel.sweepShift && !pulseMuted(channel, i)) {
+            channel.period = sweepTarget(channel, i);
+        }
+
+        if(!channel.sweepDivider || channel.sweepReload) {
+            channel.sweepDivider = channel.sweepPeriod;
+            channel.sweepReload = false;
+        } else {
+            channel.sweepDivider--;
+        }
+    }
+
+    if(!triangle.control && triangle.length) triangle.length--;
+    if(!noise.envelope.loop && noise.length) noise.length--;
+}
+
+// Pulse 1 negates in ones' complement, pulse 2 in twos' complement
+uint16_t APU::sweepTarget(const apu_pulse_t &channel, int index) const {
+    int change = channel.period >> channel.sweepShift;
+    if(!channel.sweepNegate) return channel.period + change;
+
+    int target = channel.period - change - (index == 0 ? 1 : 0);
+    return target < 0 ? 0 : target;
+}
+
+bool APU::pulseMuted(const apu_pulse_t &channel, int index) const {
+    return channel.period < 8 || (!channel.sweepNegate && sweepTarget(channel, index) > 0x7FF);
+}
+
+void APU::schedule() {
+    for(int i = 0; i < 2; i++) {
+        apu_pulse_t &channel = pulse[i];
+
+        bool audible = channel.length && envelopeVolume(channel.envelope) && !pulseMuted(channel, i);
+        if(!audible) channel.next = APU_NEVER;
+        else if(channel.next == APU_NEVER) channel.next = time + (channel.period + 1) * 2;
+    }
+
+    // Periods below 2 are ultrasonic, and left frozen
+    bool audible = triangle.length && triangle.linear && triangle.period >= 2;
+    if(!audible) triangle.next = APU_NEVER;
+    else if(triangle.next == APU_NEVER) triangle.next = time + triangle.period + 1;
+
+    audible = noise.length && envelopeVolume(noise.envelope);
+    if(!audible) noise.next = APU_NEVER;
+    else if(noise.next == APU_NEVER) noise.next = time + NOISE_PERIODS[noise.period];
+
+    bool active = dmc.remaining || dmc.buffered || !dmc.silence;
+    if(!active) dmc.next = APU_NEVER;
+    else if(dmc.next == APU_NEVER) dmc.next = time + DMC_RATES[dmc.rate];
+}
+
+void APU::clockPulse(apu_pulse_t &channel) {
+    channel.step = (channel.step + 1) & 7;
+    channel.next += (channel.period + 1) * 2;
+}
+
+void APU::clockTriangle() {
+    triangle.step = (triangle.step + 1) & 31;
+    triangle.next += triangle.period + 1;
+}
+
+void APU::clockNoise() {
+    uint16_t feedback = (noise.shift ^ (noise.shift >> (noise.mode ? 6 : 1))) & 0x01;
+    noise.shift = (noise.shift >> 1) | (feedback << 14);
+    noise.next += NOISE_PERIODS[noise.period];
+}
+
+void APU::clockDMC() {
+    if(!dmc.silence) {
+        if(dmc.shift & 0x01) {
+            if(dmc.level <= 125) dmc.level += 2;
+        } else if(dmc.level >= 2) {
+            dmc.level -= 2;
+        }
+    }
+    dmc.shift >>= 1;
+
+    if(!--dmc.bits) {
+        dmc.bits = 8;
+        dmc.silence = !dmc.buffered;
+        dmc.shift = dmc.buffer;
+        dmc.buffered = false;
+
+        fetchSample();
+    }
+
+    bool active = dmc.remaining || dmc.buffered || !dmc.silence;
+    dmc.next = active ? dmc.next + DMC_RATES[dmc.rate] : APU_NEVER;
+}
+
+void APU::fetchSample() {
+    if(dmc.buffered || !dmc.remaining) return;
+
+    dmc.buffer = cpu ? cpu->bus.read(dmc.address) : 0;
+    dmc.buffered = true;
+    dmc.address = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+
+    if(!--dmc.remaining) {
+        if(dmc.loop) startSample();
+        else if(dmc.irqEnabled) dmcIrq = true;
+    }
+}
+
+void APU::startSample() {
+    dmc.address = dmc.start;
+    dmc.remaining = dmc.sampleLength;
+}
+
+// Output
+
+float APU::mix() const {
+    int pulses = 0;
+    for(int i = 0; i < 2; i++) {
+        const apu_pulse_t &channel = pulse[i];
+        if(channel.length && !pulseMuted(channel, i) && DUTIES[channel.duty][channel.step]) {
+            pulses += envelopeVolume(channel.envelope);
+        }
+    }
+
+    int tri = TRIANGLE[triangle.step];
+    int noi = noise.length && !(noise.shift & 0x01) ? envelopeVolume(noise.envelope) : 0;
+
+    return pulseTable[pulses] + tndTable[3 * tri + 2 * noi + dmc.level];
+}
+
+void APU::updateLevel() {
+    if(!mixing) return;
+
+    float level = mix();
+    if(level == last) return;
+
+    blep.add(time, level - last);
+    last = level;
+}
+
+// Registers
+
+void APU::setRate(double ratio) {
+    blep.setRatio(ratio);
+}
+
+uint8_t APU::readStatus() {
+    if(cpu) run(cpu->cycles);
+
+    uint8_t value = (pulse[0].length ? 0x01 : 0)
+        | (pulse[1].length ? 0x02 : 0)
+        | (triangle.length ? 0x04 : 0)
+        | (noise.length    ? 0x08 : 0)
+        | (dmc.remaining   ? 0x10 : 0)
+        | (frameIrq ? APU_STATUS_FRAME_IRQ : 0)
+        | (dmcIrq   ? APU_STATUS_DMC_IRQ : 0);
+
+    frameIrq = false;
+    updateIRQs();
+    return value;
+}
+
+void APU::writeRegister(uint16_t address, uint8_t value) {
+    if(cpu) run(cpu->cycles);
+
+    switch(address) {
+        case 0x4000: case 0x4004: {
+            apu_pulse_t &channel = pulse[(address >> 2) & 1];
+            channel.duty = value >> 6;
+            channel.envelope.loop = value & 0x20;
+            channel.envelope.constant = value & 0x10;
+            channel.envelope.volume = value & 0x0F;
+            break;
+        }
+        case 0x4001: case 0x4005: {
+            apu_pulse_t &channel = pulse[(address >> 2) & 1];
+            channel.sweepEnabled = value & 0x80;
+            channel.sweepPeriod = (value >> 4) & 0x07;
+            channel.sweepNegate = value & 0x08;
+            channel.sweepShift = value & 0x07;
+            channel.sweepReload = true;
+            break;
+        }
+        case 0x4002: case 0x4006: {
+            apu_pulse_t &channel = pulse[(address >> 2) & 1];
+            channel.period = (channel.period & 0x0700) | value;
+            break;
+        }
+        case 0x4003: case 0x4007: {
+            int index = (address >> 2) & 1;
+            apu_pulse_t &channel = pulse[index];
+            channel.period = (channel.period & 0x00FF) | ((value & 0x07) << 8);
+            if(enabled & (1 << index)) channel.length = LENGTHS[value >> 3];
+            channel.step = 0;
+            channel.envelope.start = true;
+            break;
+        }
+        case 0x4008:
+            triangle.control = value & 0x80;
+            triangle.linearPeriod = value & 0x7F;
+            break;
+        case 0x400A:
+            triangle.period = (triangle.period & 0x0700) | value;
+            break;
+        case 0x400B:
+            triangle.period = (triangle.period & 0x00FF) | ((value & 0x07) << 8);
+            if(enabled & 0x04) triangle.length = LENGTHS[value >> 3];
+            triangle.linearReload = true;
+            break;
+        case 0x400C:
+            noise.envelope.loop = value & 0x20;
+            noise.envelope.constant = value & 0x10;
+            noise.envelope.volume = value & 0x0F;
+            break;
+        case 0x400E:
+            noise.mode = value & 0x80;
+            noise.period = value & 0x0F;
+            break;
+        case 0x400F:
+            if(enabled & 0x08) noise.length = LENGTHS[value >> 3];
+            noise.envelope.start = true;
+            break;
+        case 0x4010:
+            dmc.irqEnabled = value & 0x80;
+            dmc.loop = value & 0x40;
+            dmc.rate = value & 0x0F;
+            if(!dmc.irqEnabled) dmcIrq = false;
+            break;
+        case 0x4011:
+            dmc.level = value & 0x7F;
+            break;
+        case 0x4012:
+            dmc.start = 0xC000 + value * 64;
+            break;
+        case 0x4013:
+            dmc.sampleLength = value * 16 + 1;
+            break;
+        case APU_STATUS:
+            enabled = value & 0x1F;
+            if(!(enabled & 0x01)) pulse[0].length = 0;
+            if(!(enabled & 0x02)) pulse[1].length = 0;
+            if(!(enabled & 0x04)) triangle.length = 0;
+            if(!(enabled & 0x08)) noise.length = 0;
+
+            if(!(enabled & 0x10)) {
+                dmc.remaining = 0;
+            } else if(!dmc.remaining) {
+                startSample();
+                fetchSample();
+            }
+            dmcIrq = false;
+            break;
+        case APU_FRAME_COUNTER:
+            fiveStep = value & 0x80;
+            irqInhibit = value & 0x40;
+            if(irqInhibit) frameIrq = false;
+
+            frameStart = time;
+            frameStep = 0;
+            if(fiveStep) {
+                quarterFrame();
+                halfFrame();
+            }
+            break;
+    }
+
+    schedule();
+    updateLevel();
+
+    updateIRQs();
+    scheduleIRQs();
+}
+
+// Save states
+
+static void saveEnvelope(StateWriter &out, const apu_envelope_t &envelope) {
+    out.u8(envelope.start);
+    out.u8(envelope.loop);
+    out.u8(envelope.constant);
+    out.u8(envelope.volume);
+    out.u8(envelope.divider);
+    out.u8(envelope.decay);
+}
+
+static void loadEnvelope(StateReader &in, apu_envelope_t &envelope) {
+    envelope.start    = in.u8();
+    envelope.loop     = in.u8();
+    envelope.constant = in.u8();
+    envelope.volume   = in.u8();
+    envelope.divider  = in.u8();
+    envelope.decay    = in.u8();
+}
+
+size_t APU::stateSize() const {
+    return 2 * 25 + 16 + 19 + 25 + 22;
+}
+
+void APU::saveState(StateWriter &out) const {
+    out.begin("APU ");
+
+    for(const apu_pulse_t &channel : pulse) {
+        saveEnvelope(out, channel.envelope);
+        out.u8(channel.duty);
+        out.u8(channel.step);
+        out.u8(channel.length);
+        out.u16(channel.period);
+        out.u8(channel.sweepEnabled);
+        out.u8(channel.sweepNegate);
+        out.u8(channel.sweepReload);
+        out.u8(channel.sweepPeriod);
+        out.u8(channel.sweepShift);
+        out.u8(channel.sweepDivider);
+        out.u64(channel.next);
+    }
+
+    out.u8(triangle.control);
+    out.u8(triangle.linearReload);
+    out.u8(triangle.linearPeriod);
+    out.u8(triangle.linear);
+    out.u8(triangle.step);
+    out.u8(triangle.length);
+    out.u16(triangle.period);
+    out.u64(triangle.next);
+
+    saveEnvelope(out, noise.envelope);
+    out.u8(noise.mode);
+    out.u8(noise.period);
+    out.u8(noise.length);
+    out.u16(noise.shift);
+    out.u64(noise.next);
+
+    out.u8(dmc.irqEnabled);
+    out.u8(dmc.loop);
+    out.u8(dmc.rate);
+    out.u8(dmc.level);
+    out.u16(dmc.start);
+    out.u16(dmc.sampleLength);
+    out.u16(dmc.address);
+    out.u16(dmc.remaining);
+    out.u8(dmc.buffer);
+    out.u8(dmc.buffered);
+    out.u8(dmc.shift);
+    out.u8(dmc.bits);
+    out.u8(dmc.silence);
+    out.u64(dmc.next);
+
+    out.u8(enabled);
+    out.u8(fiveStep);
+    out.u8(irqInhibit);
+    out.u8(frameIrq);
+    out.u8(dmcIrq);
+    out.u8(frameStep);
+    out.u64(frameStart);
+    out.u64(time);
+
+    out.end();
+}
+
+// States from before the APU existed have no chunk, and start it afresh
+void APU::loadState(StateReader &in) {
+    if(!in.chunk("APU ")) {
+        reset();
+        return;
+    }
+
+    for(apu_pulse_t &channel : pulse) {
+        loadEnvelope(in, channel.envelope);
+        channel.duty         = in.u8() & 0x03;
+        channel.step         = in.u8() & 0x07;
+        channel.length       = in.u8();
+        channel.period       = in.u16() & 0x07FF;
+        channel.sweepEnabled = in.u8();
+        channel.sweepNegate  = in.u8();
+        channel.sweepReload  = in.u8();
+        channel.sweepPeriod  = in.u8();
+        channel.sweepShift   = in.u8();
+        channel.sweepDivider = in.u8();
+        channel.next         = in.u64();
+    }
+
+    triangle.control      = in.u8();
+    triangle.linearReload = in.u8();
+    triangle.linearPeriod = in.u8();
+    triangle.linear       = in.u8();
+    triangle.step         = in.u8() & 0x1F;
+    triangle.length       = in.u8();
+    triangle.period       = in.u16() & 0x07FF;
+    triangle.next         = in.u64();
+
+    loadEnvelope(in, noise.envelope);
+    noise.mode   = in.u8();
+    noise.period = in.u8() & 0x0F;
+    noise.length = in.u8();
+    noise.shift  = in.u16();
+    noise.next   = in.u64();
+
+    dmc.irqEnabled   = in.u8();
+    dmc.loop         = in.u8();
+    dmc.rate         = in.u8() & 0x0F;
+    dmc.level        = in.u8() & 0x7F;
+    dmc.start        = in.u16();
+    dmc.sampleLength = in.u16();
+    dmc.address      = in.u16();
+    dmc.remaining    = in.u16();
+    dmc.buffer       = in.u8();
+    dmc.buffered     = in.u8();
+    dmc.shift        = in.u8();
+    dmc.bits         = in.u8();
+    dmc.silence      = in.u8();
+    dmc.next         = in.u64();
+
+    enabled    = in.u8();
+    fiveStep   = in.u8();
+    irqInhibit = in.u8();
+    frameIrq   = in.u8();
+    dmcIrq     = in.u8();
+    frameStep  = in.u8() % (fiveStep ? 5 : 4);
+    frameStart = in.u64();
+    time       = in.u64();
+
+    // Resume the output from silence
+    blep.reset(time);
+    mixing = output;
+    last = 0;
+
+    updateIRQs();
+    scheduleIRQs();
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ring.h"
+#include "state.h"
+
+class CPU;
+
+const int    APU_SAMPLE_RATE = 48000;
+const size_t APU_RING_SIZE   = 8192;  // Samples, about 170 ms
+const uint64_t APU_SLICE_CYCLES = 8192; // Longest span synthesised at once
+
+// Band-limited steps: each level change is added as a windowed sinc impulse
+// at one of BLEP_PHASES sub-sample offsets, and samples are the running sum
+const int BLEP_TAPS   = 16;
+const int BLEP_PHASES = 32;
+const size_t BLEP_BUFFER_SIZE = 512; // Samples per slice, and then some
+
+const uint16_t APU_STATUS        = 0x4015;
+const uint16_t APU_FRAME_COUNTER = 0x4017;
+
+// $4015 reads
+#define APU_STATUS_FRAME_IRQ 0b01000000
+#define APU_STATUS_DMC_IRQ   0b10000000
+
+const uint64_t APU_NEVER = UINT64_MAX;
+
+typedef struct apu_envelope {
+    bool start;
+    bool loop;     // Also halts the length counter
+    bool constant;
+    uint8_t volume;
+    uint8_t divider;
+    uint8_t decay;
+} apu_envelope_t;
+
+typedef struct apu_pulse {
+    apu_envelope_t envelope;
+    uint8_t duty;
+    uint8_t step;
+    uint8_t length;
+    uint16_t period;
+
+    bool sweepEnabled;
+    bool sweepNegate;
+    bool sweepReload;
+    uint8_t sweepPeriod;
+    uint8_t sweepShift;
+    uint8_t sweepDivider;
+
+    uint64_t next; // CPU cycle of the next timer clock, APU_NEVER while silent
+} apu_pulse_t;
+
+typedef struct apu_triangle {
+    bool control;  // Also halts the length counter
+    bool linearReload;
+    uint8_t linearPeriod;
+    uint8_t linear;
+    uint8_t step;
+    uint8_t length;
+    uint16_t period;
+    uint64_t next;
+} apu_triangle_t;
+
+typedef struct apu_noise {
+    apu_envelope_t envelope;
+    bool mode;
+    uint8_t period; // Index into the period table
+    uint8_t length;
+    uint16_t shift;
+    uint64_t next;
+} apu_noise_t;
+
+typedef struct apu_dmc {
+    bool irqEnabled;
+    bool loop;
+    uint8_t rate;   // Index into the rate table
+    uint8_t level;
+    uint16_t start;
+    uint16_t sampleLength;
+
+    uint16_t address;
+    uint16_t remaining; // Sample bytes left to fetch
+    uint8_t buffer;
+    bool buffered;
+    uint8_t shift;
+    uint8_t bits;
+    bool silence;
+    uint64_t next;
+} apu_dmc_t;
+
+// Resamples a level that changes at CPU cycles to APU_SAMPLE_RATE
+class BlepBuffer {
+    public:
+        BlepBuffer();
+
+        // Start counting time from cycle, dropping anything buffered
+        void reset(uint64_t cycle);
+
+        // The level changed by delta at cycle, which is at or after the last
+        // flush and less than a slice later
+        void add(uint64_t cycle, float delta);
+
+        // Push every sample that is complete at cycle into ring, high-pass
+        // filtered to remove DC. Returns the number of samples dropped
+        // because the ring was full.
+        size_t flush(uint64_t cycle, SpscRing<int16_t> &ring);
+
+        // Make ratio times as many samples per CPU cycle, from the last flush
+        void setRatio(double ratio);
+
+    private:
+        float kernel[BLEP_PHASES][BLEP_TAPS];
+        float buffer[BLEP_BUFFER_SIZE + BLEP_TAPS];
+
+        // At CPU cycle start the buffer is fraction into its first sample,
+        // in 32.32 fixed point samples
+        uint64_t start;
+        uint64_t fraction;
+        uint64_t step; // Samples per CPU cycle, 32.32
+        double rate;   // APU_SAMPLE_RATE / CPU_CLOCK_HZ
+
+        float level;    // Running sum
+        float previous; // High-pass filter state
+        float filtered;
+};
+
+// 2A03 audio: two pulse channels, triangle, noise and DMC behind the frame
+// counter. Nothing runs per cycle. The APU catches up to the CPU cycle
+// counter when its registers are accessed and at the end of each frame,
+// jumping from one channel timer event to the next, and silent channels are
+// not clocked at all. Output is mixed through the nonlinear 2A03 mixer and
+// pushed into samples, which the audio device drains; when it falls behind
+// samples are dropped rather than the emulation waiting.
+//
+// Frame counter and DMC interrupts are put on the CPU's event timeline at
+// the cycle they are due, so the APU catches up and raises its IRQ lines on
+// time. DMC fetches don't steal CPU cycles.
+class APU {
+    public:
+        APU();
+
+        void reset();
+
+        // Map $4000-$4013, $4015 and $4017
+        void attach(CPU &cpu);
+
+        // Catch up to the given CPU cycle
+        void run(uint64_t cpuCycle);
+
+        // CPU side registers
+        uint8_t readStatus();
+        void writeRegister(uint16_t address, uint8_t value);
+
+        // Scale the output sample rate slightly, to keep the audio device fed
+        // when its clock and the emulation's drift apart
+        void setRate(double ratio);
+
+        // "APU " chunk of a save state. Buffered samples are not saved.
+        size_t stateSize() const;
+        void saveState(StateWriter &out) const;
+        void loadState(StateReader &in);
+
+        // Mix and resample. Off, channels still run so $4015 and the DMC
+        // behave the same, but no samples are produced.
+        bool output;
+
+        SpscRing<int16_t> samples;
+        uint64_t dropped;
+
+        apu_pulse_t pulse[2];
+        apu_triangle_t triangle;
+        apu_noise_t noise;
+        apu_dmc_t dmc;
+
+        uint8_t enabled; // $4015 channel bits
+        bool fiveStep;
+        bool irqInhibit;
+        bool frameIrq;
+        bool dmcIrq;
+        uint8_t frameStep;
+        uint64_t frameStart; // CPU cycle the frame counter sequence started
+
+        uint64_t time; // CPU cycle the APU has reached
+
+    private:
+        void runSlice(uint64_t until);
+        void clockFrame();
+        void quarterFrame();
+        void halfFrame();
+
+        void clockPulse(apu_pulse_t &channel);
+        void clockTriangle();
+        void clockNoise();
+        void clockDMC();
+        void fetchSample();
+        void startSample();
+
+        // Start or stop the timers of channels that became audible or silent
+        void schedule();
+        uint64_t frameEvent() const;
+
+        // Put the next frame and DMC interrupts on the CPU's timeline, and
+        // drive the IRQ lines from the flags
+        void scheduleIRQs();
+        void updateIRQs();
+        static void irqEvent(void *device, uint64_t cycle);
+
+        // Resample the mixer output if it changed at time
+        void updateLevel();
+
+        uint16_t sweepTarget(const apu_pulse_t &channel, int index) const;
+        bool pulseMuted(const apu_pulse_t &channel, int index) const;
+        float mix() const;
+
+        CPU *cpu;
+
+        BlepBuffer blep;
+        bool mixing; // output, as of the last catch up
+        float last;  // Mixer output at time
+
+        float pulseTable[31];
+        float tndTable[203];
+};
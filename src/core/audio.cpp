@@ -0,0 +1,51 @@
+#include "audio.h"
+#include "apu.h"
+#include "platform.h"
+
+AudioOutput::AudioOutput() : underruns(0), samples(nullptr), open(false) {
+}
+
+AudioOutput::~AudioOutput() {
+    if(open) SDL_CloseAudio();
+}
+
+bool AudioOutput::init(SpscRing<int16_t> &samples) {
+    this->samples = &samples;
+
+    if(SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        platformLog("audio: %s", SDL_GetError());
+        return false;
+    }
+
+    // About 21 ms per callback, well inside what the ring holds
+    SDL_AudioSpec spec = {};
+    spec.freq = APU_SAMPLE_RATE;
+    spec.format = AUDIO_S16SYS;
+    spec.channels = 1;
+    spec.samples = 1024;
+    spec.callback = callback;
+    spec.userdata = this;
+
+    if(SDL_OpenAudio(&spec, nullptr) != 0) {
+        platformLog("audio: %s", SDL_GetError());
+        return false;
+    }
+
+    open = true;
+    SDL_PauseAudio(0);
+    return true;
+}
+
+void AudioOutput::callback(void *userdata, Uint8 *stream, int length) {
+    AudioOutput *audio = (AudioOutput *) userdata;
+    int16_t *out = (int16_t *) stream;
+    int count = length / sizeof(int16_t);
+
+    int i = 0;
+    while(i < count && audio->samples->pop(out[i])) i++;
+
+    if(i < count) {
+        audio->underruns += count - i;
+        for(; i < count; i++) out[i] = 0;
+    }
+}
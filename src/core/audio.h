@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <SDL/SDL.h>
+
+#include "ring.h"
+
+// Plays an APU's sample ring through SDL. The audio callback runs on SDL's
+// thread and is the ring's only consumer; when the ring runs dry it plays
+// silence instead of waiting, so neither side ever blocks the other.
+class AudioOutput {
+    public:
+        AudioOutput();
+        ~AudioOutput();
+
+        AudioOutput(const AudioOutput &) = delete;
+        AudioOutput &operator=(const AudioOutput &) = delete;
+
+        // Open the device at APU_SAMPLE_RATE, mono, and start playing
+        bool init(SpscRing<int16_t> &samples);
+
+        // Samples of silence played because the ring was empty
+        uint64_t underruns;
+
+    private:
+        static void callback(void *userdata, Uint8 *stream, int length);
+
+        SpscRing<int16_t> *samples;
+        bool open;
+};
@@ -0,0 +1,93 @@
+#include "batch.h"
+#include "machine.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+BatchRunner::BatchRunner(size_t threads) : threads(threads), stolen(0) {
+    if(!this->threads) this->threads = std::thread::hardware_concurrency();
+    if(!this->threads) this->threads = 1;
+
+    queues.reset(new queue_t[this->threads]);
+
+    frames = 0;
+    steals = 0;
+    seconds = 0;
+    jobs = nullptr;
+    results = nullptr;
+}
+
+void BatchRunner::run(const batch_job_t *jobs, batch_result_t *results, size_t count) {
+    this->jobs = jobs;
+    this->results = results;
+    stolen = 0;
+
+    for(size_t i = 0; i < count; i++) queues[i % threads].jobs.push_back(i);
+
+    auto start = std::chrono::steady_clock::now();
+
+    // The calling thread is worker 0
+    std::vector<std::thread> pool;
+    for(size_t i = 1; i < threads; i++) pool.emplace_back(&BatchRunner::work, this, i);
+    work(0);
+    for(std::thread &thread : pool) thread.join();
+
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    steals = stolen;
+
+    frames = 0;
+    for(size_t i = 0; i < count; i++) frames += results[i].frames;
+}
+
+// Own work from the back, stolen work from the front. No job adds more, so
+// once every queue is empty the run is over.
+bool BatchRunner::next(size_t index, size_t &job) {
+    {
+        std::lock_guard<std::mutex> guard(queues[index].lock);
+        if(!queues[index].jobs.empty()) {
+            job = queues[index].jobs.back();
+            queues[index].jobs.pop_back();
+            return true;
+        }
+    }
+
+    for(size_t i = 1; i < threads; i++) {
+        queue_t &victim = queues[(index + i) % threads];
+
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if(!victim.jobs.empty()) {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            stolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void BatchRunner::work(size_t index) {
+    size_t i;
+    while(next(index, i)) {
+        const batch_job_t &job = jobs[i];
+        batch_result_t &result = results[i];
+
+        Machine machine;
+        result.ok = job.image ? machine.load(job.image, job.size) : machine.open(job.path);
+        result.error = machine.error;
+        machine.apu.output = false;
+
+        if(result.ok && job.movie) {
+            result.ok = machine.play(*job.movie);
+            result.error = machine.error;
+        } else if(result.ok) {
+            machine.runFrames(job.frames);
+        }
+
+        result.frames = machine.cpu.frames;
+        result.cycles = machine.cpu.cycles;
+        result.instructions = machine.cpu.instructions;
+        result.checksum = machine.checksum();
+    }
+}
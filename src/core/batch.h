@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+class Movie;
+
+// A ROM or raw program to run for a number of frames on a fresh Machine, or
+// to replay a movie on. image, when set, is used instead of reading path;
+// images and movies are shared by every job that points at them and must
+// outlive the run.
+typedef struct batch_job {
+    const char *path;
+    const uint8_t *image;
+    size_t size;
+    uint64_t frames;     // Ignored when there is a movie
+    const Movie *movie;
+} batch_job_t;
+
+typedef struct batch_result {
+    bool ok;
+    const char *error;
+    uint64_t frames;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t checksum; // Machine::checksum at the end of the job
+} batch_result_t;
+
+// Runs independent jobs on a pool of threads. Jobs are dealt round robin to
+// one deque per thread; a thread takes work from the back of its own and,
+// once that is empty, steals from the front of the others, so long and short
+// jobs even out across cores.
+class BatchRunner {
+    public:
+        // threads 0 uses every hardware thread
+        BatchRunner(size_t threads = 0);
+
+        BatchRunner(const BatchRunner &) = delete;
+        BatchRunner &operator=(const BatchRunner &) = delete;
+
+        // Run count jobs, filling results in job order. Returns when all are done.
+        void run(const batch_job_t *jobs, batch_result_t *results, size_t count);
+
+        size_t threads;
+
+        // Totals of the last run
+        uint64_t frames;
+        uint64_t steals;
+        double seconds;
+
+        double framesPerSecond() const { return seconds > 0 ? frames / seconds : 0; }
+
+    private:
+        typedef struct queue {
+            std::mutex lock;
+            std::deque<size_t> jobs;
+        } queue_t;
+
+        void work(size_t index);
+        bool next(size_t index, size_t &job);
+
+        std::unique_ptr<queue_t[]> queues;
+
+        const batch_job_t *jobs;
+        batch_result_t *results;
+        std::atomic<uint64_t> stolen;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+class CPU;
+
+typedef void (*decoded_execute_t)(CPU &cpu, uint8_t arg0, uint8_t arg1);
+
+// One instruction of a cached block, with its operand bytes already fetched
+typedef struct decoded {
+    decoded_execute_t execute;
+    uint8_t arg0;
+    uint8_t arg1;
+    uint8_t bytes;
+    uint8_t cycles; // Base cycles, before page crossing and branch penalties
+} decoded_t;
+
+const int BLOCK_MAX_INSTRUCTIONS = 16;
+const int BLOCK_CACHE_SIZE       = 4096; // Direct mapped on the low bits of PC
+
+// Straight-line code from pc up to and including the first control-flow
+// instruction. Blocks never leave the page they start on, so they are valid
+// while that page's generation in the Bus is unchanged.
+typedef struct block {
+    uint64_t generation;
+    uint16_t pc;
+    uint8_t  alias; // Page in Bus::generations that covers pc
+    uint8_t  count; // 0 for an empty slot
+    decoded_t ops[BLOCK_MAX_INSTRUCTIONS];
+} block_t;
@@ -0,0 +1,91 @@
+#include "bus.h"
+
+// Unmapped I/O reads return 0 and writes are ignored
+static uint8_t openBusRead(void *device, uint16_t address) {
+    return 0x00;
+}
+
+static void openBusWrite(void *device, uint16_t address, uint8_t value) {
+}
+
+// Dispatch $4000-$40FF to the register handlers, the rest of the page is open bus
+static uint8_t registerRead(void *device, uint16_t address) {
+    if(address > MEM_APU_IO_END) return 0x00;
+
+    const bus_device_t &io = ((Bus *) device)->registers[address - MEM_APU_IO_START];
+    return io.read(io.device, address);
+}
+
+static void registerWrite(void *device, uint16_t address, uint8_t value) {
+    if(address > MEM_APU_IO_END) return;
+
+    const bus_device_t &io = ((Bus *) device)->registers[address - MEM_APU_IO_START];
+    if(io.write) io.write(io.device, address, value);
+}
+
+Bus::Bus() : generations(), decoded(), aliases(), ram(new uint8_t[0x10000]()) {
+    mapNES();
+}
+
+void Bus::mapNES() {
+    mapFlat();
+    mapMemory(MEM_RAM_START >> 8, MEM_RAM_END >> 8, ram.get(), MEM_RAM_SIZE, true);
+    mapDevice(MEM_PPU_REGISTERS_START >> 8, MEM_PPU_REGISTERS_END >> 8, nullptr, openBusRead, openBusWrite);
+    mapDevice(MEM_APU_IO_START >> 8, MEM_APU_IO_START >> 8, this, registerRead, registerWrite);
+
+    for(bus_device_t &io : registers) {
+        io = { nullptr, openBusRead, openBusWrite };
+    }
+}
+
+// Invalidate code decoded from both the old and the new backing of a page
+void Bus::remap(uint8_t page, uint8_t alias) {
+    generations[aliases[page]]++;
+    aliases[page] = alias;
+    generations[alias]++;
+}
+
+void Bus::modified(uint8_t alias) {
+    decoded[alias] = false;
+    generations[alias]++;
+}
+
+void Bus::invalidate() {
+    for(uint64_t &generation : generations) generation++;
+}
+
+void Bus::mapFlat() {
+    mapMemory(0x00, 0xFF, ram.get(), 0x10000, true);
+}
+
+void Bus::mapMemory(uint8_t first, uint8_t last, uint8_t *memory, size_t size, bool writable) {
+    size_t pageCount = size >> 8;
+
+    for(size_t page = first; page <= last; page++) {
+        size_t mirror = (page - first) % pageCount;
+        uint8_t *start = memory + (mirror << 8);
+
+        readPages[page] = start;
+        writePages[page] = writable ? start : nullptr;
+        devices[page] = { nullptr, openBusRead, nullptr };
+        remap(page, first + mirror);
+    }
+}
+
+void Bus::mapDevice(uint8_t first, uint8_t last, void *device, bus_read_t read, bus_write_t write) {
+    for(size_t page = first; page <= last; page++) {
+        readPages[page] = nullptr;
+        writePages[page] = nullptr;
+        devices[page] = { device, read, write };
+        remap(page, page);
+    }
+}
+
+void Bus::mapRegister(uint16_t address, void *device, bus_read_t read, bus_write_t write) {
+    registers[address - MEM_APU_IO_START] = { device, read ? read : openBusRead, write };
+}
+
+uint8_t *Bus::pointer(uint16_t address) {
+    uint8_t *page = readPages[address >> 8];
+    return page ? page + (address & 0xFF) : nullptr;
+}
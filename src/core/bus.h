@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+#include "memory.h"
+
+// I/O handlers receive the full CPU address and do their own mirroring
+typedef uint8_t (*bus_read_t)(void *device, uint16_t address);
+typedef void (*bus_write_t)(void *device, uint16_t address, uint8_t value);
+
+typedef struct bus_device {
+    void *device;
+    bus_read_t read;
+    bus_write_t write;
+} bus_device_t;
+
+class Bus {
+    public:
+        Bus();
+
+        Bus(const Bus &) = delete;
+        Bus &operator=(const Bus &) = delete;
+
+        // NES layout: 2 KB of internal RAM mirrored up to $1FFF, open bus
+        // for the PPU and APU/IO registers and RAM everywhere else until a
+        // cartridge or device is mapped over it
+        void mapNES();
+
+        // 64 KB of plain RAM, for 6502 test programs written for a bare CPU
+        void mapFlat();
+
+        // Map pages [first, last] to memory, repeating it if it is smaller
+        // than the range. Writes are dropped when writable is false.
+        void mapMemory(uint8_t first, uint8_t last, uint8_t *memory, size_t size, bool writable);
+        void mapDevice(uint8_t first, uint8_t last, void *device, bus_read_t read, bus_write_t write);
+
+        // The APU and I/O registers at $4000-$401F share a page, so they are
+        // mapped one register at a time
+        void mapRegister(uint16_t address, void *device, bus_read_t read, bus_write_t write);
+
+        inline uint8_t read(uint16_t address) {
+            uint8_t *page = readPages[address >> 8];
+            if(page) return page[address & 0xFF];
+
+            const bus_device_t &io = devices[address >> 8];
+            return io.read(io.device, address);
+        }
+
+        inline void write(uint16_t address, uint8_t value) {
+            uint8_t *page = writePages[address >> 8];
+            if(page) {
+                page[address & 0xFF] = value;
+
+                uint8_t alias = aliases[address >> 8];
+                if(decoded[alias]) modified(alias);
+                return;
+            }
+
+            const bus_device_t &io = devices[address >> 8];
+            if(io.write) io.write(io.device, address, value);
+        }
+
+        // Direct pointer to a memory mapped address, null for I/O
+        uint8_t *pointer(uint16_t address);
+
+        // One entry per 256 byte page of the CPU address space. Memory pages
+        // point straight at their bytes; pages without a pointer (I/O, and
+        // ROM for writes) go through the device instead.
+        uint8_t *readPages[256];
+        uint8_t *writePages[256];
+        bus_device_t devices[256];
+        bus_device_t registers[MEM_APU_IO_END - MEM_APU_IO_START + 1];
+
+        // Bumped whenever a page is remapped, and on a write to a page that
+        // code has been decoded from since its last bump, so decoded code can
+        // tell when its bytes may have changed. Mirrors share the counter of
+        // the first page of their memory. Whoever decodes from a page sets
+        // its decoded flag; the bump clears it.
+        uint64_t generations[256];
+        bool decoded[256];
+        uint8_t aliases[256];
+        void remap(uint8_t page, uint8_t alias);
+
+        // Out of line so write() stays small enough to inline everywhere
+        void modified(uint8_t alias);
+
+        // Bump every generation, after memory changed behind the bus's back
+        void invalidate();
+
+        // Backing store for internal RAM and every page not mapped elsewhere
+        std::unique_ptr<uint8_t[]> ram;
+};
@@ -0,0 +1,138 @@
+#include "cartridge.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+Cartridge::Cartridge() : mapping(nullptr), mappingSize(0) {
+    close();
+}
+
+Cartridge::~Cartridge() {
+    close();
+}
+
+void Cartridge::close() {
+    if(mapping) munmap(mapping, mappingSize);
+    mapping = nullptr;
+    mappingSize = 0;
+
+    mapper    = 0;
+    submapper = 0;
+    mirroring = MirrorHorizontal;
+    battery   = false;
+    nes20     = false;
+    prg       = nullptr;
+    prgSize   = 0;
+    chr       = nullptr;
+    chrSize   = 0;
+    error     = nullptr;
+}
+
+bool Cartridge::open(const char *path) {
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0) {
+        error = "cannot open file";
+        return false;
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) < 0 || info.st_size < (off_t) INES_HEADER_SIZE) {
+        ::close(fd);
+        error = "file too small for an iNES header";
+        return false;
+    }
+
+    void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if(data == MAP_FAILED) {
+        error = "cannot map file";
+        return false;
+    }
+
+    if(!load((const uint8_t *) data, info.st_size)) {
+        const char *reason = error;
+        munmap(data, info.st_size);
+        close();
+        error = reason;
+        return false;
+    }
+
+    mapping = data;
+    mappingSize = info.st_size;
+    return true;
+}
+
+bool Cartridge::isImage(const uint8_t *image, size_t size) {
+    return size >= INES_HEADER_SIZE && !memcmp(image, "NES\x1A", 4);
+}
+
+// NES 2.0 sizes with the MSB nibble set to $F use exponent-multiplier form
+static size_t romSize(uint8_t lsb, uint8_t msb, size_t unit) {
+    if(msb == 0x0F) return ((size_t) 1 << (lsb >> 2)) * ((lsb & 0x03) * 2 + 1);
+    return (((size_t) msb << 8) | lsb) * unit;
+}
+
+bool Cartridge::load(const uint8_t *image, size_t size) {
+    // Drop any mapped file, and leave nothing to attach if the image is rejected
+    close();
+
+    if(!isImage(image, size)) {
+        error = "not an iNES image";
+        return false;
+    }
+
+    uint8_t flags6 = image[6];
+    uint8_t flags7 = image[7];
+
+    nes20 = (flags7 & 0x0C) == 0x08;
+
+    mapper    = (flags7 & 0xF0) | (flags6 >> 4);
+    mirroring = (flags6 & 0x08) ? MirrorFourScreen : (flags6 & 0x01) ? MirrorVertical : MirrorHorizontal;
+    battery   = flags6 & 0x02;
+
+    if(nes20) {
+        mapper   |= (image[8] & 0x0F) << 8;
+        submapper = image[8] >> 4;
+        prgSize   = romSize(image[4], image[9] & 0x0F, PRG_BANK_SIZE);
+        chrSize   = romSize(image[5], image[9] >> 4, CHR_BANK_SIZE);
+    } else {
+        prgSize   = image[4] * PRG_BANK_SIZE;
+        chrSize   = image[5] * CHR_BANK_SIZE;
+    }
+
+    size_t offset = INES_HEADER_SIZE + ((flags6 & 0x04) ? INES_TRAINER_SIZE : 0);
+    if(prgSize == 0 || offset + prgSize + chrSize > size) {
+        error = "truncated PRG/CHR data";
+        return false;
+    }
+
+    if(mapper != 0) {
+        error = "unsupported mapper";
+        return false;
+    }
+    if(prgSize != PRG_BANK_SIZE && prgSize != 2 * PRG_BANK_SIZE) {
+        error = "NROM expects 16 or 32 KB of PRG-ROM";
+        return false;
+    }
+
+    prg = image + offset;
+    chr = chrSize ? image + offset + prgSize : nullptr;
+
+    memset(chrRam, 0, sizeof(chrRam));
+    return true;
+}
+
+bool Cartridge::attach(Bus &bus) {
+    if(!prg) return false;
+
+    // NROM-128 mirrors its single bank into $C000-$FFFF. The pages are
+    // mapped read-only, so the const cast never leads to a write.
+    bus.mapMemory(MEM_PRG_ROM_START >> 8, 0xFF, (uint8_t *) prg, prgSize, false);
+    return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bus.h"
+
+const size_t INES_HEADER_SIZE  = 16;
+const size_t INES_TRAINER_SIZE = 512;
+const size_t PRG_BANK_SIZE     = 0x4000;
+const size_t CHR_BANK_SIZE     = 0x2000;
+
+const uint16_t MEM_PRG_ROM_START = 0x8000;
+
+enum Mirroring {
+    MirrorHorizontal,
+    MirrorVertical,
+    MirrorFourScreen,
+};
+
+// An iNES / NES 2.0 image. Files are mapped read-only and PRG/CHR point into
+// the mapping, so opening a ROM neither copies nor allocates.
+class Cartridge {
+    public:
+        Cartridge();
+        ~Cartridge();
+
+        Cartridge(const Cartridge &) = delete;
+        Cartridge &operator=(const Cartridge &) = delete;
+
+        // Map a .nes file, or parse an image already in memory (not copied,
+        // must outlive the cartridge). On failure error says why.
+        bool open(const char *path);
+        bool load(const uint8_t *image, size_t size);
+        void close();
+
+        // Map PRG-ROM into $8000-$FFFF
+        bool attach(Bus &bus);
+
+        static bool isImage(const uint8_t *image, size_t size);
+
+        // Header
+        uint16_t mapper;
+        uint8_t  submapper;
+        uint8_t  mirroring;
+        bool     battery;
+        bool     nes20;
+
+        const uint8_t *prg;
+        size_t prgSize;
+        const uint8_t *chr;
+        size_t chrSize;
+
+        // Boards without CHR-ROM have 8 KB of CHR-RAM instead
+        uint8_t chrRam[CHR_BANK_SIZE];
+
+        const char *error;
+
+    private:
+        void *mapping;
+        size_t mappingSize;
+};
@@ -1,4 +1,9 @@
 #include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+
+#include <thread>
+#include <utility>
 
 CPU::CPU() {
     // Initialize registers
@@ -8,6 +13,19 @@ CPU::CPU() {
     registers.X  = 0x00;
     registers.Y  = 0x00;
     registers.P  = 0x00;
+
+    setStatus(registers.P);
+
+    cycles       = 0;
+    instructions = 0;
+    pageCrossed  = 0;
+    frames       = 0;
+    trace        = nullptr;
+    ppu          = nullptr;
+    apu          = nullptr;
+    input        = nullptr;
+    irqLines     = 0;
+    nmi          = false;
 }
 
 CPU::~CPU() {
@@ -21,228 +39,573 @@ void CPU::reset() {
     registers.A  = 0x00;
     registers.X  = 0x00;
     registers.Y  = 0x00;
-    registers.P  = 0x00;
-}
-
-instruction_t CPU::fetch(uint8_t opcode) {
-    return instructionSet.at(opcode);
+    registers.P  = FLAG_INTERRUPT;
+
+    setStatus(registers.P);
+    nmi = false;
+}
+
+const instruction_t *CPU::fetch(uint8_t opcode) {
+    return &instructionSet[opcode];
+}
+
+// Operand of one addressing mode, resolved at compile time: the effective
+// address, or the value itself for Immediate and the offset for Relative
+template<uint8_t MODE>
+inline uint16_t CPU::address(uint8_t arg0, uint8_t arg1) {
+    uint16_t base;
+    uint16_t address;
+
+    if constexpr (MODE == Immediate) {
+        return (uint16_t) arg0;
+    } else if constexpr (MODE == ZeroPage) {
+        return (uint16_t) memoryReadu16(arg0);
+    } else if constexpr (MODE == ZeroPage_X) {
+        return (uint16_t) memoryReadu16(arg0 + registers.X);
+    } else if constexpr (MODE == ZeroPage_Y) {
+        return (uint16_t) memoryReadu16(arg0 + registers.Y);
+    } else if constexpr (MODE == Absolute) {
+        return CONCAT(arg0, arg1);
+    } else if constexpr (MODE == Absolute_X || MODE == Absolute_Y) {
+        base = CONCAT(arg0, arg1);
+        address = base + (MODE == Absolute_X ? registers.X : registers.Y);
+        pageCrossed = (base ^ address) > 0xFF;
+        return address;
+    } else if constexpr (MODE == Indirect) {
+        return memoryReadu16(CONCAT(arg0, arg1));
+    } else if constexpr (MODE == Indirect_X) {
+        // Pointers live in the zero page and wrap around inside it
+        arg0 += registers.X;
+        return CONCAT(memoryRead(arg0), memoryRead((uint8_t) (arg0 + 1)));
+    } else if constexpr (MODE == Indirect_Y) {
+        base = CONCAT(memoryRead(arg0), memoryRead((uint8_t) (arg0 + 1)));
+        address = base + registers.Y;
+        pageCrossed = (base ^ address) > 0xFF;
+        return address;
+    } else if constexpr (MODE == Relative) {
+        return (int8_t) arg0;
+    } else {
+        return 0x0000;
+    }
 }
 
+// Runtime addressing mode, for callers that only have a table entry
 uint16_t CPU::decode(uint8_t arg0, uint8_t arg1, uint8_t mode) {
+    pageCrossed = 0;
+
     switch(mode) {
-        case Immediate:
-            return (uint16_t) arg0;
-        case ZeroPage:
-            return (uint16_t) memoryReadu16(arg0);
-        case ZeroPage_X:
-            return (uint16_t) memoryReadu16(arg0 + registers.X);
-        case ZeroPage_Y:
-            return (uint16_t) memoryReadu16(arg0 + registers.Y);
-        case Absolute:
-            return CONCAT(arg0, arg1);
-        case Absolute_X:
-            return CONCAT(arg0, arg1) + registers.X;
-        case Absolute_Y:
-            return CONCAT(arg0, arg1) + registers.Y;
-        case Indirect:
-            return memoryReadu16(CONCAT(arg0, arg1));
-        case Indirect_X:
-            return memoryReadu16(CONCAT(arg0, arg1)) + registers.X;
-        case Indirect_Y:
-            return memoryReadu16(CONCAT(arg0, arg1)) + registers.Y;
-        case Relative:
-            return (int8_t) arg0;
+        case Immediate:  return address<Immediate>(arg0, arg1);
+        case ZeroPage:   return address<ZeroPage>(arg0, arg1);
+        case ZeroPage_X: return address<ZeroPage_X>(arg0, arg1);
+        case ZeroPage_Y: return address<ZeroPage_Y>(arg0, arg1);
+        case Absolute:   return address<Absolute>(arg0, arg1);
+        case Absolute_X: return address<Absolute_X>(arg0, arg1);
+        case Absolute_Y: return address<Absolute_Y>(arg0, arg1);
+        case Indirect:   return address<Indirect>(arg0, arg1);
+        case Indirect_X: return address<Indirect_X>(arg0, arg1);
+        case Indirect_Y: return address<Indirect_Y>(arg0, arg1);
+        case Relative:   return address<Relative>(arg0, arg1);
         default:
             return 0x0000; // TODO: Throw error
     }
 }
 
 
-void CPU::exec(instruction_t *instr, uint8_t opcode, uint16_t arg) {
+void CPU::exec(const instruction_t *instr, uint16_t arg) {
     // Execute instruction
-    switch(instr->name) {
-        case INSTR_BRK: BRK(instr->mode, arg); break;
-
-        case INSTR_ADC: ADC(instr->mode, arg); break;
-        case INSTR_AND: AND(instr->mode, arg); break;
-        case INSTR_ASL: ASL(instr->mode, arg); break;
-        case INSTR_BCC: BCC(instr->mode, arg); break;
-        case INSTR_BCS: BCS(instr->mode, arg); break;
-        case INSTR_BEQ: BEQ(instr->mode, arg); break;
-        case INSTR_BIT: BIT(instr->mode, arg); break;
-        case INSTR_BMI: BMI(instr->mode, arg); break;
-        case INSTR_BNE: BNE(instr->mode, arg); break;
-        case INSTR_BPL: BPL(instr->mode, arg); break;
-        case INSTR_BVC: BVC(instr->mode, arg); break;
-        case INSTR_BVS: BVS(instr->mode, arg); break;
-        case INSTR_CLC: CLC(instr->mode, arg); break;
-        case INSTR_CLD: CLD(instr->mode, arg); break;
-        case INSTR_CLI: CLI(instr->mode, arg); break;
-        case INSTR_CLV: CLV(instr->mode, arg); break;
-        case INSTR_CMP: CMP(instr->mode, arg); break;
-        case INSTR_CPX: CPX(instr->mode, arg); break;
-        case INSTR_CPY: CPY(instr->mode, arg); break;
-        case INSTR_DEC: DEC(instr->mode, arg); break;
-        case INSTR_DEX: DEX(instr->mode, arg); break;
-        case INSTR_DEY: DEY(instr->mode, arg); break;
-        case INSTR_EOR: EOR(instr->mode, arg); break;
-        case INSTR_INC: INC(instr->mode, arg); break;
-        case INSTR_INX: INX(instr->mode, arg); break;
-        case INSTR_INY: INY(instr->mode, arg); break;
-        case INSTR_JMP: JMP(instr->mode, arg); break;
-        case INSTR_JSR: JSR(instr->mode, arg); break;
-        case INSTR_LDA: LDA(instr->mode, arg); break;
-        case INSTR_LDX: LDX(instr->mode, arg); break;
-        case INSTR_LDY: LDY(instr->mode, arg); break;
-        case INSTR_LSR: LSR(instr->mode, arg); break;
-        case INSTR_NOP: NOP(instr->mode, arg); break;
-        case INSTR_ORA: ORA(instr->mode, arg); break;
-        case INSTR_PHA: PHA(instr->mode, arg); break;
-        case INSTR_PHP: PHP(instr->mode, arg); break;
-        case INSTR_PLA: PLA(instr->mode, arg); break;
-        case INSTR_PLP: PLP(instr->mode, arg); break;
-        case INSTR_ROL: ROL(instr->mode, arg); break;
-        case INSTR_ROR: ROR(instr->mode, arg); break;
-        case INSTR_RTI: RTI(instr->mode, arg); break;
-        case INSTR_RTS: RTS(instr->mode, arg); break;
-        case INSTR_SBC: SBC(instr->mode, arg); break;
-        case INSTR_SEC: SEC(instr->mode, arg); break;
-        case INSTR_SED: SED(instr->mode, arg); break;
-        case INSTR_SEI: SEI(instr->mode, arg); break;
-        case INSTR_STA: STA(instr->mode, arg); break;
-        case INSTR_STX: STX(instr->mode, arg); break;
-        case INSTR_STY: STY(instr->mode, arg); break;
-        case INSTR_TAX: TAX(instr->mode, arg); break;
-        case INSTR_TAY: TAY(instr->mode, arg); break;
-        case INSTR_TSX: TSX(instr->mode, arg); break;
-        case INSTR_TXA: TXA(instr->mode, arg); break;
-        case INSTR_TXS: TXS(instr->mode, arg); break;
-        case INSTR_TYA: TYA(instr->mode, arg); break;
-
-        default: opcode = 0x00; return; // TODO: Throw exception
+    (this->*(instr->handler))(instr->mode, arg);
+}
+
+// Operation OP in addressing mode MODE. Both are constants, so the mode's
+// address calculation is straight-line code and handlers that look at mode
+// (ASL, LSR, ROL, ROR, JMP) fold to one case when inlined.
+template<handler_t OP, uint8_t MODE>
+inline void CPU::op(uint8_t arg0, uint8_t arg1, uint8_t bytes) {
+    uint16_t arg = address<MODE>(arg0, arg1);
+
+    // Advance past the instruction first, so jumps and branches can simply
+    // overwrite or offset the program counter
+    registers.PC += bytes;
+
+    (this->*OP)(MODE, arg);
+}
+
+// One instruction, generated from its entry in the instruction table
+template<uint8_t OPCODE>
+inline void CPU::execute() {
+    constexpr instruction_t instr = instructionSet[OPCODE];
+
+    uint8_t arg0 = 0;
+    uint8_t arg1 = 0;
+    if constexpr (instr.bytes > 1 || TRACE_ENABLED) arg0 = memoryRead(registers.PC + 1);
+    if constexpr (instr.bytes > 2 || TRACE_ENABLED) arg1 = memoryRead(registers.PC + 2);
+
+    execute<OPCODE>(arg0, arg1);
+}
+
+// The same, with the operand bytes already fetched
+template<uint8_t OPCODE>
+inline void CPU::execute(uint8_t arg0, uint8_t arg1) {
+    constexpr instruction_t instr = instructionSet[OPCODE];
+
+    if constexpr (TRACE_ENABLED) {
+        if(trace) traceInstruction(OPCODE, arg0, arg1);
+    }
+
+    op<instr.handler, instr.mode>(arg0, arg1, instr.bytes);
+
+    if constexpr (instr.pageCross) {
+        cycles += instr.cycles + pageCrossed;
+    } else {
+        cycles += instr.cycles;
     }
+    instructions++;
+}
+
+typedef void (*executor_t)(CPU &cpu);
+
+template<uint8_t OPCODE>
+static void executeOpcode(CPU &cpu) {
+    cpu.execute<OPCODE>();
+}
+
+template<size_t... OPCODES>
+static constexpr std::array<executor_t, 256> buildExecutors(std::index_sequence<OPCODES...>) {
+    return {{ &executeOpcode<OPCODES>... }};
+}
+
+// execute<OPCODE> for every opcode
+static constexpr std::array<executor_t, 256> executors = buildExecutors(std::make_index_sequence<256>());
+
+template<uint8_t OPCODE>
+static void executeDecoded(CPU &cpu, uint8_t arg0, uint8_t arg1) {
+    cpu.execute<OPCODE>(arg0, arg1);
+}
+
+template<size_t... OPCODES>
+static constexpr std::array<decoded_execute_t, 256> buildDecodedExecutors(std::index_sequence<OPCODES...>) {
+    return {{ &executeDecoded<OPCODES>... }};
+}
+
+// execute<OPCODE>(arg0, arg1) for every opcode, for cached blocks
+static constexpr std::array<decoded_execute_t, 256> decodedExecutors = buildDecodedExecutors(std::make_index_sequence<256>());
+
+void CPU::step() {
+    setStatus(registers.P);
+    if(cycles >= events.next) serviceEvents();
+    executors[memoryRead(registers.PC)](*this);
+    registers.P = status();
 }
 
 void CPU::run(void (*callback)(void)) {
-    uint8_t opcode; // Initialize to a non-zero value
-    
-    uint8_t arg0;
-    uint8_t arg1;
-    uint16_t arg;
-
-    instruction_t instr;
-
-    // TODO: Consider using emscripten_set_main_loop 
-    opcode = memory[registers.PC];
-    arg0 = memory[registers.PC + 1];
-    arg1 = memory[registers.PC + 2];
-    if(VERBOSE) emscripten_log(EM_LOG_CONSOLE, "0x%X opcode, 0x%X program counter", opcode, registers.PC);
-
-    // Fetch instruction
-    instr = fetch(opcode);
-    arg = decode(arg0, arg1, instr.mode);
-
-    exec(&instr, opcode, arg);
-
-    if(VERBOSE) emscripten_log(EM_LOG_CONSOLE, "%u name, %u arg0, %u arg1, %u arg", instr.name, arg0, arg1, arg);
-    if(       
-        instr.name != INSTR_BCC
-        && instr.name != INSTR_BCS
-        && instr.name != INSTR_BEQ
-        && instr.name != INSTR_BIT
-        && instr.name != INSTR_BMI
-        && instr.name != INSTR_BNE
-        && instr.name != INSTR_BPL
-        && instr.name != INSTR_BVC
-        && instr.name != INSTR_BVS
-    ) registers.PC += instr.bytes; // Increment PC by number of bytes in instruction + 1 for opcode
-    
+    step();
+
     if(callback) callback();
 }
 
 void CPU::run() {
-
-  emscripten_log(EM_LOG_CONSOLE, "running...");
     run(nullptr);
 }
 
-void CPU::load_and_run(uint8_t program[], size_t program_size) {
-    load(program, program_size);
-    uint8_t opcode;
+// Execute whole instructions until at least budget cycles have elapsed,
+// returns the number of cycles actually run
+uint64_t CPU::runCycles(uint64_t budget) {
+#if THREADED_SUPPORTED
+    if constexpr (THREADED_DISPATCH) return runThreaded(budget);
+#endif
+    if constexpr (CACHED_DISPATCH) return runCached(budget);
+#if DYNAREC_SUPPORTED
+    if constexpr (DYNAREC_DISPATCH) return runDynarec(budget);
+#endif
 
-    do {
-        opcode = memory[registers.PC];
-        run();
-    } while(opcode != 0x00);
+    return runSwitched(budget);
 }
 
-void CPU::load(uint8_t program[], size_t program_size) {
-    memoryLoad(program, program_size);
-    if(VERBOSE) emscripten_log(EM_LOG_CONSOLE, "program size %u", program_size);
+// Portable core: step() through the instruction table
+uint64_t CPU::runSwitched(uint64_t budget) {
+    uint64_t start = cycles;
+    uint64_t end = start + budget;
+
+    setStatus(registers.P);
+    events.setDeadline(end);
 
+    while(cycles < end) {
+        while(cycles < events.next) executors[memoryRead(registers.PC)](*this);
+        serviceEvents();
+    }
+
+    events.setDeadline(SCHEDULER_NEVER);
+    registers.P = status();
+
+    return cycles - start;
 }
 
-void CPU::updateCarryFlag(uint8_t result, uint8_t a, uint8_t b) {
-    if(result < a || result < b) {
-        registers.P |= FLAG_CARRY;
-    } else {
-        registers.P &= ~FLAG_CARRY;
+// Control flow ends a block: whatever follows may not run next
+static constexpr bool endsBlock(const instruction_t &instr) {
+    switch(instr.name) {
+        case INSTR_JMP: case INSTR_JSR: case INSTR_RTS: case INSTR_RTI: case INSTR_BRK:
+            return true;
+        default:
+            return instr.mode == Relative;
     }
 }
 
-void CPU::updateZeroFlag(uint8_t value) {
-    if (value == 0) {
-        registers.P |= FLAG_ZERO;
-    } else {
-        registers.P &= ~FLAG_ZERO;
+// Decode the block starting at pc into block, returns its length. Stops
+// before an instruction that would run off the page, so a block can come
+// out empty.
+uint8_t CPU::buildBlock(block_t &block, uint16_t pc) {
+    const uint8_t *page = bus.readPages[pc >> 8];
+    uint8_t offset = pc & 0xFF;
+
+    block.pc = pc;
+    block.alias = bus.aliases[pc >> 8];
+    block.generation = bus.generations[block.alias];
+    block.count = 0;
+    bus.decoded[block.alias] = true;
+
+    while(block.count < BLOCK_MAX_INSTRUCTIONS) {
+        uint8_t opcode = page[offset];
+        const instruction_t &instr = instructionSet[opcode];
+        if(offset + instr.bytes > 0x100) break;
+
+        decoded_t &op = block.ops[block.count++];
+        op.execute = decodedExecutors[opcode];
+        op.arg0 = (instr.bytes > 1 || TRACE_ENABLED) && offset < 0xFF ? page[offset + 1] : 0;
+        op.arg1 = (instr.bytes > 2 || TRACE_ENABLED) && offset < 0xFE ? page[offset + 2] : 0;
+        op.bytes = instr.bytes;
+        op.cycles = instr.cycles;
+
+        if(endsBlock(instr) || offset + instr.bytes == 0x100) break;
+        offset += instr.bytes;
+    }
+
+    return block.count;
+}
+
+// Block cache core: run decoded blocks straight through. Code in I/O space,
+// and instructions that straddle a page, run uncached through step's table.
+uint64_t CPU::runCached(uint64_t budget) {
+    if(!blocks) blocks.reset(new block_t[BLOCK_CACHE_SIZE]());
+
+    uint64_t start = cycles;
+    uint64_t end = start + budget;
+
+    setStatus(registers.P);
+    events.setDeadline(end);
+
+    while(cycles < end) {
+        if(cycles >= events.next) {
+            serviceEvents();
+            continue;
+        }
+
+        uint16_t pc = registers.PC;
+        block_t &block = blocks[pc & (BLOCK_CACHE_SIZE - 1)];
+
+        bool valid = block.count
+            && block.pc == pc
+            && block.alias == bus.aliases[pc >> 8]
+            && block.generation == bus.generations[block.alias];
+
+        if(!valid && (!bus.readPages[pc >> 8] || !buildBlock(block, pc))) {
+            block.count = 0;
+            executors[memoryRead(pc)](*this);
+            continue;
+        }
+
+        // Stop early if the block wrote to its own page, or an event is due
+        const uint64_t &generation = bus.generations[block.alias];
+        for(uint8_t i = 0; i < block.count; i++) {
+            const decoded_t &op = block.ops[i];
+            op.execute(*this, op.arg0, op.arg1);
+
+            if(generation != block.generation || cycles >= events.next) break;
+        }
     }
+
+    events.setDeadline(SCHEDULER_NEVER);
+    registers.P = status();
+    return cycles - start;
 }
 
-void CPU::updateNegativeFlag(uint8_t value) {
-    if (value & 0x80) {
-        registers.P |= FLAG_NEGATIVE;
+#if DYNAREC_SUPPORTED
+
+// Recompiler core: translated blocks where the Dynarec has them, the
+// interpreter for everything else. Blocks get the cycles left before
+// events.next and stop after the instruction that reaches it, so events are
+// serviced at the same instruction boundary as in the other cores.
+uint64_t CPU::runDynarec(uint64_t budget) {
+    // Translated code can't trace single instructions
+    if(TRACE_ENABLED && trace) return runSwitched(budget);
+
+    if(!dynarec) dynarec.reset(new Dynarec(*this));
+
+    uint64_t start = cycles;
+    uint64_t end = start + budget;
+
+    setStatus(registers.P);
+    events.setDeadline(end);
+
+    while(cycles < end) {
+        if(cycles >= events.next) {
+            serviceEvents();
+            continue;
+        }
+
+        dynarec_code_t code = dynarec->lookup(registers.PC);
+        uint64_t executed = instructions;
+
+        if(code) code(this, events.next - cycles);
+
+        // Untranslated, or the block left before its first instruction
+        if(instructions == executed) executors[memoryRead(registers.PC)](*this);
+    }
+
+    events.setDeadline(SCHEDULER_NEVER);
+    registers.P = status();
+    return cycles - start;
+}
+
+#endif
+
+#if THREADED_SUPPORTED
+
+// Expand m(00) ... m(FF), one per opcode
+#define OPCODES_ROW(m, h) \
+    m(h##0) m(h##1) m(h##2) m(h##3) m(h##4) m(h##5) m(h##6) m(h##7) \
+    m(h##8) m(h##9) m(h##A) m(h##B) m(h##C) m(h##D) m(h##E) m(h##F)
+#define OPCODES(m) \
+    OPCODES_ROW(m, 0) OPCODES_ROW(m, 1) OPCODES_ROW(m, 2) OPCODES_ROW(m, 3) \
+    OPCODES_ROW(m, 4) OPCODES_ROW(m, 5) OPCODES_ROW(m, 6) OPCODES_ROW(m, 7) \
+    OPCODES_ROW(m, 8) OPCODES_ROW(m, 9) OPCODES_ROW(m, A) OPCODES_ROW(m, B) \
+    OPCODES_ROW(m, C) OPCODES_ROW(m, D) OPCODES_ROW(m, E) OPCODES_ROW(m, F)
+
+// Every handler ends in its own indirect jump, so the host predicts each
+// opcode's successor separately instead of through one shared branch
+#define DISPATCH() \
+    if(cycles >= events.next) goto service; \
+    goto *labels[memoryRead(registers.PC)];
+
+#define OPCODE_LABEL(n) &&op_##n,
+#define OPCODE_BODY(n) op_##n: execute<0x##n>(); DISPATCH();
+
+// Threaded core: same results as runSwitched
+uint64_t CPU::runThreaded(uint64_t budget) {
+    static const void *const labels[256] = { OPCODES(OPCODE_LABEL) };
+
+    uint64_t start = cycles;
+    uint64_t end = start + budget;
+
+    setStatus(registers.P);
+    events.setDeadline(end);
+
+    DISPATCH();
+    OPCODES(OPCODE_BODY)
+
+service:
+    serviceEvents();
+    if(cycles < end) {
+        DISPATCH();
+    }
+
+    events.setDeadline(SCHEDULER_NEVER);
+    registers.P = status();
+    return cycles - start;
+}
+
+#undef OPCODE_BODY
+#undef OPCODE_LABEL
+#undef DISPATCH
+#undef OPCODES
+#undef OPCODES_ROW
+
+#endif
+
+// Interrupts
+
+void CPU::setIRQ(uint8_t line, bool asserted) {
+    if(asserted) {
+        irqLines |= line;
+        pollInterrupts(cycles);
     } else {
-        registers.P &= ~FLAG_NEGATIVE;
+        irqLines &= ~line;
+    }
+}
+
+void CPU::raiseNMI() {
+    nmi = true;
+    pollInterrupts(cycles);
+}
+
+void CPU::pollInterrupts(uint64_t cycle) {
+    if(cycle < events.when(EVENT_INTERRUPT)) events.schedule(EVENT_INTERRUPT, cycle);
+}
+
+// Run the handlers of due events, then take NMI, or IRQ if it isn't masked
+void CPU::serviceEvents() {
+    events.dispatch(cycles);
+
+    if(nmi) {
+        nmi = false;
+        interrupt(MEM_INTERRUPT_HANDLER, false);
+        cycles += 7;
+    } else if(irqLines && !(registers.P & FLAG_INTERRUPT)) {
+        interrupt(MEM_BRK_HANDLER, false); // IRQ shares the BRK vector
+        cycles += 7;
     }
 }
 
-void CPU::updateOverflowFlag(uint8_t result, uint8_t a, uint8_t b) {
-    result &= 0b10000000;
-    a      &= 0b10000000;
-    b      &= 0b10000000;
+void CPU::interrupt(uint16_t vector, bool brk) {
+    pushStacku16(registers.PC);
+    pushStack(status() | FLAG_UNUSED | (brk ? FLAG_BREAK : 0));
+
+    registers.P |= FLAG_INTERRUPT;
+    registers.PC = memoryReadu16(vector);
+}
+
+// Execute until the next vertical blank. Frames are 341 * 262 PPU dots long,
+// which is not a whole number of CPU cycles, so boundaries are computed from
+// the frame count rather than added up, rounding up so the PPU has always
+// reached vertical blank when this returns.
+void CPU::runFrame() {
+    frames++;
 
-    registers.P |= ((~a & b & result) | (a & ~b & ~result)) >> 1;
+    uint64_t end = (frames * PPU_DOTS_PER_FRAME + 2) / 3;
+    if(cycles < end) runCycles(end - cycles);
+
+    catchUp();
+}
+
+void CPU::catchUp() {
+    if(ppu) ppu->run(cycles);
+    if(apu) apu->run(cycles);
+}
+
+void CPU::runFrame(void (*callback)(void)) {
+    runFrame();
+
+    if(callback) callback();
 }
 
-void CPU::updateFlags(uint8_t result, uint8_t a, uint8_t b) {
-    updateCarryFlag(result, a, b);
-    updateZeroFlag(result);
-    updateNegativeFlag(result);
-    updateOverflowFlag(result, a, b);
+void CPU::traceInstruction(uint8_t opcode, uint8_t arg0, uint8_t arg1) {
+    trace_record_t record = {
+        cycles,
+        registers.PC,
+        opcode, arg0, arg1,
+        registers.A, registers.X, registers.Y, status(), registers.SP,
+    };
+
+    // Never drop records, wait for the writer to catch up instead
+    while(!trace->push(record)) std::this_thread::yield();
+}
+
+void CPU::saveState(StateWriter &out) const {
+    out.begin("CPU ");
+    out.u16(registers.PC);
+    out.u8(registers.SP);
+    out.u8(registers.A);
+    out.u8(registers.X);
+    out.u8(registers.Y);
+    out.u8(registers.P);
+    out.u64(cycles);
+    out.u64(instructions);
+    out.u64(frames);
+    out.end();
+
+    out.begin("RAM ");
+    out.bytes(bus.ram.get(), CPU_RAM_STATE_SIZE);
+    out.end();
+}
+
+// Pending events and interrupt lines belong to the devices, which schedule
+// and raise them again as they load
+void CPU::loadState(StateReader &in) {
+    events.clear();
+    irqLines = 0;
+    nmi = false;
+
+    if(in.chunk("CPU ")) {
+        registers.PC = in.u16();
+        registers.SP = in.u8();
+        registers.A  = in.u8();
+        registers.X  = in.u8();
+        registers.Y  = in.u8();
+        setStatus(in.u8());
+        cycles       = in.u64();
+        instructions = in.u64();
+        frames       = in.u64();
+    }
+
+    if(in.chunk("RAM ")) {
+        in.bytes(bus.ram.get(), CPU_RAM_STATE_SIZE);
+        bus.invalidate(); // Code may have changed under the block caches
+    }
+}
+
+void CPU::load_and_run(uint8_t program[], size_t program_size) {
+    load(program, program_size);
+    uint8_t opcode;
+
+    do {
+        opcode = memoryRead(registers.PC);
+        run();
+    } while(opcode != 0x00);
+}
+
+void CPU::load(uint8_t program[], size_t program_size) {
+    memoryLoad(program, program_size);
+}
+
+uint8_t CPU::status() {
+    return (registers.P & ~(FLAG_NEGATIVE | FLAG_OVERFLOW | FLAG_ZERO | FLAG_CARRY))
+        | (flagN & FLAG_NEGATIVE)
+        | ((flagV & 0x80) >> 1)
+        | ((flagZ == 0) << 1)
+        | (flagC & FLAG_CARRY);
+}
+
+void CPU::setStatus(uint8_t value) {
+    registers.P = value;
+
+    flagN = value;
+    flagV = value << 1;
+    flagZ = !(value & FLAG_ZERO);
+    flagC = value & FLAG_CARRY;
+}
+
+// Take a relative branch without branching on the host: one cycle more
+// when taken, and another when the target is on a different page
+void CPU::branch(bool condition, uint16_t offset) {
+    uint16_t target = registers.PC + offset;
+    uint16_t mask = -(uint16_t) condition;
+
+    cycles += condition + (condition & ((registers.PC ^ target) > 0xFF));
+    registers.PC = (target & mask) | (registers.PC & ~mask);
 }
 
 // Memory
 uint8_t CPU::memoryRead(uint16_t address) {
-    return memory[address];
+    return bus.read(address);
 }
 
 uint16_t CPU::memoryReadu16(uint16_t address) {
-    return CONCAT(memory[address], memory[address + 1]);
+    return CONCAT(bus.read(address), bus.read(address + 1));
 }
 
 void CPU::memoryWrite(uint16_t address, uint8_t value) {
-    memory[address] = value;
+    bus.write(address, value);
 }
 
 void CPU::memoryWriteu16(uint16_t address, uint16_t value) {
-    memory[address] = (uint8_t) value;
-    memory[address + 1] = (uint8_t) (value >> 8);
+    bus.write(address, (uint8_t) value);
+    bus.write(address + 1, (uint8_t) (value >> 8));
 }
 
 void CPU::memoryLoad(uint8_t block[], size_t size) {
     // Load array into memory
-    uint8_t *start_addr = &(memory[MEM_PROGRAM_START]);
-    memcpy(start_addr, block, size);
+    for(size_t i = 0; i < size; i++) {
+        bus.write(MEM_PROGRAM_START + i, block[i]);
+    }
 }
 
 void CPU::pushStack(uint8_t value) {
@@ -275,9 +638,15 @@ uint16_t CPU::popStacku16() {
 
 // Add with Carry
 void CPU::ADC(uint8_t mode, uint16_t arg) {
-    registers.A += arg + ((uint8_t) (registers.P & FLAG_CARRY) > 0);
+    uint16_t sum = registers.A + (uint8_t) arg + flagC;
+    uint8_t result = sum;
+
+    flagC = sum >> 8;
+    flagV = (registers.A ^ result) & ((uint8_t) arg ^ result);
+    registers.A = result;
 
-    updateFlags(registers.A, arg, (uint8_t) (registers.P & FLAG_CARRY) > 0);
+    updateZeroFlag(registers.A);
+    updateNegativeFlag(registers.A);
 }
 
 // Logical AND
@@ -294,8 +663,7 @@ void CPU::ASL(uint8_t mode, uint16_t arg) {
         case NoneAddressing:
             arg = registers.A;
         default:
-            registers.P &= ~FLAG_CARRY;
-            registers.P |= (arg & 0x80) ? FLAG_CARRY : 0;
+            flagC = (arg >> 7) & 0x01;
             registers.A = arg << 1;
             break;
     }
@@ -306,72 +674,62 @@ void CPU::ASL(uint8_t mode, uint16_t arg) {
 
 // Branch if Carry Clear
 void CPU::BCC(uint8_t mode, uint16_t arg) {
-    if(!(registers.P & FLAG_CARRY)) registers.PC += arg;
+    branch(!flagC, arg);
 }
 
 // Branch if Carry Set
 void CPU::BCS(uint8_t mode, uint16_t arg) {
-    if(registers.P & FLAG_CARRY) registers.PC += arg;
+    branch(flagC, arg);
 }
 
 // Branch if Equal
 void CPU::BEQ(uint8_t mode, uint16_t arg) {
-    if(registers.P & FLAG_ZERO) registers.PC += arg;
+    branch(!flagZ, arg);
 }
 
 // Bit Test
 void CPU::BIT(uint8_t mode, uint16_t arg) {
-    arg &= registers.A;
+    uint8_t value = arg & registers.A;
 
-    registers.P &= ~FLAG_ZERO & ~FLAG_NEGATIVE & ~FLAG_OVERFLOW;
-    registers.P |= (arg & (FLAG_NEGATIVE | FLAG_OVERFLOW));
-    updateZeroFlag(arg);
-    
+    flagV = value << 1;
+    updateZeroFlag(value);
+    updateNegativeFlag(value);
 }
 
 // Branch if Minus
 void CPU::BMI(uint8_t mode, uint16_t arg) {
-    if(registers.P & FLAG_NEGATIVE) registers.PC += arg;
+    branch((flagN & 0x80) != 0, arg);
 }
 
 // Branch if Not Equal
 void CPU::BNE(uint8_t mode, uint16_t arg) {
-    if(!(registers.P & FLAG_ZERO)) registers.PC += arg;
+    branch(flagZ != 0, arg);
 }
 
 // Branch if Positive
 void CPU::BPL(uint8_t mode, uint16_t arg) {
-    if(!(registers.P & FLAG_NEGATIVE)) registers.PC += arg;
+    branch(!(flagN & 0x80), arg);
 }
 
-// Force interrupt
+// Force interrupt. The return address skips the padding byte after BRK.
 void CPU::BRK(uint8_t mode, uint16_t arg) {
-    // TODO: Add stack and interrupts
-
-    // registers.PC += 2;
-    // pushStack(registers.PC >> 8);
-    // pushStack(registers.PC & 0xFF);
-    // pushStack(registers.P);
-    // registers.P |= FLAG_INTERRUPT;
-    // registers.PC = memoryReadu16(0xFFFE);
-    registers.P |= FLAG_BREAK | FLAG_UNUSED;
-
-    registers.P |= FLAG_BREAK;
+    registers.PC++;
+    interrupt(MEM_BRK_HANDLER, true);
 }
 
 // Branch if Overflow Clear
 void CPU::BVC(uint8_t mode, uint16_t arg) {
-    if(!(registers.P & FLAG_OVERFLOW)) registers.PC += arg;
+    branch(!(flagV & 0x80), arg);
 }
 
 // Branch if Overflow Set
 void CPU::BVS(uint8_t mode, uint16_t arg) {
-    if(registers.P & FLAG_OVERFLOW) registers.PC += arg;
+    branch((flagV & 0x80) != 0, arg);
 }
 
 // Clear Carry Flag
 void CPU::CLC(uint8_t mode, uint16_t arg) {
-    registers.P &= ~FLAG_CARRY;
+    flagC = 0;
 }
 
 // Clear Decimal Mode
@@ -382,44 +740,41 @@ void CPU::CLD(uint8_t mode, uint16_t arg) {
 // Clear Interrupt Disable
 void CPU::CLI(uint8_t mode, uint16_t arg) {
     registers.P &= ~FLAG_INTERRUPT;
+
+    // A pending IRQ waits until after the next instruction
+    if(irqLines) pollInterrupts(cycles + 3);
 }
 
 // Clear Overflow Flag
 void CPU::CLV(uint8_t mode, uint16_t arg) {
-    registers.P &= ~FLAG_OVERFLOW;
+    flagV = 0;
 }
 
 // Compare
 void CPU::CMP(uint8_t mode, uint16_t arg) {
-    if(registers.A == arg) {
-        registers.P |= FLAG_ZERO | FLAG_CARRY;
-    } else if(registers.A >= arg) {
-        registers.P |= FLAG_CARRY;
-    }
+    uint8_t value = arg;
 
-    updateNegativeFlag(registers.A - arg);
+    flagC = registers.A >= value;
+    updateZeroFlag(registers.A - value);
+    updateNegativeFlag(registers.A - value);
 }
 
 // Compare X register
 void CPU::CPX(uint8_t mode, uint16_t arg) {
-    if(registers.X == arg) {
-        registers.P |= FLAG_ZERO | FLAG_CARRY;
-    } else if(registers.X >= arg) {
-        registers.P |= FLAG_CARRY;
-    }
+    uint8_t value = arg;
 
-    updateNegativeFlag(registers.X - arg);
+    flagC = registers.X >= value;
+    updateZeroFlag(registers.X - value);
+    updateNegativeFlag(registers.X - value);
 }
 
 // Compare Y register
 void CPU::CPY(uint8_t mode, uint16_t arg) {
-    if(registers.Y == arg) {
-        registers.P |= FLAG_ZERO | FLAG_CARRY;
-    } else if(registers.Y >= arg) {
-        registers.P |= FLAG_CARRY;
-    }
+    uint8_t value = arg;
 
-    updateNegativeFlag(registers.Y - arg);
+    flagC = registers.Y >= value;
+    updateZeroFlag(registers.Y - value);
+    updateNegativeFlag(registers.Y - value);
 }
 
 // Decrement Memory
@@ -521,8 +876,7 @@ void CPU::LSR(uint8_t mode, uint16_t arg) {
         case NoneAddressing:
             arg = registers.A;
         default:
-            registers.P &= ~FLAG_CARRY;
-            registers.P |= (arg & 0x01) ? FLAG_CARRY : 0;
+            flagC = arg & 0x01;
             registers.A = arg >> 1;
             break;
     }
@@ -550,8 +904,7 @@ void CPU::PHA(uint8_t mode, uint16_t arg) {
 
 // Push Processor Status
 void CPU::PHP(uint8_t mode, uint16_t arg) {
-    registers.P |= FLAG_BREAK | FLAG_UNUSED;
-    pushStack(registers.P);
+    pushStack(status() | FLAG_BREAK | FLAG_UNUSED);
 }
 
 // Pull Accumulator
@@ -563,7 +916,11 @@ void CPU::PLA(uint8_t mode, uint16_t arg) {
 
 // Pull Processor Status
 void CPU::PLP(uint8_t mode, uint16_t arg) {
-    registers.P = popStack();
+    // B only exists on the stack
+    setStatus(popStack() & ~FLAG_BREAK);
+
+    // Delayed like CLI
+    if(irqLines && !(registers.P & FLAG_INTERRUPT)) pollInterrupts(cycles + 5);
 }
 
 // Rotate left
@@ -572,10 +929,8 @@ void CPU::ROL(uint8_t mode, uint16_t arg) {
         case NoneAddressing:
             arg = registers.A;
         default:
-            uint8_t carry = arg & 0x80;
-            registers.P &= ~FLAG_CARRY;
-            registers.P |= carry ? FLAG_CARRY : 0;
-            registers.A = (arg << 1) | (carry >> 7);
+            registers.A = (arg << 1) | flagC;
+            flagC = (arg >> 7) & 0x01;
             break;
     }
 
@@ -589,11 +944,8 @@ void CPU::ROR(uint8_t mode, uint16_t arg) {
         case NoneAddressing:
             arg = registers.A;
         default:
-            uint8_t lsb = arg & 0x01;
-            registers.P &= ~FLAG_CARRY;
-            registers.P |= lsb ? FLAG_CARRY : 0;
-            registers.P |= lsb;
-            registers.A = (arg >> 1) | (lsb << 7);
+            registers.A = ((uint8_t) arg >> 1) | (flagC << 7);
+            flagC = arg & 0x01;
             break;
     }
 
@@ -603,8 +955,10 @@ void CPU::ROR(uint8_t mode, uint16_t arg) {
 
 // Return from interrupt
 void CPU::RTI(uint8_t mode, uint16_t arg) {
-    registers.P = popStack();
+    setStatus(popStack() & ~FLAG_BREAK);
     registers.PC = popStacku16();
+
+    if(irqLines && !(registers.P & FLAG_INTERRUPT)) pollInterrupts(cycles);
 }
 
 // Return from subroutine
@@ -615,15 +969,13 @@ void CPU::RTS(uint8_t mode, uint16_t arg) {
 
 // Subtract with carry
 void CPU::SBC(uint8_t mode, uint16_t arg) {
-    uint8_t cin = !((uint8_t) (registers.P & FLAG_CARRY) > 0);
-    registers.A -= arg + cin;
-
-    updateFlags(registers.A, ~((uint8_t) arg) + 1, cin);
+    // A - M - (1 - C) is A + ~M + C
+    ADC(mode, (uint8_t) ~arg);
 }
 
 // Set carry flag
 void CPU::SEC(uint8_t mode, uint16_t arg) {
-    registers.P |= FLAG_CARRY;
+    flagC = 1;
 }
 
 // Set decimal flag
@@ -689,4 +1041,8 @@ void CPU::TYA(uint8_t mode, uint16_t arg) {
     registers.A = registers.Y;
     updateZeroFlag(registers.Y);
     updateNegativeFlag(registers.Y);
+}
+
+// Unofficial opcode, executed as a no-op
+void CPU::ILL(uint8_t mode, uint16_t arg) {
 }
\ No newline at end of file
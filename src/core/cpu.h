@@ -3,13 +3,23 @@
 #include <stdint.h>
 #include <array>
 #include <map>
-#include <emscripten.h>
+#include <memory>
+#include <stddef.h>
 
+#include "platform.h"
 #include "memory.h"
+#include "bus.h"
 #include "instructions.h"
+#include "trace.h"
+#include "block.h"
+#include "dynarec.h"
+#include "state.h"
+#include "scheduler.h"
 
-#define VERBOSE 1
-#define CONCAT(arg0, arg1) (((uint16_t) arg1) << 8) | arg0
+class PPU;
+class APU;
+class Input;
+#define CONCAT(arg0, arg1) ((((uint16_t) arg1) << 8) | arg0)
 
 // Registers
 struct registers {
@@ -21,6 +31,43 @@ struct registers {
     uint8_t  P;  // Processor Status
 };
 
+// Timing (NTSC)
+const double   CPU_CLOCK_HZ       = 1789773.0;
+const uint32_t PPU_DOTS_PER_FRAME = 341 * 262; // 3 PPU dots per CPU cycle
+const uint32_t CPU_CYCLES_PER_FRAME = PPU_DOTS_PER_FRAME / 3;
+
+// Save state chunks: registers and counters, and the bus's backing RAM
+const size_t CPU_STATE_SIZE     = 31;
+const size_t CPU_RAM_STATE_SIZE = 0x10000;
+
+// Build with DISPATCH=threaded to run runCycles on the computed goto core,
+// DISPATCH=cached for the basic block cache or DISPATCH=dynarec for the
+// x86-64 recompiler. The threaded core needs GCC/Clang labels as values and
+// the recompiler x86-64 Linux; elsewhere they fall back to the portable core.
+#if defined(__GNUC__)
+#define THREADED_SUPPORTED 1
+#else
+#define THREADED_SUPPORTED 0
+#endif
+
+#ifndef THREADED
+#define THREADED 0
+#endif
+
+constexpr bool THREADED_DISPATCH = THREADED && THREADED_SUPPORTED;
+
+#ifndef CACHED
+#define CACHED 0
+#endif
+
+constexpr bool CACHED_DISPATCH = CACHED;
+
+#ifndef DYNAREC
+#define DYNAREC 0
+#endif
+
+constexpr bool DYNAREC_DISPATCH = DYNAREC && DYNAREC_SUPPORTED;
+
 // Flags
 #define FLAG_CARRY      0b00000001
 #define FLAG_ZERO       0b00000010
@@ -31,6 +78,11 @@ struct registers {
 #define FLAG_OVERFLOW   0b01000000
 #define FLAG_NEGATIVE   0b10000000
 
+// IRQ lines, one per source
+#define IRQ_APU_FRAME   0b00000001
+#define IRQ_APU_DMC     0b00000010
+#define IRQ_MAPPER      0b00000100
+
 class CPU {
     public:
         CPU();
@@ -41,22 +93,113 @@ class CPU {
         // Registers
         struct registers registers;
 
+        // Address space, owned by this CPU
+        Bus bus;
+
+        // Cycles and instructions executed since power on, including page
+        // crossing and branch penalties. Divide by CPU_CLOCK_HZ for emulated time.
+        uint64_t cycles;
+        uint64_t instructions;
+
+        // Frames completed by runFrame
+        uint64_t frames;
+
+        // Receives a record per instruction when built with TRACE=1
+        TraceBuffer *trace;
+
+        // Devices are never clocked in lockstep. Each remembers how far it
+        // has run and catches up to cycles when its registers are accessed,
+        // when one of its events comes due, and at the end of each frame.
+        PPU *ppu;
+        APU *apu;
+
+        // Saved and restored with the machine, not clocked
+        Input *input;
+
+        // Device events. Run loops stop at events.next and call
+        // serviceEvents, which is the only place interrupts are taken.
+        Scheduler events;
+
+        // Interrupts. IRQs are level triggered: taken while any line is up
+        // and I is clear. NMI is an edge, taken once per raiseNMI.
+        uint8_t irqLines;
+        bool nmi;
+
+        void setIRQ(uint8_t line, bool asserted);
+        void raiseNMI();
+
+        // Look at the interrupt lines once cycle is reached
+        void pollInterrupts(uint64_t cycle);
+        void serviceEvents();
+
+        // Push PC and P and jump through vector, with B set in the pushed
+        // copy for BRK
+        void interrupt(uint16_t vector, bool brk);
+
         // Methods
-        instruction_t fetch(uint8_t opcode);
+        const instruction_t *fetch(uint8_t opcode);
         uint16_t decode(uint8_t arg0, uint8_t arg1, uint8_t mode);
-        void exec(instruction_t *instr, uint8_t opcode, uint16_t arg);
+        void exec(const instruction_t *instr, uint16_t arg);
         void load(uint8_t program[], size_t program_size);
         void load_and_run(uint8_t program[], size_t program_size);
+        void step();
         void run();
         void run(void (*callback)(void));
+        uint64_t runCycles(uint64_t budget);
+        uint64_t runSwitched(uint64_t budget);
+#if THREADED_SUPPORTED
+        uint64_t runThreaded(uint64_t budget);
+#endif
+        uint64_t runCached(uint64_t budget);
+#if DYNAREC_SUPPORTED
+        uint64_t runDynarec(uint64_t budget);
+#endif
+        void runFrame();
+        void runFrame(void (*callback)(void));
+
+        // Bring every attached device up to cycles
+        void catchUp();
+        void traceInstruction(uint8_t opcode, uint8_t arg0, uint8_t arg1);
+
+        // "CPU " and "RAM " chunks of a save state, see state.h. Only the
+        // backing RAM is saved: the bus mapping belongs to whoever set it up.
+        void saveState(StateWriter &out) const;
+        void loadState(StateReader &in);
 
-        // Flags
-        void updateCarryFlag(uint8_t value, uint8_t a, uint8_t b);
-        void updateZeroFlag(uint8_t value);
-        void updateOverflowFlag(uint8_t value, uint8_t a, uint8_t b);
-        void updateNegativeFlag(uint8_t value);
+        // Per-opcode code generated from the instruction table: the address
+        // calculation for one mode, an operation in one mode, and a whole
+        // instruction. Only instantiated in cpu.cpp.
+        template<uint8_t MODE> inline uint16_t address(uint8_t arg0, uint8_t arg1);
+        template<handler_t OP, uint8_t MODE> inline void op(uint8_t arg0, uint8_t arg1, uint8_t bytes);
+        template<uint8_t OPCODE> inline void execute();
+        template<uint8_t OPCODE> inline void execute(uint8_t arg0, uint8_t arg1);
 
-        void updateFlags(uint8_t value, uint8_t a, uint8_t b);
+        // Decoded basic blocks for runCached, allocated on first use
+        std::unique_ptr<block_t[]> blocks;
+        uint8_t buildBlock(block_t &block, uint16_t pc);
+
+        // Translated blocks for runDynarec, created on first use
+        std::unique_ptr<Dynarec> dynarec;
+
+        // Set by decode when an indexed address crossed a page
+        uint8_t pageCrossed;
+        void branch(bool condition, uint16_t offset);
+
+        // Flags. N, Z, C and V are evaluated lazily: handlers store the raw
+        // values below and registers.P is only brought up to date when it is
+        // observed. step() and the run functions sync both ways, so P is
+        // always current outside of them.
+        uint8_t flagN; // N is bit 7
+        uint8_t flagZ; // Z is set when this is zero
+        uint8_t flagC; // 0 or 1
+        uint8_t flagV; // V is bit 7
+
+        inline void updateZeroFlag(uint8_t value) { flagZ = value; }
+        inline void updateNegativeFlag(uint8_t value) { flagN = value; }
+
+        // P with the lazy flags materialised, and the reverse
+        uint8_t status();
+        void setStatus(uint8_t value);
         
         // Memory
         uint8_t memoryRead(uint16_t address);
@@ -127,5 +270,8 @@ class CPU {
         void TXA(uint8_t mode, uint16_t arg);
         void TXS(uint8_t mode, uint16_t arg);
         void TYA(uint8_t mode, uint16_t arg);
+        void ILL(uint8_t mode, uint16_t arg);
+
+};
 
-};
\ No newline at end of file
+#include "opcodes.h"
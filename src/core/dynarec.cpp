@@ -0,0 +1,560 @@
+#include "dynarec.h"
+#include "cpu.h"
+
+#if DYNAREC_SUPPORTED
+
+#include <string.h>
+#include <sys/mman.h>
+
+// Host registers. Block state lives in callee-saved registers so it survives
+// calls into the store helper.
+enum {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+const int REG_CPU = RBX;
+const int REG_A   = R12;
+const int REG_X   = R13;
+const int REG_Y   = R14;
+const int REG_C   = R15; // flagC
+const int REG_NZ  = RBP; // flagZ in bits 0-7, flagN in bits 8-15
+
+// Condition codes
+enum {
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7,
+};
+
+// Group 1 ALU operations: the opcode of "op r/m32, r32" and the /digit of
+// "op r/m32, imm32"
+typedef struct alu {
+    uint8_t opcode;
+    uint8_t digit;
+} alu_t;
+
+const alu_t ALU_ADD = { 0x01, 0 };
+const alu_t ALU_OR  = { 0x09, 1 };
+const alu_t ALU_AND = { 0x21, 4 };
+const alu_t ALU_SUB = { 0x29, 5 };
+const alu_t ALU_XOR = { 0x31, 6 };
+const alu_t ALU_CMP = { 0x39, 7 };
+
+const uint8_t SHIFT_SHL = 4;
+const uint8_t SHIFT_SHR = 5;
+
+// Store helper results
+const uint32_t STORE_DONE = 0;
+const uint32_t STORE_CODE = 1; // Wrote to the block's own page
+const uint32_t STORE_IO   = 2; // Not a memory page, nothing was written
+
+// Writes x86-64 machine code for one block. All 32 bit operations take a REX
+// prefix, even when it is empty, so the byte registers of RBP and R12-R15
+// can be used like the others.
+class Emitter {
+    public:
+        Emitter(uint8_t *code) : start(code), code(code) {}
+
+        size_t size() const { return code - start; }
+
+        void byte(uint8_t value) { *code++ = value; }
+        void u16(uint16_t value) { memcpy(code, &value, 2); code += 2; }
+        void u32(uint32_t value) { memcpy(code, &value, 4); code += 4; }
+        void u64(uint64_t value) { memcpy(code, &value, 8); code += 8; }
+
+        void rex(bool wide, int reg, int rm) {
+            byte(0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3));
+        }
+
+        void modrm(int mod, int reg, int rm) {
+            byte((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+        }
+
+        // [REG_CPU + disp32]
+        void field(int reg, int32_t disp) {
+            modrm(2, reg, REG_CPU);
+            u32(disp);
+        }
+
+        void push(int reg) { if(reg >= 8) byte(0x41); byte(0x50 | (reg & 7)); }
+        void pop(int reg) { if(reg >= 8) byte(0x41); byte(0x58 | (reg & 7)); }
+
+        void mov(int dst, int src) { rex(false, src, dst); byte(0x89); modrm(3, src, dst); }
+        void mov64(int dst, int src) { rex(true, src, dst); byte(0x89); modrm(3, src, dst); }
+        void movImm(int reg, uint32_t value) { rex(false, 0, reg); byte(0xB8 | (reg & 7)); u32(value); }
+        void movzx8(int dst, int src) { rex(false, dst, src); byte(0x0F); byte(0xB6); modrm(3, dst, src); }
+
+        void alu(alu_t op, int dst, int src) { rex(false, src, dst); byte(op.opcode); modrm(3, src, dst); }
+        void aluImm(alu_t op, int reg, uint32_t value) { rex(false, 0, reg); byte(0x81); modrm(3, op.digit, reg); u32(value); }
+        void testImm(int reg, uint32_t value) { rex(false, 0, reg); byte(0xF7); modrm(3, 0, reg); u32(value); }
+        void shift(uint8_t digit, int reg, uint8_t count) { rex(false, 0, reg); byte(0xC1); modrm(3, digit, reg); byte(count); }
+        void setcc(uint8_t cc, int reg) { rex(false, 0, reg); byte(0x0F); byte(0x90 | cc); modrm(3, 0, reg); }
+
+        // Byte fields of the CPU
+        void load8(int reg, int32_t disp) { rex(false, reg, REG_CPU); byte(0x0F); byte(0xB6); field(reg, disp); }
+        void store8(int reg, int32_t disp) { rex(false, reg, REG_CPU); byte(0x88); field(reg, disp); }
+        void store8Imm(int32_t disp, uint8_t value) { byte(0xC6); field(0, disp); byte(value); }
+        void or8Imm(int32_t disp, uint8_t value) { byte(0x80); field(1, disp); byte(value); }
+        void and8Imm(int32_t disp, uint8_t value) { byte(0x80); field(4, disp); byte(value); }
+        void test8Imm(int32_t disp, uint8_t value) { byte(0xF6); field(0, disp); byte(value); }
+        void store16Imm(int32_t disp, uint16_t value) { byte(0x66); byte(0xC7); field(0, disp); u16(value); }
+        void add64Imm(int32_t disp, uint32_t value) { rex(true, 0, REG_CPU); byte(0x81); field(0, disp); u32(value); }
+
+        // The qword at [RSP]
+        void storeStack(int reg) { rex(true, reg, RSP); byte(0x89); modrm(0, reg, RSP); byte(0x24); }
+        void cmpStackImm(uint32_t value) { rex(true, 0, RSP); byte(0x81); modrm(0, 7, RSP); byte(0x24); u32(value); }
+
+        // flagN and flagZ both set to the low byte of reg
+        void setNZ(int reg) {
+            movzx8(REG_NZ, reg);
+            rex(false, REG_NZ, REG_NZ); byte(0x69); modrm(3, REG_NZ, REG_NZ); u32(0x0101);
+        }
+
+        void call(const void *function) {
+            rex(true, 0, RAX); byte(0xB8); u64((uint64_t) function);
+            byte(0xFF); modrm(3, 2, RAX);
+        }
+
+        // Jumps return the offset of their rel32 for bind
+        uint8_t *jcc(uint8_t cc) { byte(0x0F); byte(0x80 | cc); u32(0); return code - 4; }
+        uint8_t *jmp() { byte(0xE9); u32(0); return code - 4; }
+
+        void bind(uint8_t *rel) {
+            int32_t offset = code - (rel + 4);
+            memcpy(rel, &offset, 4);
+        }
+
+    private:
+        uint8_t *start;
+        uint8_t *code;
+};
+
+static uint32_t dynarecStore(CPU *cpu, uint32_t address, uint32_t value, uint32_t alias) {
+    Bus &bus = cpu->bus;
+    if(!bus.writePages[address >> 8]) return STORE_IO;
+
+    bus.write(address, value);
+    return bus.aliases[address >> 8] == alias ? STORE_CODE : STORE_DONE;
+}
+
+// Offsets of the CPU fields that translated code touches
+typedef struct fields {
+    int32_t PC, SP, A, X, Y, P;
+    int32_t flagN, flagZ, flagC, flagV;
+    int32_t cycles, instructions;
+} fields_t;
+
+static int32_t fieldOffset(const CPU &cpu, const void *field) {
+    return (const uint8_t *) field - (const uint8_t *) &cpu;
+}
+
+// Compiles one block: a prologue that loads the registers, the translated
+// instructions, and an epilogue that every exit jumps to. The cycle budget
+// is kept in the stack slot that aligns the stack.
+class BlockCompiler {
+    public:
+        BlockCompiler(Emitter &out, const fields_t &f, uint8_t alias) : out(out), f(f), alias(alias) {
+            exits = 0;
+            cycles = 0;
+            count = 0;
+        }
+
+        void prologue() {
+            out.push(RBX); out.push(RBP); out.push(R12); out.push(R13); out.push(R14); out.push(R15);
+            out.rex(true, 0, RSP); out.byte(0x83); out.modrm(3, 5, RSP); out.byte(8); // Align the stack for calls
+            out.storeStack(RSI);
+            out.mov64(REG_CPU, RDI);
+
+            out.load8(REG_A, f.A);
+            out.load8(REG_X, f.X);
+            out.load8(REG_Y, f.Y);
+            out.load8(REG_C, f.flagC);
+            out.load8(REG_NZ, f.flagZ);
+            out.load8(RAX, f.flagN);
+            out.shift(SHIFT_SHL, RAX, 8);
+            out.alu(ALU_OR, REG_NZ, RAX);
+        }
+
+        void epilogue() {
+            for(int i = 0; i < exits; i++) out.bind(exitJumps[i]);
+
+            out.store8(REG_A, f.A);
+            out.store8(REG_X, f.X);
+            out.store8(REG_Y, f.Y);
+            out.store8(REG_C, f.flagC);
+            out.store8(REG_NZ, f.flagZ);
+            out.mov(RAX, REG_NZ);
+            out.shift(SHIFT_SHR, RAX, 8);
+            out.store8(RAX, f.flagN);
+
+            out.rex(true, 0, RSP); out.byte(0x83); out.modrm(3, 0, RSP); out.byte(8);
+            out.pop(R15); out.pop(R14); out.pop(R13); out.pop(R12); out.pop(RBP); out.pop(RBX);
+            out.byte(0xC3);
+        }
+
+        // Leave the block at pc, after extraCycles more than the instructions
+        // so far and extraInstructions more of them
+        void exit(uint16_t pc, uint32_t extraCycles, uint32_t extraInstructions) {
+            out.store16Imm(f.PC, pc);
+            out.add64Imm(f.cycles, cycles + extraCycles);
+            out.add64Imm(f.instructions, count + extraInstructions);
+            exitJumps[exits++] = out.jmp();
+        }
+
+        // Leave the block at pc if the instructions so far used up the budget
+        void checkBudget(uint16_t pc) {
+            out.cmpStackImm(cycles);
+            uint8_t *left = out.jcc(CC_A);
+            exit(pc, 0, 0);
+            out.bind(left);
+        }
+
+        // Translate the instruction at pc, which must be translatable. Sets
+        // ends after control flow.
+        void translate(uint16_t pc, const instruction_t &instr, uint8_t arg0, uint8_t arg1, bool &ends);
+
+        uint32_t count;
+
+    private:
+        void store(uint16_t pc, const instruction_t &instr, uint16_t address, int value, int result);
+        void setNZ(uint8_t value);
+        void compare(int reg, uint8_t value);
+        void adc(uint8_t value);
+        void branch(uint16_t pc, const instruction_t &instr, uint8_t arg0, int reg, uint32_t mask, bool taken);
+
+        Emitter &out;
+        const fields_t &f;
+        uint8_t alias;
+
+        uint32_t cycles;
+
+        uint8_t *exitJumps[BLOCK_MAX_INSTRUCTIONS * 5 + 1];
+        int exits;
+};
+
+void BlockCompiler::setNZ(uint8_t value) {
+    out.movImm(RAX, value);
+    out.setNZ(RAX);
+}
+
+// Store a register, or with value < 0 the constant in EDX, through the
+// helper, then set N and Z to result unless it is negative. I/O leaves the
+// block before this instruction, and a write to the block's own page right
+// after it.
+void BlockCompiler::store(uint16_t pc, const instruction_t &instr, uint16_t address, int value, int result) {
+    if(value >= 0) out.movzx8(RDX, value);
+    out.mov64(RDI, REG_CPU);
+    out.movImm(RSI, address);
+    out.movImm(RCX, alias);
+    out.call((const void *) &dynarecStore);
+
+    out.alu(ALU_OR, RAX, RAX);
+    uint8_t *done = out.jcc(CC_E);
+    out.aluImm(ALU_CMP, RAX, STORE_IO);
+    uint8_t *io = out.jcc(CC_E);
+    if(result >= 0) setNZ(result);
+    exit(pc + instr.bytes, instr.cycles, 1);
+    out.bind(io);
+    exit(pc, 0, 0);
+    out.bind(done);
+    if(result >= 0) setNZ(result);
+}
+
+void BlockCompiler::compare(int reg, uint8_t value) {
+    out.alu(ALU_XOR, REG_C, REG_C);
+    out.aluImm(ALU_CMP, reg, value);
+    out.setcc(CC_AE, REG_C);
+    out.mov(RAX, reg);
+    out.aluImm(ALU_SUB, RAX, value);
+    out.setNZ(RAX);
+}
+
+void BlockCompiler::adc(uint8_t value) {
+    out.mov(RAX, REG_A);
+    out.aluImm(ALU_ADD, RAX, value);
+    out.alu(ALU_ADD, RAX, REG_C);
+    out.mov(REG_C, RAX);
+    out.shift(SHIFT_SHR, REG_C, 8);
+    out.movzx8(RAX, RAX);
+
+    // V = (A ^ result) & (M ^ result)
+    out.mov(RCX, REG_A);
+    out.alu(ALU_XOR, RCX, RAX);
+    out.movImm(RDX, value);
+    out.alu(ALU_XOR, RDX, RAX);
+    out.alu(ALU_AND, RCX, RDX);
+    out.store8(RCX, f.flagV);
+
+    out.mov(REG_A, RAX);
+    out.setNZ(REG_A);
+}
+
+// Branch on reg & mask (the flag field when reg < 0), taken when the masked
+// bits are non-zero if taken is set. Both ways leave the block.
+void BlockCompiler::branch(uint16_t pc, const instruction_t &instr, uint8_t arg0, int reg, uint32_t mask, bool taken) {
+    uint16_t next = pc + instr.bytes;
+    uint16_t target = next + (int8_t) arg0;
+
+    if(reg < 0) {
+        out.test8Imm(f.flagV, mask);
+    } else {
+        out.testImm(reg, mask);
+    }
+
+    uint8_t *jump = out.jcc(taken ? CC_NE : CC_E);
+    exit(next, instr.cycles, 1);
+    out.bind(jump);
+    exit(target, instr.cycles + 1 + ((next ^ target) > 0xFF), 1);
+}
+
+// Everything the compiler handles. Handlers take the operand address as the
+// value, so only modes that don't read memory qualify; the shifts only on the
+// accumulator, as their memory forms shift the whole 16 bit address. CLI is
+// left to the interpreter, which checks for a pending IRQ.
+static bool translatable(const instruction_t &instr) {
+    switch(instr.name) {
+        case INSTR_LDA: case INSTR_LDX: case INSTR_LDY:
+        case INSTR_AND: case INSTR_ORA: case INSTR_EOR:
+        case INSTR_ADC: case INSTR_SBC:
+        case INSTR_CMP: case INSTR_CPX: case INSTR_CPY:
+            return instr.mode == Immediate || instr.mode == Absolute;
+
+        case INSTR_BIT: case INSTR_INC: case INSTR_DEC: case INSTR_JMP:
+        case INSTR_STA: case INSTR_STX: case INSTR_STY:
+            return instr.mode == Absolute;
+
+        case INSTR_ASL: case INSTR_LSR: case INSTR_ROL: case INSTR_ROR:
+        case INSTR_NOP:
+            return instr.mode == NoneAddressing;
+
+        case INSTR_INX: case INSTR_INY: case INSTR_DEX: case INSTR_DEY:
+        case INSTR_TAX: case INSTR_TAY: case INSTR_TXA: case INSTR_TYA:
+        case INSTR_TSX: case INSTR_TXS:
+        case INSTR_CLC: case INSTR_SEC: case INSTR_CLV:
+        case INSTR_CLD: case INSTR_SED: case INSTR_SEI:
+        case INSTR_BCC: case INSTR_BCS: case INSTR_BNE: case INSTR_BEQ:
+        case INSTR_BMI: case INSTR_BPL: case INSTR_BVS: case INSTR_BVC:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+void BlockCompiler::translate(uint16_t pc, const instruction_t &instr, uint8_t arg0, uint8_t arg1, bool &ends) {
+    uint16_t address = CONCAT(arg0, arg1);
+
+    ends = false;
+
+    switch(instr.name) {
+        case INSTR_LDA: out.movImm(REG_A, arg0); out.setNZ(REG_A); break;
+        case INSTR_LDX: out.movImm(REG_X, arg0); out.setNZ(REG_X); break;
+        case INSTR_LDY: out.movImm(REG_Y, arg0); out.setNZ(REG_Y); break;
+        case INSTR_AND: out.aluImm(ALU_AND, REG_A, arg0); out.setNZ(REG_A); break;
+        case INSTR_ORA: out.aluImm(ALU_OR, REG_A, arg0); out.setNZ(REG_A); break;
+        case INSTR_EOR: out.aluImm(ALU_XOR, REG_A, arg0); out.setNZ(REG_A); break;
+        case INSTR_ADC: adc(arg0); break;
+        case INSTR_SBC: adc(~arg0); break;
+        case INSTR_CMP: compare(REG_A, arg0); break;
+        case INSTR_CPX: compare(REG_X, arg0); break;
+        case INSTR_CPY: compare(REG_Y, arg0); break;
+
+        case INSTR_BIT:
+            out.mov(RAX, REG_A);
+            out.aluImm(ALU_AND, RAX, arg0);
+            out.mov(RCX, RAX);
+            out.shift(SHIFT_SHL, RCX, 1);
+            out.store8(RCX, f.flagV);
+            out.setNZ(RAX);
+            break;
+
+        case INSTR_INX: out.aluImm(ALU_ADD, REG_X, 1); out.movzx8(REG_X, REG_X); out.setNZ(REG_X); break;
+        case INSTR_INY: out.aluImm(ALU_ADD, REG_Y, 1); out.movzx8(REG_Y, REG_Y); out.setNZ(REG_Y); break;
+        case INSTR_DEX: out.aluImm(ALU_SUB, REG_X, 1); out.movzx8(REG_X, REG_X); out.setNZ(REG_X); break;
+        case INSTR_DEY: out.aluImm(ALU_SUB, REG_Y, 1); out.movzx8(REG_Y, REG_Y); out.setNZ(REG_Y); break;
+
+        case INSTR_TAX: out.mov(REG_X, REG_A); out.setNZ(REG_X); break;
+        case INSTR_TAY: out.mov(REG_Y, REG_A); out.setNZ(REG_Y); break;
+        case INSTR_TXA: out.mov(REG_A, REG_X); out.setNZ(REG_A); break;
+        case INSTR_TYA: out.mov(REG_A, REG_Y); out.setNZ(REG_A); break;
+        case INSTR_TSX: out.load8(REG_X, f.SP); out.setNZ(REG_X); break;
+        case INSTR_TXS: out.store8(REG_X, f.SP); break;
+
+        case INSTR_CLC: out.alu(ALU_XOR, REG_C, REG_C); break;
+        case INSTR_SEC: out.movImm(REG_C, 1); break;
+        case INSTR_CLV: out.store8Imm(f.flagV, 0); break;
+        case INSTR_CLD: out.and8Imm(f.P, (uint8_t) ~FLAG_DECIMAL); break;
+        case INSTR_SED: out.or8Imm(f.P, FLAG_DECIMAL); break;
+        case INSTR_SEI: out.or8Imm(f.P, FLAG_INTERRUPT); break;
+        case INSTR_NOP: break;
+
+        // Accumulator forms
+        case INSTR_ASL:
+            out.mov(REG_C, REG_A);
+            out.shift(SHIFT_SHR, REG_C, 7);
+            out.shift(SHIFT_SHL, REG_A, 1);
+            out.movzx8(REG_A, REG_A);
+            out.setNZ(REG_A);
+            break;
+        case INSTR_LSR:
+            out.mov(REG_C, REG_A);
+            out.aluImm(ALU_AND, REG_C, 1);
+            out.shift(SHIFT_SHR, REG_A, 1);
+            out.setNZ(REG_A);
+            break;
+        case INSTR_ROL:
+            out.mov(RAX, REG_A);
+            out.shift(SHIFT_SHL, REG_A, 1);
+            out.alu(ALU_OR, REG_A, REG_C);
+            out.movzx8(REG_A, REG_A);
+            out.shift(SHIFT_SHR, RAX, 7);
+            out.mov(REG_C, RAX);
+            out.setNZ(REG_A);
+            break;
+        case INSTR_ROR:
+            out.mov(RAX, REG_A);
+            out.shift(SHIFT_SHR, REG_A, 1);
+            out.mov(RCX, REG_C);
+            out.shift(SHIFT_SHL, RCX, 7);
+            out.alu(ALU_OR, REG_A, RCX);
+            out.aluImm(ALU_AND, RAX, 1);
+            out.mov(REG_C, RAX);
+            out.setNZ(REG_A);
+            break;
+
+        case INSTR_STA: store(pc, instr, address, REG_A, -1); break;
+        case INSTR_STX: store(pc, instr, address, REG_X, -1); break;
+        case INSTR_STY: store(pc, instr, address, REG_Y, -1); break;
+
+        // INC and DEC both store the low byte of the address minus one
+        case INSTR_INC:
+        case INSTR_DEC:
+            out.movImm(RDX, (uint8_t) (arg0 - 1));
+            store(pc, instr, address, -1, (uint8_t) (arg0 - 1));
+            break;
+
+        case INSTR_JMP:
+            ends = true;
+            exit(address, instr.cycles, 1);
+            return;
+
+        case INSTR_BCC: ends = true; branch(pc, instr, arg0, REG_C, 1, false); return;
+        case INSTR_BCS: ends = true; branch(pc, instr, arg0, REG_C, 1, true); return;
+        case INSTR_BNE: ends = true; branch(pc, instr, arg0, REG_NZ, 0x00FF, true); return;
+        case INSTR_BEQ: ends = true; branch(pc, instr, arg0, REG_NZ, 0x00FF, false); return;
+        case INSTR_BMI: ends = true; branch(pc, instr, arg0, REG_NZ, 0x8000, true); return;
+        case INSTR_BPL: ends = true; branch(pc, instr, arg0, REG_NZ, 0x8000, false); return;
+        case INSTR_BVS: ends = true; branch(pc, instr, arg0, -1, 0x80, true); return;
+        case INSTR_BVC: ends = true; branch(pc, instr, arg0, -1, 0x80, false); return;
+
+        default:
+            break;
+    }
+
+    cycles += instr.cycles;
+    count++;
+}
+
+Dynarec::Dynarec(CPU &cpu) : cpu(cpu), blocks(new dynarec_block_t[BLOCK_CACHE_SIZE]()) {
+    compiled = 0;
+    flushes = 0;
+    used = 0;
+
+    void *memory = mmap(nullptr, DYNAREC_ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    arena = memory == MAP_FAILED ? nullptr : (uint8_t *) memory;
+
+    if(!arena) platformLog("dynarec: no executable memory, interpreting");
+}
+
+Dynarec::~Dynarec() {
+    if(arena) munmap(arena, DYNAREC_ARENA_SIZE);
+}
+
+void Dynarec::flush() {
+    for(size_t i = 0; i < BLOCK_CACHE_SIZE; i++) blocks[i].valid = false;
+    used = 0;
+    flushes++;
+}
+
+dynarec_code_t Dynarec::lookup(uint16_t pc) {
+    Bus &bus = cpu.bus;
+    dynarec_block_t &block = blocks[pc & (BLOCK_CACHE_SIZE - 1)];
+
+    if(block.valid
+        && block.pc == pc
+        && block.alias == bus.aliases[pc >> 8]
+        && block.generation == bus.generations[block.alias]) {
+        return block.code;
+    }
+
+    if(!arena || !bus.readPages[pc >> 8]) return nullptr;
+    if(DYNAREC_ARENA_SIZE - used < DYNAREC_MAX_BLOCK_CODE) flush();
+
+    block.pc = pc;
+    block.alias = bus.aliases[pc >> 8];
+    block.generation = bus.generations[block.alias];
+    block.code = compile(pc);
+    bus.decoded[block.alias] = true;
+    block.valid = true;
+
+    return block.code;
+}
+
+// Instructions are translated until one ends the block, can't be translated,
+// or would run off the page, the same limits as CPU::buildBlock
+dynarec_code_t Dynarec::compile(uint16_t pc) {
+    const uint8_t *page = cpu.bus.readPages[pc >> 8];
+    uint8_t offset = pc & 0xFF;
+
+    // Most code that can't be translated is turned away here, before any work
+    const instruction_t &first = instructionSet[page[offset]];
+    if(!translatable(first) || offset + first.bytes > 0x100) return nullptr;
+
+    fields_t f = {
+        fieldOffset(cpu, &cpu.registers.PC), fieldOffset(cpu, &cpu.registers.SP),
+        fieldOffset(cpu, &cpu.registers.A), fieldOffset(cpu, &cpu.registers.X),
+        fieldOffset(cpu, &cpu.registers.Y), fieldOffset(cpu, &cpu.registers.P),
+        fieldOffset(cpu, &cpu.flagN), fieldOffset(cpu, &cpu.flagZ),
+        fieldOffset(cpu, &cpu.flagC), fieldOffset(cpu, &cpu.flagV),
+        fieldOffset(cpu, &cpu.cycles), fieldOffset(cpu, &cpu.instructions),
+    };
+
+    // Code is position independent: emit it to scratch, and only touch the
+    // arena's protection when there is something to copy in
+    Emitter out(scratch);
+    BlockCompiler compiler(out, f, cpu.bus.aliases[pc >> 8]);
+    compiler.prologue();
+
+    bool ends = false;
+    while(!ends && compiler.count < BLOCK_MAX_INSTRUCTIONS) {
+        const instruction_t &instr = instructionSet[page[offset]];
+        if(!translatable(instr) || offset + instr.bytes > 0x100) break;
+
+        uint8_t arg0 = instr.bytes > 1 ? page[offset + 1] : 0;
+        uint8_t arg1 = instr.bytes > 2 ? page[offset + 2] : 0;
+
+        if(compiler.count) compiler.checkBudget(pc);
+        compiler.translate(pc, instr, arg0, arg1, ends);
+
+        pc += instr.bytes;
+        if(offset + instr.bytes == 0x100) break;
+        offset += instr.bytes;
+    }
+
+    if(!ends) compiler.exit(pc, 0, 0);
+    compiler.epilogue();
+
+    uint8_t *code = arena + used;
+    uintptr_t start = (uintptr_t) code & ~(uintptr_t) (DYNAREC_PAGE_SIZE - 1);
+    size_t length = (uintptr_t) code + out.size() - start;
+
+    if(mprotect((void *) start, length, PROT_READ | PROT_WRITE)) return nullptr;
+    memcpy(code, scratch, out.size());
+    mprotect((void *) start, length, PROT_READ | PROT_EXEC);
+
+    used += (out.size() + 15) & ~(size_t) 15;
+    compiled++;
+
+    return (dynarec_code_t) code;
+}
+
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+#include "block.h"
+
+class CPU;
+
+// x86-64 translation of 6502 basic blocks, used by CPU::runDynarec on Linux.
+// Only instructions that need no memory reads are translated: implied and
+// immediate operations, absolute operands (which the handlers use as the
+// value), absolute stores, JMP and the branches. A block ends before the
+// first instruction it can't translate, and the interpreter runs that one.
+//
+// Inside a block A, X, Y, C and N/Z live in host registers and V stays in
+// the CPU. Stores go through a helper that leaves the block before touching
+// I/O, and right after a write into the block's own page. Blocks are given
+// the cycles left before the next event and leave after the instruction
+// that uses them up, so events are seen at the same instruction as in the
+// interpreter.
+#if defined(__x86_64__) && defined(__linux__)
+#define DYNAREC_SUPPORTED 1
+#else
+#define DYNAREC_SUPPORTED 0
+#endif
+
+const size_t DYNAREC_ARENA_SIZE     = 4 << 20; // Flushed whole when full
+const size_t DYNAREC_PAGE_SIZE      = 4096;
+const size_t DYNAREC_MAX_BLOCK_CODE = 4096;    // Largest block the compiler emits
+
+typedef void (*dynarec_code_t)(CPU *cpu, uint64_t budget);
+
+typedef struct dynarec_block {
+    uint64_t generation;
+    uint16_t pc;
+    uint8_t  alias;
+    bool     valid;
+    dynarec_code_t code; // Null when the first instruction can't be translated
+} dynarec_block_t;
+
+class Dynarec {
+    public:
+        Dynarec(CPU &cpu);
+        ~Dynarec();
+
+        Dynarec(const Dynarec &) = delete;
+        Dynarec &operator=(const Dynarec &) = delete;
+
+        // Translated code for pc, compiling it if it is missing or its page
+        // changed since. Null when pc must be interpreted.
+        dynarec_code_t lookup(uint16_t pc);
+
+        // Drop every translation
+        void flush();
+
+        // Blocks compiled since creation, and arena flushes
+        uint64_t compiled;
+        uint64_t flushes;
+
+    private:
+        dynarec_code_t compile(uint16_t pc);
+
+        CPU &cpu;
+
+        uint8_t *arena;
+        size_t used;
+
+        uint8_t scratch[DYNAREC_MAX_BLOCK_CODE];
+
+        std::unique_ptr<dynarec_block_t[]> blocks;
+};
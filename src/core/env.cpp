@@ -0,0 +1,249 @@
+#include "env.h"
+#include "machine.h"
+#include "state.h"
+
+#include <string.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum EnvTask {
+    TaskStep,
+    TaskReset,
+};
+
+// Workers sleep between steps, so an agent thinking between steps costs no
+// CPU. Environment i always runs on the same thread, keeping its machine in
+// that core's cache.
+struct env {
+    env_config_t config;
+    size_t observationSize;
+    size_t threads;
+
+    std::unique_ptr<std::unique_ptr<Machine>[]> machines;
+    std::unique_ptr<uint32_t[]> counters; // Reward counter after the last step
+
+    std::unique_ptr<uint8_t[]> snapshot;
+    size_t snapshotSize;
+
+    // Current task, set before the workers are woken
+    EnvTask task;
+    const uint8_t *actions;
+    const uint8_t *mask;
+    uint8_t *observations;
+    float *rewards;
+
+    std::vector<std::thread> pool;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    uint64_t generation;
+    size_t pending;
+    bool stopping;
+};
+
+// Copy memory a page at a time, without reading I/O registers
+static void peek(CPU &cpu, uint16_t address, uint8_t *out, size_t size) {
+    size_t done = 0;
+    while(done < size) {
+        uint16_t at = address + done;
+        size_t length = 0x100 - (at & 0xFF);
+        if(length > size - done) length = size - done;
+
+        uint8_t *page = cpu.bus.pointer(at);
+        if(page) memcpy(out + done, page, length);
+        else memset(out + done, 0, length);
+
+        done += length;
+    }
+}
+
+static uint32_t counter(env_t *env, Machine &machine) {
+    uint8_t bytes[4] = { 0, 0, 0, 0 };
+    peek(machine.cpu, env->config.rewardAddress, bytes, env->config.rewardSize);
+
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+static void observe(env_t *env, Machine &machine, uint8_t *out) {
+    const env_config_t &config = env->config;
+
+    if(config.observation == ENV_OBSERVE_RAM) {
+        peek(machine.cpu, config.ramAddress, out, config.ramSize);
+        return;
+    }
+
+    int scale = config.downsample;
+    for(int y = 0; y < PPU_HEIGHT / scale; y++) {
+        const uint8_t *row = machine.ppu.framebuffer + y * scale * PPU_WIDTH;
+        for(int x = 0; x < PPU_WIDTH / scale; x++) *out++ = row[x * scale];
+    }
+}
+
+static void work(env_t *env, size_t thread) {
+    size_t first = env->config.count * thread / env->threads;
+    size_t last = env->config.count * (thread + 1) / env->threads;
+
+    for(size_t i = first; i < last; i++) {
+        Machine &machine = *env->machines[i];
+        uint8_t *row = env->observations ? env->observations + i * env->observationSize : nullptr;
+
+        if(env->task == TaskReset) {
+            if(env->mask && !env->mask[i]) continue;
+
+            loadState(machine.cpu, env->snapshot.get(), env->snapshotSize);
+            env->counters[i] = counter(env, machine);
+            if(row) observe(env, machine, row);
+            continue;
+        }
+
+        uint8_t action = env->actions ? env->actions[i] : 0;
+        for(uint32_t frame = 0; frame < env->config.framesPerStep; frame++) machine.runFrame(action);
+
+        if(row) observe(env, machine, row);
+
+        uint32_t value = counter(env, machine);
+        if(env->rewards) {
+            // Sign extend the change at the counter's width, so it may wrap
+            int shift = 32 - 8 * env->config.rewardSize;
+            env->rewards[i] = shift < 32 ? (float) ((int32_t) ((value - env->counters[i]) << shift) >> shift) : 0;
+        }
+        env->counters[i] = value;
+    }
+}
+
+static void worker(env_t *env, size_t thread) {
+    uint64_t seen = 0;
+
+    std::unique_lock<std::mutex> guard(env->lock);
+    for(;;) {
+        env->wake.wait(guard, [&] { return env->stopping || env->generation != seen; });
+        if(env->stopping) return;
+        seen = env->generation;
+
+        guard.unlock();
+        work(env, thread);
+        guard.lock();
+
+        if(!--env->pending) env->finished.notify_one();
+    }
+}
+
+// Run the current task on every thread, the caller's included
+static void dispatch(env_t *env) {
+    if(env->threads > 1) {
+        std::lock_guard<std::mutex> guard(env->lock);
+        env->generation++;
+        env->pending = env->threads - 1;
+    }
+    env->wake.notify_all();
+
+    work(env, 0);
+
+    std::unique_lock<std::mutex> guard(env->lock);
+    env->finished.wait(guard, [&] { return env->pending == 0; });
+}
+
+env_t *envCreate(const env_config_t *config, const char **error) {
+    const char *reason = nullptr;
+    if(!config->count) reason = "no environments";
+    else if(!config->framesPerStep) reason = "framesPerStep must be at least 1";
+    else if(config->rewardSize > 4) reason = "rewardSize is at most 4";
+    else if(config->observation == ENV_OBSERVE_RAM && config->ramSize > 0x10000) reason = "ramSize is larger than memory";
+    else if(config->observation == ENV_OBSERVE_FRAME && (!config->downsample || config->downsample > 8 || (config->downsample & (config->downsample - 1)))) reason = "downsample must be 1, 2, 4 or 8";
+    else if(config->observation > ENV_OBSERVE_FRAME) reason = "unknown observation";
+
+    if(reason) {
+        if(error) *error = reason;
+        return nullptr;
+    }
+
+    std::unique_ptr<env_t> env(new env_t());
+    env->config = *config;
+    env->observationSize = config->observation == ENV_OBSERVE_RAM ? config->ramSize
+        : (PPU_WIDTH / config->downsample) * (PPU_HEIGHT / config->downsample);
+
+    env->machines.reset(new std::unique_ptr<Machine>[config->count]);
+    env->counters.reset(new uint32_t[config->count]);
+
+    for(size_t i = 0; i < config->count; i++) {
+        env->machines[i].reset(new Machine());
+
+        Machine &machine = *env->machines[i];
+        if(!machine.load(config->image, config->size)) {
+            if(error) *error = machine.error;
+            return nullptr;
+        }
+        machine.apu.output = false;
+
+        if(config->observation == ENV_OBSERVE_FRAME && !machine.cpu.ppu) {
+            if(error) *error = "frame observations need a cartridge";
+            return nullptr;
+        }
+
+        env->counters[i] = counter(env.get(), machine);
+    }
+
+    Machine &first = *env->machines[0];
+    env->snapshotSize = stateSize(first.cpu);
+    env->snapshot.reset(new uint8_t[env->snapshotSize]);
+    env->snapshotSize = saveState(first.cpu, env->snapshot.get(), env->snapshotSize);
+
+    env->threads = config->threads ? config->threads : std::thread::hardware_concurrency();
+    if(!env->threads) env->threads = 1;
+    if(env->threads > config->count) env->threads = config->count;
+
+    env->generation = 0;
+    env->pending = 0;
+    env->stopping = false;
+    for(size_t i = 1; i < env->threads; i++) env->pool.emplace_back(worker, env.get(), i);
+
+    return env.release();
+}
+
+void envDestroy(env_t *env) {
+    if(!env) return;
+
+    {
+        std::lock_guard<std::mutex> guard(env->lock);
+        env->stopping = true;
+    }
+    env->wake.notify_all();
+    for(std::thread &thread : env->pool) thread.join();
+
+    delete env;
+}
+
+size_t envObservationSize(const env_t *env) {
+    return env->observationSize;
+}
+
+void envStep(env_t *env, const uint8_t *actions, uint8_t *observations, float *rewards) {
+    env->task = TaskStep;
+    env->actions = actions;
+    env->observations = observations;
+    env->rewards = rewards;
+
+    dispatch(env);
+}
+
+void envReset(env_t *env, const uint8_t *mask, uint8_t *observations) {
+    env->task = TaskReset;
+    env->mask = mask;
+    env->observations = observations;
+
+    dispatch(env);
+}
+
+int envSnapshot(env_t *env, uint32_t index) {
+    if(index >= env->config.count) return 0;
+
+    Machine &machine = *env->machines[index];
+    size_t size = saveState(machine.cpu, env->snapshot.get(), stateSize(machine.cpu));
+    if(!size) return 0;
+
+    env->snapshotSize = size;
+    return 1;
+}
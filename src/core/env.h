@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// C API stepping a pool of independent machines in lockstep, for agents that
+// act on many environments at once. Every environment runs the same image.
+// A step runs a fixed number of frames with each environment's action byte
+// as its input for every one of them: the controller's buttons for a
+// cartridge, the key at $FF for a raw program, which also draws a new
+// random byte at $FE each frame. It then fills one row per environment of a
+// caller-owned observation tensor. Nothing is allocated after envCreate.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// What an observation row holds
+#define ENV_OBSERVE_RAM   0 // ramSize bytes from ramAddress, zeros for I/O
+#define ENV_OBSERVE_FRAME 1 // PPU palette indices, every downsample'th pixel
+
+typedef struct env_config {
+    // ROM or raw program, shared by every environment and not copied
+    const uint8_t *image;
+    size_t size;
+
+    uint32_t count;
+    uint32_t threads;       // 0 uses every hardware thread
+    uint32_t framesPerStep; // At least 1
+
+    uint8_t  observation;
+    uint16_t ramAddress;
+    uint32_t ramSize;
+    uint32_t downsample;    // 1, 2, 4 or 8; needs a cartridge for the PPU
+
+    // Reward is the change over the step of the little endian counter of
+    // rewardSize (0 to 4) bytes at rewardAddress. Wraps like the counter.
+    uint16_t rewardAddress;
+    uint8_t  rewardSize;
+} env_config_t;
+
+typedef struct env env_t;
+
+// Null on failure, with the reason in *error when error is not null.
+// Every environment starts from the snapshot taken right after loading.
+env_t *envCreate(const env_config_t *config, const char **error);
+void envDestroy(env_t *env);
+
+// Bytes in one observation row; a step fills count rows
+size_t envObservationSize(const env_t *env);
+
+// Step every environment. actions holds count bytes and may be null to
+// press nothing; rewards (count floats) may be null.
+void envStep(env_t *env, const uint8_t *actions, uint8_t *observations, float *rewards);
+
+// Put the environments whose mask byte is set (all of them when mask is
+// null) back to the snapshot, and write their observation rows when
+// observations is not null.
+void envReset(env_t *env, const uint8_t *mask, uint8_t *observations);
+
+// Make the current state of environment index the snapshot resets go to
+int envSnapshot(env_t *env, uint32_t index);
+
+#ifdef __cplusplus
+}
+#endif
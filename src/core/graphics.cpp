@@ -3,7 +3,9 @@
 // University of Illinois/NCSA Open Source License.  Both these licenses can be
 // found in the LICENSE file.
 #include <emscripten.h>
+#include <string.h>
 #include "graphics.h"
+#include "platform.h"
 
 NES_COLOR_RGB* getColor(int color) {
 
@@ -20,28 +22,64 @@ NES_COLOR_RGB* getColor(int color) {
   }
 }
 
-int render(uint8_t *pixels, int width, int height) {
-  emscripten_log(EM_LOG_CONSOLE, "rendered frame");
+Renderer::Renderer() : screen(nullptr), width(0), height(0), dirty(true) {
+}
 
-  SDL_Init(SDL_INIT_VIDEO);
-  SDL_Surface *screen = SDL_SetVideoMode(32, 32, 32, SDL_SWSURFACE);
+Renderer::~Renderer() {
+  if (screen) SDL_Quit();
+}
+
+bool Renderer::init(int width, int height) {
+  if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+    platformLog("renderer: %s", SDL_GetError());
+    return false;
+  }
+
+  screen = SDL_SetVideoMode(width, height, 32, SDL_SWSURFACE);
+  if (!screen) {
+    platformLog("renderer: %s", SDL_GetError());
+    return false;
+  }
 
 #ifdef TEST_SDL_LOCK_OPTS
   EM_ASM("SDL.defaults.copyOnLock = false; SDL.defaults.discardOnLock = true; SDL.defaults.opaqueFrontBuffer = false;");
 #endif
 
-  if (SDL_MUSTLOCK(screen)) SDL_LockSurface(screen);
-  for (int i = 0; i < 32; i++) {
-    for (int j = 0; j < 32; j++) {
-      // Read pixel
-      NES_COLOR_RGB *color = getColor(pixels[i * 32 + j]);
+  this->width = width;
+  this->height = height;
+  previous.reset(new uint8_t[width * height]);
+  dirty = true;
+
+  setPalette(NES_PALETTE);
+  return true;
+}
 
-      *((Uint32*)screen->pixels + i * 32 + j) = SDL_MapRGBA(screen->format, color->r, color->g, color->b, 255);
-    }
+void Renderer::setPalette(const NES_COLOR_RGB *palette) {
+  for (int i = 0; i < NES_PALETTE_SIZE; i++) {
+    lut[i] = SDL_MapRGBA(screen->format, palette[i].r, palette[i].g, palette[i].b, 255);
+  }
+
+  dirty = true;
+}
+
+bool Renderer::draw(const uint8_t *pixels) {
+  size_t size = width * height;
+  if (!dirty && !memcmp(previous.get(), pixels, size)) return false;
+
+  memcpy(previous.get(), pixels, size);
+  dirty = false;
+
+  if (SDL_MUSTLOCK(screen)) SDL_LockSurface(screen);
+  for (int y = 0; y < height; y++) {
+    uint32_t *row = (uint32_t *) ((uint8_t *) screen->pixels + y * screen->pitch);
+    convertFrame(lut, pixels + y * width, row, width);
   }
   if (SDL_MUSTLOCK(screen)) SDL_UnlockSurface(screen);
-  SDL_Flip(screen); 
+  SDL_Flip(screen);
 
-  return 0;
+  return true;
 }
 
+void Renderer::invalidate() {
+  dirty = true;
+}
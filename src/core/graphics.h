@@ -1,10 +1,13 @@
 #pragma once
 
 #include <stdio.h>
+#include <memory>
 #include <SDL/SDL.h>
 #include <SDL/SDL_rect.h>
 #include <SDL/SDL_opengles2.h>
 
+#include "palette.h"
+
 enum NES_COLOR {
     WHITE,
     BLACK,
@@ -17,12 +20,6 @@ enum NES_COLOR {
     CYAN,
 };
 
-typedef struct NES_COLOR_RGB {
-    uint8_t r;
-    uint8_t g;
-    uint8_t b;
-} NES_COLOR_RGB;
-
 static NES_COLOR_RGB RGB_MAP[9] = {
   { .r = 0xFF, .g = 0xFF, .b = 0xFF },
   { .r = 0x00, .g = 0x00, .b = 0x00 },
@@ -35,4 +32,39 @@ static NES_COLOR_RGB RGB_MAP[9] = {
   { .r = 0x00, .g = 0xFF, .b = 0xFF },
 };
 
-int render(uint8_t *pixels, int width, int height);
\ No newline at end of file
+// Colours of the 16 colour demo programs, for indices 0-15
+NES_COLOR_RGB* getColor(int color);
+
+// Draws palette-index framebuffers to an SDL surface. The video mode is set
+// once in init, and palette indices go through a 64 entry table already in
+// the surface's pixel format, so drawing is a single lookup per pixel.
+class Renderer {
+    public:
+        Renderer();
+        ~Renderer();
+
+        Renderer(const Renderer &) = delete;
+        Renderer &operator=(const Renderer &) = delete;
+
+        bool init(int width, int height);
+
+        // 64 colours, defaults to NES_PALETTE
+        void setPalette(const NES_COLOR_RGB *palette);
+
+        // Draw a width * height frame of palette indices. Frames identical to
+        // the last one drawn are skipped; returns whether anything was drawn.
+        bool draw(const uint8_t *pixels);
+
+        // Force the next draw, e.g. after the surface was lost
+        void invalidate();
+
+    private:
+        SDL_Surface *screen;
+        int width;
+        int height;
+
+        uint32_t lut[NES_PALETTE_SIZE];
+
+        std::unique_ptr<uint8_t[]> previous;
+        bool dirty;
+};
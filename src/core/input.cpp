@@ -0,0 +1,83 @@
+#include "input.h"
+#include "cpu.h"
+
+static uint8_t portRead(void *device, uint16_t address) {
+    return ((Input *) device)->read();
+}
+
+static void portWrite(void *device, uint16_t address, uint8_t value) {
+    ((Input *) device)->write(value);
+}
+
+Input::Input() : cpu(nullptr), controller(false) {
+    seed(0);
+
+    buttons = 0;
+    shift = 0;
+    strobe = false;
+}
+
+void Input::attach(CPU &cpu, bool controller) {
+    this->cpu = &cpu;
+    this->controller = controller;
+    cpu.input = this;
+
+    if(controller) cpu.bus.mapRegister(INPUT_CONTROLLER_PORT, this, portRead, portWrite);
+}
+
+void Input::seed(uint32_t seed) {
+    // xorshift never leaves zero
+    random = seed ? seed : 0x2545F491;
+}
+
+void Input::setFrame(uint8_t state) {
+    if(controller) {
+        buttons = state;
+        if(strobe) shift = buttons;
+        return;
+    }
+
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+
+    cpu->memoryWrite(INPUT_KEY_ADDRESS, state);
+    cpu->memoryWrite(INPUT_RANDOM_ADDRESS, random);
+}
+
+// Buttons come out A first; once all eight are out the port reads 1
+uint8_t Input::read() {
+    if(strobe) return 0x40 | (buttons & 0x01);
+
+    uint8_t bit = shift & 0x01;
+    shift = (shift >> 1) | 0x80;
+    return 0x40 | bit;
+}
+
+void Input::write(uint8_t value) {
+    strobe = value & 0x01;
+    if(strobe) shift = buttons;
+}
+
+size_t Input::stateSize() const {
+    return 7;
+}
+
+void Input::saveState(StateWriter &out) const {
+    out.begin("INP ");
+    out.u32(random);
+    out.u8(buttons);
+    out.u8(shift);
+    out.u8(strobe);
+    out.end();
+}
+
+void Input::loadState(StateReader &in) {
+    // States older than the chunk keep the current input
+    if(!in.chunk("INP ")) return;
+
+    random  = in.u32();
+    buttons = in.u8();
+    shift   = in.u8();
+    strobe  = in.u8() & 0x01;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "state.h"
+
+class CPU;
+
+// Where the easy6502 style demo programs look for input
+const uint16_t INPUT_RANDOM_ADDRESS = 0x00FE;
+const uint16_t INPUT_KEY_ADDRESS    = 0x00FF;
+
+const uint16_t INPUT_CONTROLLER_PORT = 0x4016;
+
+// Standard controller buttons, in the order they are shifted out
+#define BUTTON_A        0b00000001
+#define BUTTON_B        0b00000010
+#define BUTTON_SELECT   0b00000100
+#define BUTTON_START    0b00001000
+#define BUTTON_UP       0b00010000
+#define BUTTON_DOWN     0b00100000
+#define BUTTON_LEFT     0b01000000
+#define BUTTON_RIGHT    0b10000000
+
+// Per-frame input. Cartridges read a standard controller at $4016; raw
+// programs get the frame's key at $FF and a byte from a seeded xorshift
+// generator at $FE. Either way a frame's input is one byte, so a seed and
+// one byte per frame reproduce a run exactly.
+class Input {
+    public:
+        Input();
+
+        // Map the controller port, or use the zero page inputs when
+        // controller is false
+        void attach(CPU &cpu, bool controller);
+
+        void seed(uint32_t seed);
+
+        // Input for the frame about to run: buttons, or a key code
+        void setFrame(uint8_t state);
+
+        // Controller port
+        uint8_t read();
+        void write(uint8_t value);
+
+        // "INP " chunk of a save state: the generator and the controller's
+        // shift register, so replays from a state stay exact
+        size_t stateSize() const;
+        void saveState(StateWriter &out) const;
+        void loadState(StateReader &in);
+
+        uint32_t random;
+        uint8_t buttons;
+        uint8_t shift;
+        bool strobe;
+
+    private:
+        CPU *cpu;
+        bool controller;
+};
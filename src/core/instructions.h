@@ -1,5 +1,8 @@
 #pragma once
-#include <map>
+#include <stdint.h>
+#include <array>
+
+class CPU;
 
 enum INSTRUCTIONS_6502 {
    INSTR_ADC,
@@ -58,6 +61,7 @@ enum INSTRUCTIONS_6502 {
    INSTR_TXA,
    INSTR_TXS,
    INSTR_TYA,
+   INSTR_ILL, // Unofficial opcode without a dedicated handler
 };
 
 enum AddressingMode {
@@ -75,11 +79,20 @@ enum AddressingMode {
    NoneAddressing,
 };
 
+typedef void (CPU::*handler_t)(uint8_t mode, uint16_t arg);
+
 typedef struct instruction {
     uint8_t bytes;
     uint8_t cycles;
     uint8_t name;
     uint8_t mode;
+    handler_t handler;
+    uint8_t pageCross; // 1 if an indexed read costs a cycle more across pages
 } instruction_t;
 
-extern std::map<uint8_t, instruction_t> instructionSet;
\ No newline at end of file
+typedef struct opcode {
+    uint8_t opcode;
+    instruction_t instr;
+} opcode_t;
+
+// The table itself, instructionSet, is in opcodes.h
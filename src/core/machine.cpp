@@ -0,0 +1,132 @@
+#include "machine.h"
+
+#include <stdio.h>
+
+Machine::Machine() {
+    error = nullptr;
+    image = nullptr;
+    imageSize = 0;
+    recording = nullptr;
+}
+
+bool Machine::open(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if(!file) {
+        error = "cannot open file";
+        return false;
+    }
+
+    uint8_t header[INES_HEADER_SIZE];
+    size_t size = fread(header, 1, sizeof(header), file);
+
+    if(Cartridge::isImage(header, size)) {
+        fclose(file);
+
+        // Mapped rather than read
+        if(!cartridge.open(path)) {
+            error = cartridge.error;
+            return false;
+        }
+
+        cartridge.attach(cpu.bus);
+        ppu.attach(cpu, cartridge);
+        input.attach(cpu, true);
+        apu.attach(cpu);
+        cpu.reset();
+        return true;
+    }
+
+    program.assign(header, header + size);
+
+    uint8_t block[4096];
+    while((size = fread(block, 1, sizeof(block), file)) > 0) {
+        program.insert(program.end(), block, block + size);
+    }
+    fclose(file);
+
+    return load(program.data(), program.size());
+}
+
+bool Machine::load(const uint8_t *image, size_t size) {
+    if(Cartridge::isImage(image, size)) {
+        if(!cartridge.load(image, size)) {
+            error = cartridge.error;
+            return false;
+        }
+
+        cartridge.attach(cpu.bus);
+        ppu.attach(cpu, cartridge);
+        input.attach(cpu, true);
+        apu.attach(cpu);
+        cpu.reset();
+        return true;
+    }
+
+    if(size > MAX_SAFE_PROGRAM_SIZE) {
+        error = "program too large";
+        return false;
+    }
+
+    cpu.load((uint8_t *) image, size);
+    input.attach(cpu, false);
+
+    this->image = image;
+    imageSize = size;
+    return true;
+}
+
+void Machine::runFrames(uint64_t frames) {
+    while(cpu.frames < frames) cpu.runFrame();
+}
+
+void Machine::runFrame(uint8_t state) {
+    if(recording) recording->record(state);
+
+    input.setFrame(state);
+    cpu.runFrame();
+}
+
+void Machine::record(Movie *movie, uint32_t seed) {
+    input.seed(seed);
+
+    recording = movie;
+    if(movie) movie->begin(seed, imageHash());
+}
+
+bool Machine::play(const Movie &movie, bool render) {
+    if(movie.image != imageHash()) {
+        error = "movie was recorded on a different image";
+        return false;
+    }
+
+    input.seed(movie.seed);
+    ppu.render = render;
+
+    bool output = apu.output;
+    apu.output = false;
+
+    for(size_t i = 0; i < movie.inputs.size(); i++) {
+        // Draw the last frame regardless, so it can be checked
+        if(i + 1 == movie.inputs.size()) ppu.render = true;
+
+        input.setFrame(movie.inputs[i]);
+        cpu.runFrame();
+    }
+
+    ppu.render = true;
+    apu.output = output;
+    return true;
+}
+
+uint64_t Machine::imageHash() const {
+    if(image) return Movie::hash(image, imageSize);
+
+    return Movie::hash(cartridge.chr, cartridge.chrSize, Movie::hash(cartridge.prg, cartridge.prgSize));
+}
+
+uint64_t Machine::checksum() const {
+    uint64_t hash = Movie::hash(cpu.bus.ram.get(), CPU_RAM_STATE_SIZE);
+    if(cpu.ppu) hash = Movie::hash(ppu.framebuffer, sizeof(ppu.framebuffer), hash);
+
+    return hash;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "cpu.h"
+#include "cartridge.h"
+#include "ppu.h"
+#include "apu.h"
+#include "input.h"
+#include "movie.h"
+
+// One emulated console: a CPU with its own bus, the cartridge, PPU and APU.
+// Machines share no mutable state, so any number of them can run at once on
+// different threads.
+class Machine {
+    public:
+        Machine();
+
+        Machine(const Machine &) = delete;
+        Machine &operator=(const Machine &) = delete;
+
+        // Open an iNES image and start it from its reset vector with the PPU
+        // and APU attached, or load anything else as a raw program at
+        // MEM_PROGRAM_START. On failure error says why.
+        bool open(const char *path);
+
+        // Same for an image in memory, which must outlive the machine
+        bool load(const uint8_t *image, size_t size);
+
+        // Run until frames frames have completed since power on
+        void runFrames(uint64_t frames);
+
+        // Run one frame with the given input, appending it to the movie
+        // being recorded
+        void runFrame(uint8_t input);
+
+        // Seed the input and record every runFrame into movie, from now on.
+        // Movies replay from power on, so start before the first frame.
+        void record(Movie *movie, uint32_t seed);
+
+        // Replay a movie recorded on the same image from power on, as fast
+        // as possible. Rendering is off until the last frame unless render
+        // is set, and there is no sound.
+        bool play(const Movie &movie, bool render = false);
+
+        // Movie::hash of the loaded ROM's PRG and CHR, or of the program
+        uint64_t imageHash() const;
+
+        // FNV-1a of RAM and, with a PPU, the last frame: equal machines
+        // that ran the same job have equal checksums
+        uint64_t checksum() const;
+
+        CPU cpu;
+        Cartridge cartridge;
+        PPU ppu;
+        APU apu;
+        Input input;
+
+        const char *error;
+
+    private:
+        // Raw programs read from a file
+        std::vector<uint8_t> program;
+
+        // The raw program loaded, null for cartridges
+        const uint8_t *image;
+        size_t imageSize;
+
+        Movie *recording;
+};
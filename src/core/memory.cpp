@@ -1,3 +0,0 @@
-#include "memory.h"
-
-uint8_t memory[0xFFFF];
@@ -14,5 +14,12 @@ const uint16_t MEM_IRQ_HANDLER        = 0xFFFF;
  
 const uint16_t MAX_SAFE_PROGRAM_SIZE = MEM_INTERRUPT_HANDLER - MEM_PROGRAM_START;
 
-// Ensure memory block is allocated on the heap
-extern uint8_t memory[0xFFFF];
\ No newline at end of file
+// NES memory map
+const uint16_t MEM_RAM_START           = 0x0000;
+const uint16_t MEM_RAM_END             = 0x1FFF; // 2 KB mirrored four times
+const uint16_t MEM_RAM_SIZE            = 0x0800;
+const uint16_t MEM_PPU_REGISTERS_START = 0x2000;
+const uint16_t MEM_PPU_REGISTERS_END   = 0x3FFF; // 8 registers mirrored
+const uint16_t MEM_APU_IO_START        = 0x4000;
+const uint16_t MEM_APU_IO_END          = 0x401F;
+const uint16_t MEM_CARTRIDGE_START     = 0x4020;
\ No newline at end of file
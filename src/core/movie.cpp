@@ -0,0 +1,136 @@
+#include "movie.h"
+
+#include <stdio.h>
+
+Movie::Movie() {
+    begin(0, 0);
+    error = nullptr;
+}
+
+void Movie::begin(uint32_t seed, uint64_t image) {
+    this->seed = seed;
+    this->image = image;
+    inputs.clear();
+}
+
+uint64_t Movie::hash(const uint8_t *data, size_t size, uint64_t hash) {
+    for(size_t i = 0; i < size; i++) hash = (hash ^ data[i]) * 0x100000001B3;
+    return hash;
+}
+
+static void put(std::vector<uint8_t> &out, uint64_t value, int bytes) {
+    for(int i = 0; i < bytes; i++) out.push_back(value >> (i * 8));
+}
+
+static uint64_t get(const uint8_t *data, int bytes) {
+    uint64_t value = 0;
+    for(int i = 0; i < bytes; i++) value |= (uint64_t) data[i] << (i * 8);
+    return value;
+}
+
+void Movie::encode(std::vector<uint8_t> &out) const {
+    out.clear();
+
+    put(out, MOVIE_MAGIC, 4);
+    put(out, MOVIE_VERSION, 2);
+    put(out, 0, 2);
+    put(out, seed, 4);
+    put(out, image, 8);
+    put(out, inputs.size(), 4);
+
+    for(size_t i = 0; i < inputs.size(); ) {
+        size_t count = 1;
+        while(i + count < inputs.size() && inputs[i + count] == inputs[i]) count++;
+
+        out.push_back(inputs[i]);
+        for(size_t value = count; ; ) {
+            uint8_t byte = value & 0x7F;
+            value >>= 7;
+            out.push_back(byte | (value ? 0x80 : 0));
+            if(!value) break;
+        }
+
+        i += count;
+    }
+}
+
+bool Movie::load(const uint8_t *data, size_t size) {
+    if(size < MOVIE_HEADER_SIZE || get(data, 4) != MOVIE_MAGIC) {
+        error = "not a movie";
+        return false;
+    }
+    if(get(data + 4, 2) > MOVIE_VERSION) {
+        error = "movie from a newer version";
+        return false;
+    }
+
+    seed = get(data + 8, 4);
+    image = get(data + 12, 8);
+    size_t frames = get(data + 20, 4);
+
+    inputs.clear();
+    inputs.reserve(frames);
+
+    size_t position = MOVIE_HEADER_SIZE;
+    while(inputs.size() < frames) {
+        if(position >= size) break;
+        uint8_t input = data[position++];
+
+        size_t count = 0;
+        bool done = false;
+        for(int shift = 0; shift < 35 && position < size; shift += 7) {
+            uint8_t byte = data[position++];
+            count |= (size_t) (byte & 0x7F) << shift;
+            if(!(byte & 0x80)) {
+                done = true;
+                break;
+            }
+        }
+
+        if(!done || !count || count > frames - inputs.size()) break;
+        inputs.insert(inputs.end(), count, input);
+    }
+
+    if(inputs.size() != frames || position != size) {
+        inputs.clear();
+        error = "truncated or damaged movie";
+        return false;
+    }
+
+    return true;
+}
+
+bool Movie::save(const char *path) {
+    std::vector<uint8_t> data;
+    encode(data);
+
+    FILE *file = fopen(path, "wb");
+    if(!file) {
+        error = "cannot write file";
+        return false;
+    }
+
+    bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+    if(fclose(file) != 0) written = false;
+
+    if(!written) error = "cannot write file";
+    return written;
+}
+
+bool Movie::open(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if(!file) {
+        error = "cannot open file";
+        return false;
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t block[4096];
+    size_t size;
+    while((size = fread(block, 1, sizeof(block), file)) > 0) {
+        data.insert(data.end(), block, block + size);
+    }
+    fclose(file);
+
+    return load(data.data(), data.size());
+}
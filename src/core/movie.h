@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Input movies: the input seed and one input byte per frame, from power on.
+// Files are little endian:
+//
+//   "NESM" u16 version u16 reserved u32 seed u64 image u32 frames
+//   then runs of [u8 input][LEB128 count] covering every frame
+//
+// image is Movie::hash of the ROM the movie was recorded on, so playing it
+// on anything else can be refused. Inputs rarely change from frame to frame,
+// so runs keep movies to a few bytes a second.
+const uint32_t MOVIE_MAGIC   = 0x4D53454E; // "NESM"
+const uint16_t MOVIE_VERSION = 1;
+
+const size_t MOVIE_HEADER_SIZE = 24;
+
+class Movie {
+    public:
+        Movie();
+
+        // Start an empty recording
+        void begin(uint32_t seed, uint64_t image);
+        void record(uint8_t input) { inputs.push_back(input); }
+
+        bool save(const char *path);
+        bool open(const char *path);
+
+        // Parse or write a whole movie in memory
+        bool load(const uint8_t *data, size_t size);
+        void encode(std::vector<uint8_t> &out) const;
+
+        // FNV-1a, for identifying images
+        static uint64_t hash(const uint8_t *data, size_t size, uint64_t hash = 0xCBF29CE484222325);
+
+        uint32_t seed;
+        uint64_t image;
+        std::vector<uint8_t> inputs;
+
+        const char *error;
+};
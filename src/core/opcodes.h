@@ -0,0 +1,282 @@
+#pragma once
+
+// The dispatch table, built at compile time. It lives in a header so the
+// threaded core can look entries up in constant expressions; it needs the
+// complete CPU class for the handler pointers, so cpu.h includes it last.
+
+#include "instructions.h"
+
+// Official opcodes, in the order of the 6502 reference
+inline constexpr opcode_t officialOpcodes[] = {
+   { 0x69, { 2, 2, INSTR_ADC, Immediate, &CPU::ADC } },
+   { 0x65, { 2, 3, INSTR_ADC, ZeroPage, &CPU::ADC } },
+   { 0x75, { 2, 4, INSTR_ADC, ZeroPage_X, &CPU::ADC } },
+   { 0x6D, { 3, 4, INSTR_ADC, Absolute, &CPU::ADC } },
+   { 0x7D, { 3, 4 /*+1 if page crossed*/, INSTR_ADC, Absolute_X, &CPU::ADC } },
+   { 0x79, { 3, 4 /*+1 if page crossed*/, INSTR_ADC, Absolute_Y, &CPU::ADC } },
+   { 0x61, { 2, 6, INSTR_ADC, Indirect_X, &CPU::ADC } },
+   { 0x71, { 2, 5 /*+1 if page crossed*/, INSTR_ADC, Indirect_Y, &CPU::ADC } },
+
+   { 0x29, { 2, 2, INSTR_AND, Immediate, &CPU::AND } },
+   { 0x25, { 2, 3, INSTR_AND, ZeroPage, &CPU::AND } },
+   { 0x35, { 2, 4, INSTR_AND, ZeroPage_X, &CPU::AND } },
+   { 0x2D, { 3, 4, INSTR_AND, Absolute, &CPU::AND } },
+   { 0x3D, { 3, 4 /*+1 if page crossed*/, INSTR_AND, Absolute_X, &CPU::AND } },
+   { 0x39, { 3, 4 /*+1 if page crossed*/, INSTR_AND, Absolute_Y, &CPU::AND } },
+   { 0x21, { 2, 6, INSTR_AND, Indirect_X, &CPU::AND } },
+   { 0x31, { 2, 5 /*+1 if page crossed*/, INSTR_AND, Indirect_Y, &CPU::AND } },
+
+   { 0x0A, { 1, 2, INSTR_ASL, NoneAddressing, &CPU::ASL } },
+   { 0x06, { 2, 5, INSTR_ASL, ZeroPage, &CPU::ASL } },
+   { 0x16, { 2, 6, INSTR_ASL, ZeroPage_X, &CPU::ASL } },
+   { 0x0E, { 3, 6, INSTR_ASL, Absolute, &CPU::ASL } },
+   { 0x1E, { 3, 7, INSTR_ASL, Absolute_X, &CPU::ASL } },
+
+   { 0x90, { 2, 2 /*+1 if branch succeeds+2 if to a new page*/, INSTR_BCC, Relative, &CPU::BCC } },
+
+   { 0xB0, { 2, 2 /*+1 if branch succeeds+2 if to a new page*/, INSTR_BCS, Relative, &CPU::BCS } },
+
+   { 0xF0, { 2, 2 /*+1 if branch succeeds+2 if to a new page*/, INSTR_BEQ, Relative, &CPU::BEQ } },
+
+   { 0x24, { 2, 3, INSTR_BIT, ZeroPage, &CPU::BIT } },
+   { 0x2C, { 3, 4, INSTR_BIT, Absolute, &CPU::BIT } },
+
+   { 0x30, { 2, 2 /*+1 if branch succeeds+2 if to a new page*/, INSTR_BMI, Relative, &CPU::BMI } },
+
+   { 0xD0, { 2, 2 /*+1 if branch succeeds+2 if to a new page*/, INSTR_BNE, Relative, &CPU::BNE } },
+
+   { 0x10, { 2, 2 /*+1 if branch succeeds+2 if to a new page*/, INSTR_BPL, Relative, &CPU::BPL } },
+
+   { 0x00, { 1, 7, INSTR_BRK, NoneAddressing, &CPU::BRK } },
+
+   { 0x50, { 2, 2 /*+1 if branch succeeds+2 if to a new page*/, INSTR_BVC, Relative, &CPU::BVC } },
+
+   { 0x70, { 2, 2 /*+1 if branch succeeds+2 if to a new page*/, INSTR_BVS, Relative, &CPU::BVS } },
+
+   { 0x18, { 1, 2, INSTR_CLC, NoneAddressing, &CPU::CLC } },
+
+   { 0xD8, { 1, 2, INSTR_CLD, NoneAddressing, &CPU::CLD } },
+
+   { 0x58, { 1, 2, INSTR_CLI, NoneAddressing, &CPU::CLI } },
+
+   { 0xB8, { 1, 2, INSTR_CLV, NoneAddressing, &CPU::CLV } },
+
+   { 0xC9, { 2, 2, INSTR_CMP, Immediate, &CPU::CMP } },
+   { 0xC5, { 2, 3, INSTR_CMP, ZeroPage, &CPU::CMP } },
+   { 0xD5, { 2, 4, INSTR_CMP, ZeroPage_X, &CPU::CMP } },
+   { 0xCD, { 3, 4, INSTR_CMP, Absolute, &CPU::CMP } },
+   { 0xDD, { 3, 4 /*+1 if page crossed*/, INSTR_CMP, Absolute_X, &CPU::CMP } },
+   { 0xD9, { 3, 4 /*+1 if page crossed*/, INSTR_CMP, Absolute_Y, &CPU::CMP } },
+   { 0xC1, { 2, 6, INSTR_CMP, Indirect_X, &CPU::CMP } },
+   { 0xD1, { 2, 5 /*+1 if page crossed*/, INSTR_CMP, Indirect_Y, &CPU::CMP } },
+
+   { 0xE0, { 2, 2, INSTR_CPX, Immediate, &CPU::CPX } },
+   { 0xE4, { 2, 3, INSTR_CPX, ZeroPage, &CPU::CPX } },
+   { 0xEC, { 3, 4, INSTR_CPX, Absolute, &CPU::CPX } },
+
+   { 0xC0, { 2, 2, INSTR_CPY, Immediate, &CPU::CPY } },
+   { 0xC4, { 2, 3, INSTR_CPY, ZeroPage, &CPU::CPY } },
+   { 0xCC, { 3, 4, INSTR_CPY, Absolute, &CPU::CPY } },
+
+   { 0xC6, { 2, 5, INSTR_DEC, ZeroPage, &CPU::DEC } },
+   { 0xD6, { 2, 6, INSTR_DEC, ZeroPage_X, &CPU::DEC } },
+   { 0xCE, { 3, 6, INSTR_DEC, Absolute, &CPU::DEC } },
+   { 0xDE, { 3, 7, INSTR_DEC, Absolute_X, &CPU::DEC } },
+
+   { 0xCA, { 1, 2, INSTR_DEX, NoneAddressing, &CPU::DEX } },
+
+   { 0x88, { 1, 2, INSTR_DEY, NoneAddressing, &CPU::DEY } },
+
+   { 0x49, { 2, 2, INSTR_EOR, Immediate, &CPU::EOR } },
+   { 0x45, { 2, 3, INSTR_EOR, ZeroPage, &CPU::EOR } },
+   { 0x55, { 2, 4, INSTR_EOR, ZeroPage_X, &CPU::EOR } },
+   { 0x4D, { 3, 4, INSTR_EOR, Absolute, &CPU::EOR } },
+   { 0x5D, { 3, 4 /*+1 if page crossed*/, INSTR_EOR, Absolute_X, &CPU::EOR } },
+   { 0x59, { 3, 4 /*+1 if page crossed*/, INSTR_EOR, Absolute_Y, &CPU::EOR } },
+   { 0x41, { 2, 6, INSTR_EOR, Indirect_X, &CPU::EOR } },
+   { 0x51, { 2, 5 /*+1 if page crossed*/, INSTR_EOR, Indirect_Y, &CPU::EOR } },
+
+   { 0xE6, { 2, 5, INSTR_INC, ZeroPage, &CPU::INC } },
+   { 0xF6, { 2, 6, INSTR_INC, ZeroPage_X, &CPU::INC } },
+   { 0xEE, { 3, 6, INSTR_INC, Absolute, &CPU::INC } },
+   { 0xFE, { 3, 7, INSTR_INC, Absolute_X, &CPU::INC } },
+
+   { 0xE8, { 1, 2, INSTR_INX, NoneAddressing, &CPU::INX } },
+
+   { 0xC8, { 1, 2, INSTR_INY, NoneAddressing, &CPU::INY } },
+
+   { 0x4C, { 3, 3, INSTR_JMP, Absolute, &CPU::JMP } },
+   { 0x6C, { 3, 5, INSTR_JMP, Indirect, &CPU::JMP } },
+
+   { 0x20, { 3, 6, INSTR_JSR, Absolute, &CPU::JSR } },
+
+   { 0xA9, { 2, 2, INSTR_LDA, Immediate, &CPU::LDA } },
+   { 0xA5, { 2, 3, INSTR_LDA, ZeroPage, &CPU::LDA } },
+   { 0xB5, { 2, 4, INSTR_LDA, ZeroPage_X, &CPU::LDA } },
+   { 0xAD, { 3, 4, INSTR_LDA, Absolute, &CPU::LDA } },
+   { 0xBD, { 3, 4 /*+1 if page crossed*/, INSTR_LDA, Absolute_X, &CPU::LDA } },
+   { 0xB9, { 3, 4 /*+1 if page crossed*/, INSTR_LDA, Absolute_Y, &CPU::LDA } },
+   { 0xA1, { 2, 6, INSTR_LDA, Indirect_X, &CPU::LDA } },
+   { 0xB1, { 2, 5 /*+1 if page crossed*/, INSTR_LDA, Indirect_Y, &CPU::LDA } },
+
+   { 0xA2, { 2, 2, INSTR_LDX, Immediate, &CPU::LDX } },
+   { 0xA6, { 2, 3, INSTR_LDX, ZeroPage, &CPU::LDX } },
+   { 0xB6, { 2, 4, INSTR_LDX, ZeroPage_Y, &CPU::LDX } },
+   { 0xAE, { 3, 4, INSTR_LDX, Absolute, &CPU::LDX } },
+   { 0xBE, { 3, 4 /*+1 if page crossed*/, INSTR_LDX, Absolute_Y, &CPU::LDX } },
+
+   { 0xA0, { 2, 2, INSTR_LDY, Immediate, &CPU::LDY } },
+   { 0xA4, { 2, 3, INSTR_LDY, ZeroPage, &CPU::LDY } },
+   { 0xB4, { 2, 4, INSTR_LDY, ZeroPage_X, &CPU::LDY } },
+   { 0xAC, { 3, 4, INSTR_LDY, Absolute, &CPU::LDY } },
+   { 0xBC, { 3, 4 /*+1 if page crossed*/, INSTR_LDY, Absolute_X, &CPU::LDY } },
+
+   { 0x4A, { 1, 2, INSTR_LSR, NoneAddressing, &CPU::LSR } },
+   { 0x46, { 2, 5, INSTR_LSR, ZeroPage, &CPU::LSR } },
+   { 0x56, { 2, 6, INSTR_LSR, ZeroPage_X, &CPU::LSR } },
+   { 0x4E, { 3, 6, INSTR_LSR, Absolute, &CPU::LSR } },
+   { 0x5E, { 3, 7, INSTR_LSR, Absolute_X, &CPU::LSR } },
+
+   { 0xEA, { 1, 2, INSTR_NOP, NoneAddressing, &CPU::NOP } },
+
+   { 0x09, { 2, 2, INSTR_ORA, Immediate, &CPU::ORA } },
+   { 0x05, { 2, 3, INSTR_ORA, ZeroPage, &CPU::ORA } },
+   { 0x15, { 2, 4, INSTR_ORA, ZeroPage_X, &CPU::ORA } },
+   { 0x0D, { 3, 4, INSTR_ORA, Absolute, &CPU::ORA } },
+   { 0x1D, { 3, 4 /*+1 if page crossed*/, INSTR_ORA, Absolute_X, &CPU::ORA } },
+   { 0x19, { 3, 4 /*+1 if page crossed*/, INSTR_ORA, Absolute_Y, &CPU::ORA } },
+   { 0x01, { 2, 6, INSTR_ORA, Indirect_X, &CPU::ORA } },
+   { 0x11, { 2, 5 /*+1 if page crossed*/, INSTR_ORA, Indirect_Y, &CPU::ORA } },
+
+   { 0x48, { 1, 3, INSTR_PHA, NoneAddressing, &CPU::PHA } },
+
+   { 0x08, { 1, 3, INSTR_PHP, NoneAddressing, &CPU::PHP } },
+
+   { 0x68, { 1, 4, INSTR_PLA, NoneAddressing, &CPU::PLA } },
+
+   { 0x28, { 1, 4, INSTR_PLP, NoneAddressing, &CPU::PLP } },
+
+   { 0x2A, { 1, 2, INSTR_ROL, NoneAddressing, &CPU::ROL } },
+   { 0x26, { 2, 5, INSTR_ROL, ZeroPage, &CPU::ROL } },
+   { 0x36, { 2, 6, INSTR_ROL, ZeroPage_X, &CPU::ROL } },
+   { 0x2E, { 3, 6, INSTR_ROL, Absolute, &CPU::ROL } },
+   { 0x3E, { 3, 7, INSTR_ROL, Absolute_X, &CPU::ROL } },
+
+   { 0x6A, { 1, 2, INSTR_ROR, NoneAddressing, &CPU::ROR } },
+   { 0x66, { 2, 5, INSTR_ROR, ZeroPage, &CPU::ROR } },
+   { 0x76, { 2, 6, INSTR_ROR, ZeroPage_X, &CPU::ROR } },
+   { 0x6E, { 3, 6, INSTR_ROR, Absolute, &CPU::ROR } },
+   { 0x7E, { 3, 7, INSTR_ROR, Absolute_X, &CPU::ROR } },
+
+   { 0x40, { 1, 6, INSTR_RTI, NoneAddressing, &CPU::RTI } },
+
+   { 0x60, { 1, 6, INSTR_RTS, NoneAddressing, &CPU::RTS } },
+
+   { 0xE9, { 2, 2, INSTR_SBC, Immediate, &CPU::SBC } },
+   { 0xE5, { 2, 3, INSTR_SBC, ZeroPage, &CPU::SBC } },
+   { 0xF5, { 2, 4, INSTR_SBC, ZeroPage_X, &CPU::SBC } },
+   { 0xED, { 3, 4, INSTR_SBC, Absolute, &CPU::SBC } },
+   { 0xFD, { 3, 4 /*+1 if page crossed*/, INSTR_SBC, Absolute_X, &CPU::SBC } },
+   { 0xF9, { 3, 4 /*+1 if page crossed*/, INSTR_SBC, Absolute_Y, &CPU::SBC } },
+   { 0xE1, { 2, 6, INSTR_SBC, Indirect_X, &CPU::SBC } },
+   { 0xF1, { 2, 5 /*+1 if page crossed*/, INSTR_SBC, Indirect_Y, &CPU::SBC } },
+
+   { 0x38, { 1, 2, INSTR_SEC, NoneAddressing, &CPU::SEC } },
+
+   { 0xF8, { 1, 2, INSTR_SED, NoneAddressing, &CPU::SED } },
+
+   { 0x78, { 1, 2, INSTR_SEI, NoneAddressing, &CPU::SEI } },
+
+   { 0x85, { 2, 3, INSTR_STA, ZeroPage, &CPU::STA } },
+   { 0x95, { 2, 4, INSTR_STA, ZeroPage_X, &CPU::STA } },
+   { 0x8D, { 3, 4, INSTR_STA, Absolute, &CPU::STA } },
+   { 0x9D, { 3, 5, INSTR_STA, Absolute_X, &CPU::STA } },
+   { 0x99, { 3, 5, INSTR_STA, Absolute_Y, &CPU::STA } },
+   { 0x81, { 2, 6, INSTR_STA, Indirect_X, &CPU::STA } },
+   { 0x91, { 2, 6, INSTR_STA, Indirect_Y, &CPU::STA } },
+
+   { 0x86, { 2, 3, INSTR_STX, ZeroPage, &CPU::STX } },
+   { 0x96, { 2, 4, INSTR_STX, ZeroPage_Y, &CPU::STX } },
+   { 0x8E, { 3, 4, INSTR_STX, Absolute, &CPU::STX } },
+
+   { 0x84, { 2, 3, INSTR_STY, ZeroPage, &CPU::STY } },
+   { 0x94, { 2, 4, INSTR_STY, ZeroPage_X, &CPU::STY } },
+   { 0x8C, { 3, 4, INSTR_STY, Absolute, &CPU::STY } },
+
+   { 0xAA, { 1, 2, INSTR_TAX, NoneAddressing, &CPU::TAX } },
+   { 0xA8, { 1, 2, INSTR_TAY, NoneAddressing, &CPU::TAY } },
+   { 0xBA, { 1, 2, INSTR_TSX, NoneAddressing, &CPU::TSX } },
+   { 0x8A, { 1, 2, INSTR_TXA, NoneAddressing, &CPU::TXA } },
+   { 0x9A, { 1, 2, INSTR_TXS, NoneAddressing, &CPU::TXS } },
+   { 0x98, { 1, 2, INSTR_TYA, NoneAddressing, &CPU::TYA } },
+};
+
+// Reads through an indexed address take one more cycle when the index
+// carries into the high byte, stores and read-modify-writes always take it
+constexpr bool penalisedOnPageCross(const instruction_t &instr) {
+   if(instr.mode != Absolute_X && instr.mode != Absolute_Y && instr.mode != Indirect_Y) return false;
+
+   switch(instr.name) {
+      case INSTR_ADC: case INSTR_AND: case INSTR_CMP: case INSTR_EOR:
+      case INSTR_LDA: case INSTR_LDX: case INSTR_LDY: case INSTR_NOP:
+      case INSTR_ORA: case INSTR_SBC:
+         return true;
+      default:
+         return false;
+   }
+}
+
+// Fill every slot of the dispatch table at compile time. Opcodes that are not
+// in the official list become INSTR_ILL, taking their length from the official
+// opcode in the same column so the program counter stays in sync.
+constexpr std::array<instruction_t, 256> buildInstructionSet() {
+   std::array<instruction_t, 256> set {};
+
+   for(size_t i = 0; i < set.size(); i++) {
+      set[i] = { 0, 2, INSTR_ILL, NoneAddressing, &CPU::ILL };
+   }
+
+   for(const opcode_t &op : officialOpcodes) {
+      set[op.opcode] = op.instr;
+   }
+
+   // Unofficial NOPs ($1A, $04, $0C, $1C, ...) are well defined, keep them as NOP
+   for(size_t i = 0; i < set.size(); i++) {
+      if(set[i].bytes != 0) continue;
+
+      uint8_t low = i & 0x1F;
+      if(low == 0x1A) {
+         set[i] = { 1, 2, INSTR_NOP, NoneAddressing, &CPU::NOP };
+      } else if(low == 0x04 || low == 0x14) {
+         set[i] = { 2, (uint8_t) (low == 0x04 ? 3 : 4), INSTR_NOP, low == 0x04 ? ZeroPage : ZeroPage_X, &CPU::NOP };
+      } else if(low == 0x0C || (low == 0x1C && i != 0x9C)) {
+         set[i] = { 3, 4, INSTR_NOP, low == 0x0C ? Absolute : Absolute_X, &CPU::NOP };
+      } else if(i == 0x80 || i == 0x82 || i == 0x89 || i == 0xC2 || i == 0xE2) {
+         set[i] = { 2, 2, INSTR_NOP, Immediate, &CPU::NOP };
+      }
+   }
+
+   // The remaining combined opcodes ($x3, $x7, $xB, $xF) share their operand
+   // layout with the official opcode two slots below
+   for(size_t i = 0; i < set.size(); i++) {
+      if(set[i].bytes != 0) continue;
+
+      if((i & 0x03) == 0x03 && set[i & ~0x02].bytes != 0) {
+         set[i].bytes  = set[i & ~0x02].bytes;
+         set[i].cycles = set[i & ~0x02].cycles;
+      } else if(i == 0x9C || i == 0x9E) {
+         set[i].bytes = 3; // SHY/SHX Absolute indexed
+      } else {
+         set[i].bytes = 1; // $x2 JAM opcodes
+      }
+   }
+
+   for(size_t i = 0; i < set.size(); i++) {
+      set[i].pageCross = penalisedOnPageCross(set[i]);
+   }
+
+   return set;
+}
+
+// Indexed directly by opcode
+inline constexpr std::array<instruction_t, 256> instructionSet = buildInstructionSet();
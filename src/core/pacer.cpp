@@ -0,0 +1,78 @@
+#include "pacer.h"
+#include "apu.h"
+
+#include <math.h>
+#include <string.h>
+
+Pacer::Pacer(double frameRate) : hostRate(0), frameRate(frameRate), last(-1), owed(0), apu(nullptr), target(0), fill(0) {
+    resetStats();
+}
+
+void Pacer::syncAudio(APU *apu, double latency) {
+    if(this->apu) this->apu->setRate(1.0);
+
+    this->apu = apu;
+    target = latency * APU_SAMPLE_RATE;
+    fill = target;
+}
+
+void Pacer::resetStats() {
+    memset(&stats, 0, sizeof(stats));
+    stats.ratio = 1.0;
+    m2 = 0;
+}
+
+int Pacer::tick(double now) {
+    int frames = 1;
+
+    if(last >= 0) {
+        double interval = now - last;
+
+        // Welford's running mean and variance
+        stats.ticks++;
+        double delta = interval - stats.meanInterval;
+        stats.meanInterval += delta / stats.ticks;
+        m2 += delta * (interval - stats.meanInterval);
+        stats.jitter = stats.ticks > 1 ? sqrt(m2 / (stats.ticks - 1)) : 0;
+        if(interval > stats.maxInterval) stats.maxInterval = interval;
+
+        if(interval > 0) {
+            double rate = 1 / interval;
+            hostRate = hostRate > 0 ? hostRate + (rate - hostRate) * 0.05 : rate;
+        }
+
+        if(fabs(hostRate - frameRate) < frameRate * PACER_LOCK_TOLERANCE) {
+            owed = 0;
+        } else {
+            owed += interval * frameRate;
+            frames = (int) owed;
+
+            if(frames > PACER_MAX_FRAMES) {
+                stats.dropped += frames - PACER_MAX_FRAMES;
+                owed = frames = PACER_MAX_FRAMES;
+            }
+            owed -= frames;
+        }
+    }
+    last = now;
+
+    stats.frames += frames;
+    if(frames == 0) stats.idle++;
+    if(frames > 1) stats.doubled++;
+
+    if(apu) updateRatio();
+    return frames;
+}
+
+// Proportional control on the smoothed fill: a full ring makes fewer samples
+// per frame, an emptying one more
+void Pacer::updateRatio() {
+    fill += ((double) apu->samples.size() - fill) * 0.1;
+
+    double error = (fill - target) / target;
+    if(error > 1) error = 1;
+    if(error < -1) error = -1;
+
+    stats.ratio = 1 - error * PACER_MAX_RATE_DELTA;
+    apu->setRate(stats.ratio);
+}
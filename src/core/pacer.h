@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cpu.h"
+
+class APU;
+
+// 60.0988 Hz on NTSC
+const double NES_FRAME_RATE = CPU_CLOCK_HZ * 3 / PPU_DOTS_PER_FRAME;
+
+// Hosts refreshing within this fraction of the frame rate run exactly one
+// frame per tick, and audio resampling absorbs the difference
+const double PACER_LOCK_TOLERANCE = 0.01;
+
+// Largest resampling adjustment, small enough not to be heard as pitch
+const double PACER_MAX_RATE_DELTA = 0.005;
+
+const double PACER_AUDIO_LATENCY = 0.05; // Seconds of samples to keep queued
+const int    PACER_MAX_FRAMES    = 4;    // Per tick, beyond that time is dropped
+
+typedef struct pacer_stats {
+    uint64_t ticks;
+    uint64_t frames;
+    uint64_t idle;    // Ticks that ran no frame, so the host repeats one
+    uint64_t doubled; // Ticks that ran more than one frame
+    uint64_t dropped; // Frames given up because the host fell behind
+
+    // Seconds between ticks
+    double meanInterval;
+    double jitter; // Standard deviation
+    double maxInterval;
+
+    double ratio; // Current audio resampling ratio
+} pacer_stats_t;
+
+// Decides how many whole frames to run each time the host's main loop comes
+// round, whatever its rate. A host refreshing at about the frame rate (a
+// 60 Hz display) is locked to one frame per tick so motion stays even;
+// otherwise frames follow the host clock. With audio, the sample ring's fill
+// level steers the APU's resampling ratio by at most PACER_MAX_RATE_DELTA,
+// so the ring neither drains nor overflows as the two clocks drift apart.
+class Pacer {
+    public:
+        Pacer(double frameRate = NES_FRAME_RATE);
+
+        // Hold apu's sample ring at about latency seconds. Null stops.
+        void syncAudio(APU *apu, double latency = PACER_AUDIO_LATENCY);
+
+        // Call once per host loop iteration with the time in seconds.
+        // Returns the number of frames to run now.
+        int tick(double now);
+
+        // Clear the statistics, keeping the clock
+        void resetStats();
+
+        pacer_stats_t stats;
+
+        // Host loop rate, smoothed, 0 until measured
+        double hostRate;
+
+    private:
+        void updateRatio();
+
+        double frameRate;
+        double last;  // Time of the previous tick, negative before the first
+        double owed;  // Frames due but not yet run
+        double m2;    // Sum of squared deviations of the intervals
+
+        APU *apu;
+        double target; // Samples
+        double fill;   // Smoothed ring fill
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct NES_COLOR_RGB {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+} NES_COLOR_RGB;
+
+const int NES_PALETTE_SIZE = 64;
+
+// 2C02 output for each of the 64 palette indices the PPU produces
+extern const NES_COLOR_RGB NES_PALETTE[NES_PALETTE_SIZE];
+
+// Pack a colour as 0xAABBGGRR, the byte order of an RGBA buffer
+inline uint32_t packRGBA(const NES_COLOR_RGB &color) {
+    return 0xFF000000 | (color.b << 16) | (color.g << 8) | color.r;
+}
+
+// Build a lookup table of 64 packed colours from a palette
+void buildPaletteLUT(const NES_COLOR_RGB *palette, uint32_t *lut);
+
+// Translate count palette indices through a 64 entry lookup table. Indices
+// are masked to 6 bits, so the loop has no branches and vectorizes.
+void convertFrame(const uint32_t *lut, const uint8_t *pixels, uint32_t *out, size_t count);
@@ -0,0 +1,136 @@
+#include "pattern.h"
+
+#include <array>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+static constexpr std::array<uint8_t, 256> buildReverseTable() {
+    std::array<uint8_t, 256> table {};
+
+    for(size_t i = 0; i < table.size(); i++) {
+        uint8_t reversed = 0;
+        for(int bit = 0; bit < 8; bit++) {
+            if(i & (1 << bit)) reversed |= 0x80 >> bit;
+        }
+        table[i] = reversed;
+    }
+
+    return table;
+}
+
+static constexpr std::array<uint8_t, 256> REVERSED = buildReverseTable();
+
+uint8_t reversePatternRow(uint8_t row) {
+    return REVERSED[row];
+}
+
+void decodePatternRowsScalar(const uint8_t *low, const uint8_t *high, uint8_t *pixels, size_t count) {
+    for(size_t tile = 0; tile < count; tile++) {
+        for(int x = 0; x < 8; x++) {
+            int shift = 7 - x;
+            pixels[tile * 8 + x] = ((low[tile] >> shift) & 0x01) | (((high[tile] >> shift) & 0x01) << 1);
+        }
+    }
+}
+
+// Every vector path works the same way: copy each bitplane byte into eight
+// lanes, keep one bit per lane with a mask, turn set lanes into 0xFF with a
+// compare and combine both planes into 0-3.
+
+#if defined(__AVX2__)
+
+void decodePatternRows(const uint8_t *low, const uint8_t *high, uint8_t *pixels, size_t count) {
+    const __m256i bits = _mm256_set1_epi64x((long long) 0x0102040810204080ULL);
+    const __m256i one  = _mm256_set1_epi8(1);
+    const __m256i two  = _mm256_set1_epi8(2);
+
+    size_t tile = 0;
+    for(; tile + 16 <= count; tile += 16) {
+        __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) (low + tile)));
+        __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) (high + tile)));
+
+        // Four tiles per 32 bytes, two per 128 bit lane
+        for(int group = 0; group < 4; group++) {
+            char a = group * 4, b = a + 1, c = a + 2, d = a + 3;
+            __m256i index = _mm256_setr_epi8(
+                a, a, a, a, a, a, a, a, b, b, b, b, b, b, b, b,
+                c, c, c, c, c, c, c, c, d, d, d, d, d, d, d, d);
+
+            __m256i l = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(lo, index), bits), bits);
+            __m256i h = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(hi, index), bits), bits);
+            __m256i out = _mm256_or_si256(_mm256_and_si256(l, one), _mm256_and_si256(h, two));
+
+            _mm256_storeu_si256((__m256i *) (pixels + (tile + group * 4) * 8), out);
+        }
+    }
+
+    decodePatternRowsScalar(low + tile, high + tile, pixels + tile * 8, count - tile);
+}
+
+#elif defined(__SSSE3__)
+
+void decodePatternRows(const uint8_t *low, const uint8_t *high, uint8_t *pixels, size_t count) {
+    const __m128i bits = _mm_set1_epi64x((long long) 0x0102040810204080ULL);
+    const __m128i one  = _mm_set1_epi8(1);
+    const __m128i two  = _mm_set1_epi8(2);
+
+    size_t tile = 0;
+    for(; tile + 16 <= count; tile += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (low + tile));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (high + tile));
+
+        // Two tiles per 16 bytes
+        for(int group = 0; group < 8; group++) {
+            char a = group * 2, b = a + 1;
+            __m128i index = _mm_setr_epi8(a, a, a, a, a, a, a, a, b, b, b, b, b, b, b, b);
+
+            __m128i l = _mm_cmpeq_epi8(_mm_and_si128(_mm_shuffle_epi8(lo, index), bits), bits);
+            __m128i h = _mm_cmpeq_epi8(_mm_and_si128(_mm_shuffle_epi8(hi, index), bits), bits);
+            __m128i out = _mm_or_si128(_mm_and_si128(l, one), _mm_and_si128(h, two));
+
+            _mm_storeu_si128((__m128i *) (pixels + (tile + group * 2) * 8), out);
+        }
+    }
+
+    decodePatternRowsScalar(low + tile, high + tile, pixels + tile * 8, count - tile);
+}
+
+#elif defined(__wasm_simd128__)
+
+void decodePatternRows(const uint8_t *low, const uint8_t *high, uint8_t *pixels, size_t count) {
+    const v128_t bits = wasm_i64x2_splat((int64_t) 0x0102040810204080ULL);
+    const v128_t one  = wasm_i8x16_splat(1);
+    const v128_t two  = wasm_i8x16_splat(2);
+
+    size_t tile = 0;
+    for(; tile + 16 <= count; tile += 16) {
+        v128_t lo = wasm_v128_load(low + tile);
+        v128_t hi = wasm_v128_load(high + tile);
+
+        // Two tiles per 16 bytes
+        for(int group = 0; group < 8; group++) {
+            int8_t a = group * 2, b = a + 1;
+            v128_t index = wasm_i8x16_make(a, a, a, a, a, a, a, a, b, b, b, b, b, b, b, b);
+
+            v128_t l = wasm_i8x16_eq(wasm_v128_and(wasm_i8x16_swizzle(lo, index), bits), bits);
+            v128_t h = wasm_i8x16_eq(wasm_v128_and(wasm_i8x16_swizzle(hi, index), bits), bits);
+            v128_t out = wasm_v128_or(wasm_v128_and(l, one), wasm_v128_and(h, two));
+
+            wasm_v128_store(pixels + (tile + group * 2) * 8, out);
+        }
+    }
+
+    decodePatternRowsScalar(low + tile, high + tile, pixels + tile * 8, count - tile);
+}
+
+#else
+
+void decodePatternRows(const uint8_t *low, const uint8_t *high, uint8_t *pixels, size_t count) {
+    decodePatternRowsScalar(low, high, pixels, count);
+}
+
+#endif
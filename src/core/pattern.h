@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Tile rows are stored as two bitplanes: the low byte holds bit 0 and the high
+// byte bit 1 of eight pixels, leftmost pixel in the most significant bit.
+//
+// decodePatternRows interleaves count rows into 8 two-bit palette indices each,
+// leftmost first, so pixels must hold count * 8 bytes. It uses AVX2 or SSSE3
+// natively and SIMD128 in the browser when the compiler targets them.
+void decodePatternRows(const uint8_t *low, const uint8_t *high, uint8_t *pixels, size_t count);
+
+// Portable reference implementation
+void decodePatternRowsScalar(const uint8_t *low, const uint8_t *high, uint8_t *pixels, size_t count);
+
+// Mirror a row horizontally, for flipped sprites
+uint8_t reversePatternRow(uint8_t row);
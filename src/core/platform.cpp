@@ -0,0 +1,74 @@
+#include "platform.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+void platformLog(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+
+#ifdef __EMSCRIPTEN__
+    char line[512];
+    vsnprintf(line, sizeof(line), format, args);
+    emscripten_log(EM_LOG_CONSOLE, "%s", line);
+#else
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+#endif
+
+    va_end(args);
+}
+
+#ifdef __EMSCRIPTEN__
+
+double platformTime() {
+    return emscripten_get_now() / 1000;
+}
+
+void platformMainLoop(void (*loop)(void *), void *arg, int fps) {
+    emscripten_set_main_loop_arg(loop, arg, fps, 1);
+}
+
+void platformStopMainLoop() {
+    emscripten_cancel_main_loop();
+}
+
+#else
+
+static bool running = false;
+
+double platformTime() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void platformMainLoop(void (*loop)(void *), void *arg, int fps) {
+    using clock = std::chrono::steady_clock;
+
+    clock::duration interval = fps > 0
+        ? std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / fps))
+        : clock::duration::zero();
+    clock::time_point next = clock::now();
+
+    running = true;
+    while(running) {
+        loop(arg);
+
+        if(fps > 0) {
+            next += interval;
+            std::this_thread::sleep_until(next);
+        }
+    }
+}
+
+void platformStopMainLoop() {
+    running = false;
+}
+
+#endif
@@ -0,0 +1,16 @@
+#pragma once
+
+// Platform services used by the core and front-ends. The browser build is
+// backed by emscripten, every other target by stdio and a plain loop.
+
+// printf-style logging, one line per call
+void platformLog(const char *format, ...);
+
+// Monotonic time in seconds, from an arbitrary origin
+double platformTime();
+
+// Call loop(arg) fps times per second (fps <= 0 runs as fast as possible,
+// or in the browser at the display's refresh rate).
+// Never returns in the browser; natively returns once platformStopMainLoop is called.
+void platformMainLoop(void (*loop)(void *), void *arg, int fps);
+void platformStopMainLoop();
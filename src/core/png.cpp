@@ -0,0 +1,227 @@
+#include "png.h"
+
+#include <array>
+
+static constexpr std::array<uint32_t, 256> buildCRCTable() {
+    std::array<uint32_t, 256> table {};
+
+    for(uint32_t i = 0; i < table.size(); i++) {
+        uint32_t crc = i;
+        for(int bit = 0; bit < 8; bit++) crc = (crc & 1) ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+        table[i] = crc;
+    }
+
+    return table;
+}
+
+static constexpr std::array<uint32_t, 256> CRC_TABLE = buildCRCTable();
+
+uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc) {
+    crc = ~crc;
+    for(size_t i = 0; i < size; i++) crc = CRC_TABLE[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+uint32_t adler32(const uint8_t *data, size_t size) {
+    uint32_t a = 1, b = 0;
+
+    // 5552 bytes is the most that can be summed before b overflows
+    while(size) {
+        size_t block = size < 5552 ? size : 5552;
+        for(size_t i = 0; i < block; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += block;
+        size -= block;
+    }
+
+    return (b << 16) | a;
+}
+
+// Deflate packs bits from the least significant end, Huffman codes most
+// significant bit first
+typedef struct deflate_bits {
+    std::vector<uint8_t> *out;
+    uint32_t bits;
+    int count;
+} deflate_bits_t;
+
+static void putBits(deflate_bits_t &stream, uint32_t value, int length) {
+    stream.bits |= value << stream.count;
+    stream.count += length;
+
+    while(stream.count >= 8) {
+        stream.out->push_back(stream.bits & 0xFF);
+        stream.bits >>= 8;
+        stream.count -= 8;
+    }
+}
+
+static void putCode(deflate_bits_t &stream, uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for(int bit = 0; bit < length; bit++) reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+    putBits(stream, reversed, length);
+}
+
+// Fixed literal/length code of RFC 1951 3.2.6
+static void putSymbol(deflate_bits_t &stream, int symbol) {
+    if(symbol < 144)      putCode(stream, 0x30 + symbol, 8);
+    else if(symbol < 256) putCode(stream, 0x190 + symbol - 144, 9);
+    else if(symbol < 280) putCode(stream, symbol - 256, 7);
+    else                  putCode(stream, 0xC0 + symbol - 280, 8);
+}
+
+static const uint16_t LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t DISTANCE_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t DISTANCE_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static void putMatch(deflate_bits_t &stream, size_t length, size_t distance) {
+    int code = 0;
+    while(code < 28 && LENGTH_BASE[code + 1] <= length) code++;
+    putSymbol(stream, 257 + code);
+    putBits(stream, length - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+
+    code = 0;
+    while(code < 29 && DISTANCE_BASE[code + 1] <= distance) code++;
+    putCode(stream, code, 5);
+    putBits(stream, distance - DISTANCE_BASE[code], DISTANCE_EXTRA[code]);
+}
+
+const int PNG_HASH_BITS = 15;
+const size_t PNG_MIN_MATCH = 3;
+const size_t PNG_MAX_MATCH = 258;
+
+static inline uint32_t hash(const uint8_t *data) {
+    uint32_t key = (data[0] << 16) | (data[1] << 8) | data[2];
+    return (key * 2654435761u) >> (32 - PNG_HASH_BITS);
+}
+
+void deflateFixed(const uint8_t *data, size_t size, std::vector<uint8_t> &out) {
+    // zlib header: deflate with a 32 KB window, check bits for 0x7801
+    out.push_back(0x78);
+    out.push_back(0x01);
+
+    deflate_bits_t stream = { &out, 0, 0 };
+    putBits(stream, 1, 1); // Final block
+    putBits(stream, 1, 2); // Fixed Huffman codes
+
+    // Chains of earlier positions with the same hash: head holds the
+    // latest, prev links each position to the one before it
+    std::vector<int32_t> head(1 << PNG_HASH_BITS, -1);
+    std::vector<int32_t> prev(PNG_WINDOW, -1);
+
+    auto insert = [&](size_t position) {
+        if(position + PNG_MIN_MATCH > size) return;
+        uint32_t key = hash(data + position);
+        prev[position & (PNG_WINDOW - 1)] = head[key];
+        head[key] = position;
+    };
+
+    size_t i = 0;
+    while(i < size) {
+        size_t best = 0;
+        size_t distance = 0;
+
+        if(i + PNG_MIN_MATCH <= size) {
+            size_t limit = size - i < PNG_MAX_MATCH ? size - i : PNG_MAX_MATCH;
+            int32_t candidate = head[hash(data + i)];
+
+            // Once a slot is reused the chain can jump forward; the distance
+            // check ends it there
+            for(int chain = 0; candidate >= 0 && chain < PNG_MAX_CHAIN; chain++) {
+                size_t back = i - candidate;
+                if(candidate >= (int32_t) i || back > PNG_WINDOW) break;
+
+                size_t length = 0;
+                while(length < limit && data[candidate + length] == data[i + length]) length++;
+                if(length > best) {
+                    best = length;
+                    distance = back;
+                    if(length == limit) break;
+                }
+
+                candidate = prev[candidate & (PNG_WINDOW - 1)];
+            }
+        }
+
+        if(best >= PNG_MIN_MATCH) {
+            putMatch(stream, best, distance);
+            for(size_t j = 0; j < best; j++) insert(i + j);
+            i += best;
+        } else {
+            putSymbol(stream, data[i]);
+            insert(i);
+            i++;
+        }
+    }
+
+    putSymbol(stream, 256); // End of block
+    if(stream.count) putBits(stream, 0, 8 - stream.count);
+
+    uint32_t check = adler32(data, size);
+    for(int shift = 24; shift >= 0; shift -= 8) out.push_back(check >> shift);
+}
+
+static void putU32(std::vector<uint8_t> &out, uint32_t value) {
+    for(int shift = 24; shift >= 0; shift -= 8) out.push_back(value >> shift);
+}
+
+static void putChunk(std::vector<uint8_t> &out, const char *type, const uint8_t *data, size_t size) {
+    putU32(out, size);
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    putU32(out, crc32(&out[start], size + 4));
+}
+
+void encodePNG(const uint8_t *pixels, int width, int height, const NES_COLOR_RGB *palette, int colors, std::vector<uint8_t> &out) {
+    static const uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    out.insert(out.end(), SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+
+    uint8_t header[13] = {
+        (uint8_t) (width >> 24), (uint8_t) (width >> 16), (uint8_t) (width >> 8), (uint8_t) width,
+        (uint8_t) (height >> 24), (uint8_t) (height >> 16), (uint8_t) (height >> 8), (uint8_t) height,
+        8, // Bit depth
+        3, // Indexed colour
+        0, 0, 0 // Deflate, adaptive filtering, no interlace
+    };
+    putChunk(out, "IHDR", header, sizeof(header));
+
+    std::vector<uint8_t> colorTable(colors * 3);
+    for(int i = 0; i < colors; i++) {
+        colorTable[i * 3 + 0] = palette[i].r;
+        colorTable[i * 3 + 1] = palette[i].g;
+        colorTable[i * 3 + 2] = palette[i].b;
+    }
+    putChunk(out, "PLTE", colorTable.data(), colorTable.size());
+
+    // Each row is its filter type, none, and the indices
+    std::vector<uint8_t> rows((size_t) (width + 1) * height);
+    for(int y = 0; y < height; y++) {
+        uint8_t *row = &rows[(size_t) y * (width + 1)];
+        row[0] = 0;
+        for(int x = 0; x < width; x++) row[x + 1] = pixels[(size_t) y * width + x] & 0x3F;
+    }
+
+    std::vector<uint8_t> compressed;
+    deflateFixed(rows.data(), rows.size(), compressed);
+    putChunk(out, "IDAT", compressed.data(), compressed.size());
+
+    putChunk(out, "IEND", nullptr, 0);
+}
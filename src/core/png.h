@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "palette.h"
+
+// Deflate window and how many earlier positions with the same hash are tried
+const size_t PNG_WINDOW    = 32768;
+const int    PNG_MAX_CHAIN = 32;
+
+// Encode a width x height image of palette indices as an 8 bit indexed PNG
+// into out, with colors entries of palette as its PLTE. Indices are masked
+// to 6 bits. Rows are left unfiltered and compressed as one deflate block
+// with LZ77 and the fixed Huffman codes: NES frames are built from repeated
+// tiles and runs of backdrop, so that is quick and most of the gain.
+void encodePNG(const uint8_t *pixels, int width, int height, const NES_COLOR_RGB *palette, int colors, std::vector<uint8_t> &out);
+
+// zlib stream of data, as encodePNG writes into its IDAT chunk
+void deflateFixed(const uint8_t *data, size_t size, std::vector<uint8_t> &out);
+
+uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0);
+uint32_t adler32(const uint8_t *data, size_t size);
@@ -0,0 +1,484 @@
+#include "ppu.h"
+#include "pattern.h"
+
+#include <string.h>
+
+static uint8_t registerRead(void *device, uint16_t address) {
+    return ((PPU *) device)->readRegister(address);
+}
+
+static void registerWrite(void *device, uint16_t address, uint8_t value) {
+    ((PPU *) device)->writeRegister(address, value);
+}
+
+static void dmaWrite(void *device, uint16_t address, uint8_t value) {
+    ((PPU *) device)->writeDMA(value);
+}
+
+PPU::PPU() : render(true), cpu(nullptr), chr(nullptr), chrRam(nullptr), mirroring(MirrorHorizontal) {
+    reset();
+}
+
+void PPU::reset() {
+    ctrl       = 0x00;
+    mask       = 0x00;
+    status     = 0x00;
+    oamAddress = 0x00;
+    readBuffer = 0x00;
+
+    v = 0x0000;
+    t = 0x0000;
+    x = 0;
+    w = false;
+
+    frame = 0;
+
+    // Start at vertical blank, so frames line up with CPU::runFrame
+    scanline = PPU_VBLANK_SCANLINE;
+    lineStart = cpu ? cpu->cycles * 3 : 0;
+    if(cpu) scheduleVblank();
+
+    memset(framebuffer, 0, sizeof(framebuffer));
+    memset(oam, 0, sizeof(oam));
+    memset(vram, 0, sizeof(vram));
+    memset(palette, 0, sizeof(palette));
+}
+
+void PPU::attach(CPU &cpu, Cartridge &cartridge) {
+    this->cpu = &cpu;
+
+    chr       = cartridge.chr;
+    chrRam    = cartridge.chrSize ? nullptr : cartridge.chrRam;
+    mirroring = cartridge.mirroring;
+
+    cpu.bus.mapDevice(MEM_PPU_REGISTERS_START >> 8, MEM_PPU_REGISTERS_END >> 8, this, registerRead, registerWrite);
+    cpu.bus.mapRegister(PPU_OAM_DMA, this, nullptr, dmaWrite);
+    cpu.ppu = this;
+    cpu.events.setHandler(EVENT_PPU_VBLANK, this, vblankEvent);
+
+    lineStart = cpu.cycles * 3;
+    scheduleVblank();
+}
+
+// Save states
+
+size_t PPU::stateSize() const {
+    return 31 + sizeof(oam) + sizeof(vram) + sizeof(palette) + (chrRam ? CHR_BANK_SIZE : 0);
+}
+
+void PPU::saveState(StateWriter &out) const {
+    out.begin("PPU ");
+    out.u8(ctrl);
+    out.u8(mask);
+    out.u8(status);
+    out.u8(oamAddress);
+    out.u8(readBuffer);
+    out.u16(v);
+    out.u16(t);
+    out.u8(x);
+    out.u8(w);
+    out.u64(frame);
+    out.u8(cpu && cpu->nmi); // Raised and not yet taken
+    out.u16(scanline);
+    out.u64(lineStart);
+    out.bytes(oam, sizeof(oam));
+    out.bytes(vram, sizeof(vram));
+    out.bytes(palette, sizeof(palette));
+    out.u8(chrRam != nullptr);
+    if(chrRam) out.bytes(chrRam, CHR_BANK_SIZE);
+    out.end();
+}
+
+void PPU::loadState(StateReader &in) {
+    if(!in.chunk("PPU ")) return;
+
+    ctrl       = in.u8();
+    mask       = in.u8();
+    status     = in.u8();
+    oamAddress = in.u8();
+    readBuffer = in.u8();
+    v          = in.u16();
+    t          = in.u16();
+    x          = in.u8();
+    w          = in.u8();
+    frame      = in.u64();
+    bool nmi   = in.u8();
+    scanline   = in.u16();
+    lineStart  = in.u64();
+    in.bytes(oam, sizeof(oam));
+    in.bytes(vram, sizeof(vram));
+    in.bytes(palette, sizeof(palette));
+    if(in.u8() && chrRam) in.bytes(chrRam, CHR_BANK_SIZE);
+
+    if(cpu) {
+        if(nmi) cpu->raiseNMI();
+        scheduleVblank();
+    }
+}
+
+// Timing
+
+void PPU::runScanlines(uint64_t dot) {
+    while(dot >= lineStart + PPU_DOTS_PER_SCANLINE) {
+        endScanline();
+
+        lineStart += PPU_DOTS_PER_SCANLINE;
+        scanline = (scanline + 1) % PPU_SCANLINES;
+
+        beginScanline();
+    }
+}
+
+void PPU::scheduleVblank() {
+    int lines = (PPU_VBLANK_SCANLINE - scanline + PPU_SCANLINES) % PPU_SCANLINES;
+    if(lines == 0) lines = PPU_SCANLINES; // Already begun
+
+    uint64_t dot = lineStart + (uint64_t) lines * PPU_DOTS_PER_SCANLINE;
+    cpu->events.schedule(EVENT_PPU_VBLANK, (dot + 2) / 3);
+}
+
+void PPU::vblankEvent(void *device, uint64_t cycle) {
+    PPU *ppu = (PPU *) device;
+
+    ppu->run(cycle);
+    ppu->scheduleVblank();
+}
+
+void PPU::beginScanline() {
+    if(scanline == PPU_VBLANK_SCANLINE) {
+        status |= PPUSTATUS_VBLANK;
+        frame++;
+
+        if((ctrl & PPUCTRL_NMI) && cpu) cpu->raiseNMI();
+    } else if(scanline == PPU_PRERENDER_SCANLINE) {
+        status &= ~(PPUSTATUS_VBLANK | PPUSTATUS_SPRITE_0 | PPUSTATUS_OVERFLOW);
+    }
+}
+
+static uint16_t incrementY(uint16_t v) {
+    if((v & 0x7000) != 0x7000) return v + 0x1000;
+
+    v &= ~0x7000;
+    uint16_t coarseY = (v & 0x03E0) >> 5;
+    if(coarseY == 29) {
+        coarseY = 0;
+        v ^= 0x0800; // Next vertical nametable
+    } else if(coarseY == 31) {
+        coarseY = 0;
+    } else {
+        coarseY++;
+    }
+
+    return (v & ~0x03E0) | (coarseY << 5);
+}
+
+void PPU::endScanline() {
+    bool visible = scanline < PPU_HEIGHT;
+    if(!visible && scanline != PPU_PRERENDER_SCANLINE) return;
+
+    if(visible && (render || affectsStatus(scanline))) renderScanline(scanline);
+
+    if(mask & (PPUMASK_BG | PPUMASK_SPRITES)) {
+        v = incrementY(v);
+        v = (v & ~0x041F) | (t & 0x041F); // Horizontal bits
+
+        if(scanline == PPU_PRERENDER_SCANLINE) {
+            v = (v & ~0x7BE0) | (t & 0x7BE0); // Vertical bits
+        }
+    }
+}
+
+// Rendering
+
+void PPU::renderScanline(int y) {
+    uint8_t *out = framebuffer + y * PPU_WIDTH;
+    uint8_t colorMask = (mask & PPUMASK_GRAYSCALE) ? 0x30 : 0x3F;
+
+    if(!(mask & (PPUMASK_BG | PPUMASK_SPRITES))) {
+        memset(out, palette[0] & colorMask, PPU_WIDTH);
+        return;
+    }
+
+    const uint8_t *patterns = chr ? chr : chrRam;
+
+    // Background: 33 tiles cover the line at any fine X scroll
+    uint8_t background[PPU_WIDTH];
+    memset(background, 0, sizeof(background));
+
+    if(mask & PPUMASK_BG) {
+        uint8_t low[33];
+        uint8_t high[33];
+        uint8_t attributes[33];
+        uint8_t pixels[33 * 8];
+
+        uint16_t address = v;
+        uint16_t table = (ctrl & PPUCTRL_BG_TABLE) ? 0x1000 : 0x0000;
+        uint16_t fineY = (v >> 12) & 0x07;
+
+        for(int tile = 0; tile < 33; tile++) {
+            uint8_t index = vram[nametableAddress(0x2000 | (address & 0x0FFF))];
+            uint8_t attribute = vram[nametableAddress(0x23C0 | (address & 0x0C00) | ((address >> 4) & 0x38) | ((address >> 2) & 0x07))];
+            uint8_t shift = ((address >> 4) & 0x04) | (address & 0x02);
+
+            attributes[tile] = ((attribute >> shift) & 0x03) << 2;
+            low[tile]  = patterns[table + index * 16 + fineY];
+            high[tile] = patterns[table + index * 16 + fineY + 8];
+
+            // Coarse X, wrapping into the next horizontal nametable
+            if((address & 0x001F) == 31) {
+                address = (address & ~0x001F) ^ 0x0400;
+            } else {
+                address++;
+            }
+        }
+
+        decodePatternRows(low, high, pixels, 33);
+
+        for(int px = 0; px < PPU_WIDTH; px++) {
+            uint8_t pixel = pixels[px + x];
+            background[px] = pixel ? attributes[(px + x) >> 3] | pixel : 0;
+        }
+
+        if(!(mask & PPUMASK_BG_LEFT)) memset(background, 0, 8);
+    }
+
+    // Sprites: palette index with bit 4 set, 0 where transparent
+    uint8_t sprites[PPU_WIDTH];
+    uint8_t behind[PPU_WIDTH];
+
+    memset(sprites, 0, sizeof(sprites));
+
+    if(mask & PPUMASK_SPRITES) renderSprites(y, sprites, behind);
+
+    for(int px = 0; px < PPU_WIDTH; px++) {
+        uint8_t color = background[px];
+        uint8_t sprite = sprites[px];
+
+        if(sprite) {
+            if(behind[px] & 0x02 && color && px != 255) status |= PPUSTATUS_SPRITE_0;
+            if(!(behind[px] & 0x01) || !color) color = sprite;
+        }
+
+        out[px] = palette[color] & colorMask;
+    }
+}
+
+// Whether rendering line y could set sprite 0 hit or sprite overflow
+bool PPU::affectsStatus(int y) {
+    if(!(mask & PPUMASK_SPRITES)) return false;
+
+    int height = (ctrl & PPUCTRL_SPRITE_16) ? 16 : 8;
+    bool hit = !(status & PPUSTATUS_SPRITE_0) && (mask & PPUMASK_BG);
+    bool overflow = !(status & PPUSTATUS_OVERFLOW);
+
+    int count = 0;
+    for(int i = 0; i < 64; i++) {
+        int row = y - (oam[i * 4] + 1);
+        if(row < 0 || row >= height) continue;
+
+        if(i == 0 && hit) return true;
+        if(++count > 8) return overflow;
+    }
+
+    return false;
+}
+
+// Evaluate and draw the first eight sprites on line y. behind holds bit 0 for
+// background priority and bit 1 for pixels of sprite 0. Returns the number of
+// sprites drawn.
+int PPU::renderSprites(int y, uint8_t *sprites, uint8_t *behind) {
+    const uint8_t *patterns = chr ? chr : chrRam;
+    int height = (ctrl & PPUCTRL_SPRITE_16) ? 16 : 8;
+
+    uint8_t selected[8];
+    uint8_t low[8];
+    uint8_t high[8];
+    uint8_t pixels[8 * 8];
+    int count = 0;
+
+    for(int i = 0; i < 64; i++) {
+        int row = y - (oam[i * 4] + 1);
+        if(row < 0 || row >= height) continue;
+
+        if(count == 8) {
+            status |= PPUSTATUS_OVERFLOW;
+            break;
+        }
+
+        uint8_t tile = oam[i * 4 + 1];
+        uint8_t attribute = oam[i * 4 + 2];
+
+        if(attribute & 0x80) row = height - 1 - row; // Vertical flip
+
+        uint16_t address;
+        if(height == 16) {
+            address = ((tile & 0x01) << 12) | ((tile & 0xFE) << 4);
+            if(row >= 8) {
+                address += 16;
+                row -= 8;
+            }
+        } else {
+            address = ((ctrl & PPUCTRL_SPRITE_TABLE) ? 0x1000 : 0x0000) | (tile << 4);
+        }
+
+        low[count]  = patterns[address + row];
+        high[count] = patterns[address + row + 8];
+
+        if(attribute & 0x40) { // Horizontal flip
+            low[count]  = reversePatternRow(low[count]);
+            high[count] = reversePatternRow(high[count]);
+        }
+
+        selected[count++] = i;
+    }
+
+    decodePatternRows(low, high, pixels, count);
+
+    // Lower OAM indices win, so only fill pixels nothing has drawn to yet
+    int left = (mask & PPUMASK_SPRITES_LEFT) ? 0 : 8;
+    for(int s = 0; s < count; s++) {
+        const uint8_t *entry = &oam[selected[s] * 4];
+        uint8_t color = 0x10 | ((entry[2] & 0x03) << 2);
+        uint8_t flags = ((entry[2] & 0x20) ? 0x01 : 0x00) | (selected[s] == 0 ? 0x02 : 0x00);
+
+        for(int px = 0; px < 8; px++) {
+            int screenX = entry[3] + px;
+            if(screenX >= PPU_WIDTH) break;
+
+            uint8_t pixel = pixels[s * 8 + px];
+            if(!pixel || screenX < left || sprites[screenX]) continue;
+
+            sprites[screenX] = color | pixel;
+            behind[screenX] = flags;
+        }
+    }
+
+    return count;
+}
+
+// Registers
+
+uint8_t PPU::readRegister(uint16_t address) {
+    run(cpu->cycles);
+
+    uint8_t value = 0x00;
+
+    switch(address & 0x07) {
+        case 2: // PPUSTATUS
+            value = (status & 0xE0) | (readBuffer & 0x1F);
+            status &= ~PPUSTATUS_VBLANK;
+            w = false;
+            break;
+        case 4: // OAMDATA
+            value = oam[oamAddress];
+            break;
+        case 7: // PPUDATA, buffered except for the palette
+            if((v & 0x3FFF) < 0x3F00) {
+                value = readBuffer;
+                readBuffer = read(v);
+            } else {
+                value = read(v);
+                readBuffer = read(v - 0x1000);
+            }
+            v += (ctrl & PPUCTRL_INCREMENT) ? 32 : 1;
+            break;
+    }
+
+    return value;
+}
+
+void PPU::writeRegister(uint16_t address, uint8_t value) {
+    run(cpu->cycles);
+
+    switch(address & 0x07) {
+        case 0: // PPUCTRL
+            // Enabling NMI during vertical blank raises it immediately
+            if(!(ctrl & PPUCTRL_NMI) && (value & PPUCTRL_NMI) && (status & PPUSTATUS_VBLANK) && cpu) cpu->raiseNMI();
+
+            ctrl = value;
+            t = (t & 0xF3FF) | ((value & 0x03) << 10);
+            break;
+        case 1: // PPUMASK
+            mask = value;
+            break;
+        case 3: // OAMADDR
+            oamAddress = value;
+            break;
+        case 4: // OAMDATA
+            oam[oamAddress++] = value;
+            break;
+        case 5: // PPUSCROLL
+            if(!w) {
+                t = (t & ~0x001F) | (value >> 3);
+                x = value & 0x07;
+            } else {
+                t = (t & 0x8C1F) | ((value & 0x07) << 12) | ((value & 0xF8) << 2);
+            }
+            w = !w;
+            break;
+        case 6: // PPUADDR
+            if(!w) {
+                t = (t & 0x00FF) | ((value & 0x3F) << 8);
+            } else {
+                t = (t & 0xFF00) | value;
+                v = t;
+            }
+            w = !w;
+            break;
+        case 7: // PPUDATA
+            write(v, value);
+            v += (ctrl & PPUCTRL_INCREMENT) ? 32 : 1;
+            break;
+    }
+}
+
+// Copy a CPU page into OAM, stalling the CPU for 513 or 514 cycles
+void PPU::writeDMA(uint8_t page) {
+    run(cpu->cycles);
+
+    for(int i = 0; i < 256; i++) {
+        oam[(oamAddress + i) & 0xFF] = cpu->memoryRead((page << 8) | i);
+    }
+
+    cpu->cycles += 513 + (cpu->cycles & 1);
+}
+
+// PPU address space
+
+uint16_t PPU::nametableAddress(uint16_t address) {
+    uint16_t table = (address >> 10) & 0x03;
+
+    switch(mirroring) {
+        case MirrorVertical:   table &= 0x01; break;
+        case MirrorHorizontal: table >>= 1;   break;
+        default: break;
+    }
+
+    return (table << 10) | (address & 0x03FF);
+}
+
+// $3F10/$3F14/$3F18/$3F1C mirror the backdrop entries below them
+static uint8_t paletteIndex(uint16_t address) {
+    uint8_t index = address & 0x1F;
+    return ((index & 0x13) == 0x10) ? index & ~0x10 : index;
+}
+
+uint8_t PPU::read(uint16_t address) {
+    address &= 0x3FFF;
+
+    if(address < 0x2000) return chr ? chr[address] : chrRam ? chrRam[address] : 0x00;
+    if(address < 0x3F00) return vram[nametableAddress(address)];
+    return palette[paletteIndex(address)];
+}
+
+void PPU::write(uint16_t address, uint8_t value) {
+    address &= 0x3FFF;
+
+    if(address < 0x2000) {
+        if(chrRam) chrRam[address] = value;
+    } else if(address < 0x3F00) {
+        vram[nametableAddress(address)] = value;
+    } else {
+        palette[paletteIndex(address)] = value;
+    }
+}
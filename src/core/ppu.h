@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "cpu.h"
+#include "cartridge.h"
+#include "state.h"
+
+const int PPU_WIDTH  = 256;
+const int PPU_HEIGHT = 240;
+
+const int PPU_DOTS_PER_SCANLINE = 341;
+const int PPU_SCANLINES         = 262;
+const int PPU_VBLANK_SCANLINE   = 241;
+const int PPU_PRERENDER_SCANLINE = 261;
+
+const uint16_t PPU_OAM_DMA = 0x4014;
+
+// PPUCTRL ($2000)
+#define PPUCTRL_INCREMENT       0b00000100
+#define PPUCTRL_SPRITE_TABLE    0b00001000
+#define PPUCTRL_BG_TABLE        0b00010000
+#define PPUCTRL_SPRITE_16       0b00100000
+#define PPUCTRL_NMI             0b10000000
+
+// PPUMASK ($2001)
+#define PPUMASK_GRAYSCALE       0b00000001
+#define PPUMASK_BG_LEFT         0b00000010
+#define PPUMASK_SPRITES_LEFT    0b00000100
+#define PPUMASK_BG              0b00001000
+#define PPUMASK_SPRITES         0b00010000
+
+// PPUSTATUS ($2002)
+#define PPUSTATUS_OVERFLOW      0b00100000
+#define PPUSTATUS_SPRITE_0      0b01000000
+#define PPUSTATUS_VBLANK        0b10000000
+
+// 2C02 picture processing unit. Renders whole scanlines into a framebuffer of
+// NES palette indices (0-63), and is clocked from the CPU cycle counter:
+// three dots per CPU cycle. Rather than being ticked after every instruction
+// it catches up when the CPU touches its registers or OAM DMA, and at the
+// start of vertical blank, which is on the CPU's event timeline. Frames start
+// at vertical blank so they line up with CPU::runFrame. A line is drawn in
+// one go when it completes, so a register write partway through a line
+// affects the whole of that line.
+class PPU {
+    public:
+        PPU();
+
+        void reset();
+
+        // Map the registers at $2000-$3FFF and OAM DMA at $4014, and render
+        // from the cartridge's CHR and mirroring
+        void attach(CPU &cpu, Cartridge &cartridge);
+
+        // Catch up to the given CPU cycle
+        inline void run(uint64_t cpuCycle) {
+            if(cpuCycle * 3 >= lineStart + PPU_DOTS_PER_SCANLINE) runScanlines(cpuCycle * 3);
+        }
+
+        // CPU side registers
+        uint8_t readRegister(uint16_t address);
+        void writeRegister(uint16_t address, uint8_t value);
+        void writeDMA(uint8_t page);
+
+        // PPU address space
+        uint8_t read(uint16_t address);
+        void write(uint16_t address, uint8_t value);
+
+        // "PPU " chunk of a save state, with CHR-RAM when the cartridge has
+        // it. The framebuffer is left out, the next frame redraws it.
+        size_t stateSize() const;
+        void saveState(StateWriter &out) const;
+        void loadState(StateReader &in);
+
+        uint8_t framebuffer[PPU_HEIGHT * PPU_WIDTH];
+
+        // Draw into the framebuffer. When off, the framebuffer is left
+        // stale and lines are only evaluated when they could still set
+        // sprite 0 hit or overflow, so emulation stays exact.
+        bool render;
+
+        // Frames completed
+        uint64_t frame;
+
+        int scanline;
+        uint64_t lineStart; // Dot at which the current scanline started
+
+        // Registers
+        uint8_t ctrl;
+        uint8_t mask;
+        uint8_t status;
+        uint8_t oamAddress;
+        uint8_t readBuffer;
+
+        // Internal scroll registers
+        uint16_t v;  // Current VRAM address
+        uint16_t t;  // Temporary VRAM address
+        uint8_t  x;  // Fine X scroll
+        bool     w;  // Write toggle
+
+        uint8_t oam[256];
+        uint8_t vram[0x1000]; // Four nametables, two unless the board adds RAM
+        uint8_t palette[32];
+
+    private:
+        void runScanlines(uint64_t dot);
+
+        // Put the start of the next vertical blank on the CPU's timeline
+        void scheduleVblank();
+        static void vblankEvent(void *device, uint64_t cycle);
+
+        void beginScanline();
+        void endScanline();
+        void renderScanline(int y);
+        bool affectsStatus(int y);
+        int renderSprites(int y, uint8_t *sprites, uint8_t *behind);
+
+        uint16_t nametableAddress(uint16_t address);
+
+        CPU *cpu;
+        const uint8_t *chr;
+        uint8_t *chrRam;
+        uint8_t mirroring;
+};
@@ -0,0 +1,228 @@
+#include "rewind.h"
+#include "state.h"
+
+#include <string.h>
+
+Rewind::Rewind(size_t stateCapacity, size_t capacity, size_t maxFrames, int keyframeInterval) :
+    stateCapacity(stateCapacity),
+    keyframeInterval(keyframeInterval),
+    history(new uint8_t[capacity]),
+    capacity(capacity),
+    entries(new rewind_entry_t[maxFrames]),
+    maxFrames(maxFrames),
+    keyframe(new uint8_t[stateCapacity]),
+    scratch(new uint8_t[2 * stateCapacity + 32]),
+    scratchSize(2 * stateCapacity + 32),
+    restore(new uint8_t[stateCapacity]),
+    queue(REWIND_STAGING_SLOTS, stateCapacity, compress, this) {
+
+    head = 0;
+    first = 0;
+    count = 0;
+    bytes = 0;
+    keyframeSize = 0;
+    sinceKeyframe = -1;
+}
+
+bool Rewind::record(const CPU &cpu) {
+    uint8_t *slot = queue.acquire();
+    if(!slot) return false;
+
+    // A state that doesn't fit goes through with size 0 and is skipped, as
+    // only the worker may hand slots back
+    size_t size = saveState(cpu, slot, stateCapacity);
+
+    queue.commit(size, 0);
+    return size != 0;
+}
+
+void Rewind::flush() {
+    queue.flush();
+}
+
+size_t Rewind::frames() {
+    std::lock_guard<std::mutex> guard(lock);
+    return count;
+}
+
+size_t Rewind::used() {
+    std::lock_guard<std::mutex> guard(lock);
+    return bytes;
+}
+
+// Worker: compress each staged state as it arrives
+void Rewind::compress(void *context, const uint8_t *state, size_t size, uint64_t) {
+    if(size) ((Rewind *) context)->store(state, size);
+}
+
+void Rewind::store(const uint8_t *state, size_t size) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    bool key = sinceKeyframe < 0 || sinceKeyframe >= keyframeInterval || size != keyframeSize;
+
+    for(;;) {
+        size_t length = encode(state, key ? nullptr : keyframe.get(), size, scratch.get(), scratchSize);
+        if(!length || !reserve(length)) return;
+
+        // Making room dropped the keyframe this delta was taken against
+        if(!key && !count) {
+            key = true;
+            continue;
+        }
+
+        memcpy(history.get() + head, scratch.get(), length);
+        entries[(first + count) % maxFrames] = { head, (uint32_t) length, (uint32_t) size, key };
+        count++;
+        head += length;
+        bytes += length;
+        break;
+    }
+
+    if(key) {
+        memcpy(keyframe.get(), state, size);
+        keyframeSize = size;
+        sinceKeyframe = 0;
+    }
+    sinceKeyframe++;
+}
+
+// Make size contiguous bytes free at head, dropping the oldest frames as
+// needed. Live data runs from the oldest entry up to head, wrapping at most
+// once; entries never straddle the end of the ring.
+bool Rewind::reserve(size_t size) {
+    if(size > capacity) return false;
+
+    while(count == maxFrames) dropGroup();
+
+    for(;;) {
+        if(!count) {
+            if(capacity - head < size) head = 0;
+            return true;
+        }
+
+        size_t start = entries[first].offset;
+        if(start < head) {
+            if(capacity - head >= size) return true;
+            if(start >= size) {
+                head = 0;
+                return true;
+            }
+        } else if(start - head >= size) {
+            return true;
+        }
+
+        dropGroup();
+    }
+}
+
+void Rewind::dropOldest() {
+    bytes -= entries[first].size;
+    first = (first + 1) % maxFrames;
+    count--;
+}
+
+// Drop the oldest keyframe and the deltas that depend on it
+void Rewind::dropGroup() {
+    dropOldest();
+    while(count && !entries[first].keyframe) dropOldest();
+
+    if(!count) sinceKeyframe = -1;
+}
+
+bool Rewind::rewind(CPU &cpu) {
+    flush();
+
+    std::lock_guard<std::mutex> guard(lock);
+    if(!count) return false;
+
+    // The oldest entry is always a keyframe, so the search ends
+    size_t age = 0;
+    while(!entry(age).keyframe) age++;
+
+    const rewind_entry_t &key = entry(age);
+    const rewind_entry_t newest = entry(0);
+
+    memset(restore.get(), 0, key.state);
+    if(!decode(history.get() + key.offset, key.size, restore.get(), key.state)) return false;
+    if(!newest.keyframe && !decode(history.get() + newest.offset, newest.size, restore.get(), newest.state)) return false;
+    if(!loadState(cpu, restore.get(), newest.state)) return false;
+
+    head = newest.offset;
+    bytes -= newest.size;
+    count--;
+
+    // New frames can't be deltas of a keyframe that is gone
+    if(newest.keyframe) sinceKeyframe = -1;
+
+    return true;
+}
+
+// Encoding
+
+static bool writeVarint(uint8_t *out, size_t capacity, size_t &position, size_t value) {
+    do {
+        if(position >= capacity) return false;
+
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        out[position++] = byte | (value ? 0x80 : 0);
+    } while(value);
+
+    return true;
+}
+
+static bool readVarint(const uint8_t *data, size_t size, size_t &position, size_t &value) {
+    value = 0;
+
+    for(int shift = 0; shift < 64; shift += 7) {
+        if(position >= size) return false;
+
+        uint8_t byte = data[position++];
+        value |= (size_t) (byte & 0x7F) << shift;
+        if(!(byte & 0x80)) return true;
+    }
+
+    return false;
+}
+
+// Runs of a zero count and a literal count followed by the literal bytes.
+// Single zeros stay inside literals, where they cost less than a new run.
+size_t Rewind::encode(const uint8_t *state, const uint8_t *base, size_t size, uint8_t *out, size_t capacity) {
+    size_t in = 0;
+    size_t position = 0;
+
+    auto delta = [&](size_t i) -> uint8_t { return base ? state[i] ^ base[i] : state[i]; };
+
+    while(in < size) {
+        size_t zeros = in;
+        while(zeros < size && !delta(zeros)) zeros++;
+
+        size_t literals = zeros;
+        while(literals < size && (delta(literals) || (literals + 1 < size && delta(literals + 1)))) literals++;
+
+        if(!writeVarint(out, capacity, position, zeros - in)) return 0;
+        if(!writeVarint(out, capacity, position, literals - zeros)) return 0;
+        if(capacity - position < literals - zeros) return 0;
+
+        for(size_t i = zeros; i < literals; i++) out[position++] = delta(i);
+        in = literals;
+    }
+
+    return position;
+}
+
+bool Rewind::decode(const uint8_t *data, size_t size, uint8_t *state, size_t stateSize) {
+    size_t position = 0;
+    size_t out = 0;
+
+    while(position < size) {
+        size_t zeros, literals;
+        if(!readVarint(data, size, position, zeros) || !readVarint(data, size, position, literals)) return false;
+        if(zeros > stateSize - out || literals > stateSize - out - zeros || literals > size - position) return false;
+
+        out += zeros;
+        for(size_t i = 0; i < literals; i++) state[out++] ^= data[position++];
+    }
+
+    return out == stateSize;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+
+#include "staging.h"
+
+class CPU;
+
+const size_t REWIND_STAGING_SLOTS      = 4;
+const size_t REWIND_DEFAULT_CAPACITY   = 4 << 20; // Compressed bytes
+const size_t REWIND_DEFAULT_FRAMES     = 3600;    // 60 seconds at 60 fps
+const int    REWIND_KEYFRAME_INTERVAL  = 60;
+
+typedef struct rewind_entry {
+    size_t offset;   // In the history ring
+    uint32_t size;   // Compressed
+    uint32_t state;  // Size of the state it decodes to
+    bool keyframe;
+} rewind_entry_t;
+
+// Save state history for stepping back frame by frame. record() only saves
+// into a slot of a StagingQueue; its worker thread compresses
+// each state as an XOR delta against the latest keyframe, run-length
+// encoded, into a fixed-size ring. When the ring is full the oldest frames
+// are dropped, along with any deltas whose keyframe went with them.
+class Rewind {
+    public:
+        // stateCapacity must hold a whole state, see stateSize()
+        Rewind(size_t stateCapacity, size_t capacity = REWIND_DEFAULT_CAPACITY,
+               size_t maxFrames = REWIND_DEFAULT_FRAMES, int keyframeInterval = REWIND_KEYFRAME_INTERVAL);
+
+        Rewind(const Rewind &) = delete;
+        Rewind &operator=(const Rewind &) = delete;
+
+        // Emulation thread, once per frame. Returns false, dropping the frame,
+        // when the worker has fallen a whole staging ring behind.
+        bool record(const CPU &cpu);
+
+        // Wait until every recorded frame has been compressed
+        void flush();
+
+        // Restore the newest frame and drop it from the history, so calling
+        // it repeatedly walks backwards. False when there is nothing left.
+        bool rewind(CPU &cpu);
+
+        // Frames available and compressed bytes they take, after flush()
+        size_t frames();
+        size_t used();
+
+        // Run-length encode the XOR of state and base (all zero when base is
+        // null). Returns the encoded size, 0 if it didn't fit in capacity.
+        static size_t encode(const uint8_t *state, const uint8_t *base, size_t size, uint8_t *out, size_t capacity);
+
+        // Reverse of encode: XOR the decoded bytes onto state, which holds
+        // base (or zeros) on entry. False if data is malformed.
+        static bool decode(const uint8_t *data, size_t size, uint8_t *state, size_t stateSize);
+
+    private:
+        static void compress(void *context, const uint8_t *state, size_t size, uint64_t tag);
+        void store(const uint8_t *state, size_t size);
+        bool reserve(size_t size);
+        void dropOldest();
+        void dropGroup();
+
+        rewind_entry_t &entry(size_t age) { return entries[(first + count - 1 - age) % maxFrames]; }
+
+        size_t stateCapacity;
+        int keyframeInterval;
+
+        // History, guarded by lock
+        std::mutex lock;
+        std::unique_ptr<uint8_t[]> history;
+        size_t capacity;
+        size_t head;
+        std::unique_ptr<rewind_entry_t[]> entries;
+        size_t maxFrames;
+        size_t first;
+        size_t count;
+        size_t bytes;
+
+        // Worker side: the latest keyframe decoded, and scratch space
+        std::unique_ptr<uint8_t[]> keyframe;
+        size_t keyframeSize;
+        int sinceKeyframe; // Frames since the keyframe, -1 to force a new one
+        std::unique_ptr<uint8_t[]> scratch;
+        size_t scratchSize;
+
+        // Emulation side: the state being restored
+        std::unique_ptr<uint8_t[]> restore;
+
+        // Last, so the worker is joined before the history it writes goes away
+        StagingQueue queue;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+
+// Single-producer/single-consumer lock-free ring buffer. Storage is allocated
+// once up front; push and pop never allocate or take a lock. Capacity is
+// rounded up to a power of two so indices wrap with a mask.
+template <typename T>
+class SpscRing {
+    public:
+        SpscRing(size_t capacity) {
+            size_t size = 1;
+            while(size < capacity) size <<= 1;
+
+            mask = size - 1;
+            slots.reset(new T[size]);
+        }
+
+        size_t capacity() const { return mask + 1; }
+
+        // Producer side
+        bool push(const T &value) {
+            size_t write = head.load(std::memory_order_relaxed);
+            if(write - tail.load(std::memory_order_acquire) > mask) return false; // Full
+
+            slots[write & mask] = value;
+            head.store(write + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer side
+        bool pop(T &value) {
+            size_t read = tail.load(std::memory_order_relaxed);
+            if(read == head.load(std::memory_order_acquire)) return false; // Empty
+
+            value = slots[read & mask];
+            tail.store(read + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Either side, approximate while the other side is running
+        size_t size() const {
+            return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+        }
+
+    private:
+        std::unique_ptr<T[]> slots;
+        size_t mask;
+
+        // Kept on separate cache lines so producer and consumer don't contend
+        alignas(64) std::atomic<size_t> head { 0 };
+        alignas(64) std::atomic<size_t> tail { 0 };
+};
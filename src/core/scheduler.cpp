@@ -0,0 +1,118 @@
+#include "scheduler.h"
+
+Scheduler::Scheduler() {
+    for(int i = 0; i < EVENT_COUNT; i++) {
+        devices[i] = nullptr;
+        handlers[i] = nullptr;
+    }
+
+    deadline = SCHEDULER_NEVER;
+    clear();
+}
+
+void Scheduler::setHandler(uint8_t source, void *device, event_handler_t handler) {
+    devices[source] = device;
+    handlers[source] = handler;
+}
+
+void Scheduler::clear() {
+    count = 0;
+    for(int i = 0; i < EVENT_COUNT; i++) positions[i] = -1;
+
+    update();
+}
+
+void Scheduler::schedule(uint8_t source, uint64_t cycle) {
+    if(positions[source] >= 0) {
+        size_t index = positions[source];
+        uint64_t previous = heap[index].cycle;
+
+        heap[index].cycle = cycle;
+        if(cycle < previous) siftUp(index);
+        else siftDown(index);
+    } else {
+        place(count, { cycle, source });
+        siftUp(count++);
+    }
+
+    update();
+}
+
+void Scheduler::cancel(uint8_t source) {
+    if(positions[source] < 0) return;
+
+    remove(positions[source]);
+    update();
+}
+
+uint64_t Scheduler::when(uint8_t source) const {
+    return positions[source] >= 0 ? heap[positions[source]].cycle : SCHEDULER_NEVER;
+}
+
+void Scheduler::setDeadline(uint64_t cycle) {
+    deadline = cycle;
+    update();
+}
+
+void Scheduler::dispatch(uint64_t cycle) {
+    while(count && heap[0].cycle <= cycle) {
+        scheduled_event_t event = heap[0];
+        remove(0);
+        update();
+
+        if(handlers[event.source]) handlers[event.source](devices[event.source], event.cycle);
+    }
+}
+
+// Heap
+
+void Scheduler::place(size_t index, const scheduled_event_t &event) {
+    heap[index] = event;
+    positions[event.source] = index;
+}
+
+void Scheduler::siftUp(size_t index) {
+    scheduled_event_t event = heap[index];
+
+    while(index > 0) {
+        size_t parent = (index - 1) / 2;
+        if(heap[parent].cycle <= event.cycle) break;
+
+        place(index, heap[parent]);
+        index = parent;
+    }
+
+    place(index, event);
+}
+
+void Scheduler::siftDown(size_t index) {
+    scheduled_event_t event = heap[index];
+
+    while(true) {
+        size_t child = index * 2 + 1;
+        if(child >= count) break;
+        if(child + 1 < count && heap[child + 1].cycle < heap[child].cycle) child++;
+        if(event.cycle <= heap[child].cycle) break;
+
+        place(index, heap[child]);
+        index = child;
+    }
+
+    place(index, event);
+}
+
+void Scheduler::remove(size_t index) {
+    positions[heap[index].source] = -1;
+    if(index == --count) return;
+
+    // Move the last event into the hole, then whichever way it belongs
+    uint8_t source = heap[count].source;
+    place(index, heap[count]);
+    siftDown(index);
+    siftUp(positions[source]);
+}
+
+void Scheduler::update() {
+    uint64_t first = count ? heap[0].cycle : SCHEDULER_NEVER;
+    next = first < deadline ? first : deadline;
+}
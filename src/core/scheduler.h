@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+const uint64_t SCHEDULER_NEVER = UINT64_MAX;
+
+// Event sources. Each has at most one event pending; scheduling it again
+// moves it.
+enum SCHEDULER_EVENT {
+    EVENT_INTERRUPT,  // Look at the interrupt lines at the next instruction boundary
+    EVENT_PPU_VBLANK,
+    EVENT_APU_FRAME,  // Frame counter IRQ
+    EVENT_APU_DMC,    // DMC sample end IRQ
+    EVENT_MAPPER,     // Reserved for mapper IRQ counters
+    EVENT_COUNT,
+};
+
+// Called with the cycle the event was due at, which may be slightly before
+// the current one
+typedef void (*event_handler_t)(void *device, uint64_t cycle);
+
+typedef struct scheduled_event {
+    uint64_t cycle;
+    uint8_t source;
+} scheduled_event_t;
+
+// Timeline of device events in CPU cycles, kept as a binary min-heap. The
+// CPU never polls devices: it compares its cycle counter against next once
+// per instruction and calls dispatch when it gets there.
+class Scheduler {
+    public:
+        Scheduler();
+
+        void setHandler(uint8_t source, void *device, event_handler_t handler);
+
+        void schedule(uint8_t source, uint64_t cycle);
+        void cancel(uint8_t source);
+
+        // When source's event is due, SCHEDULER_NEVER if it has none
+        uint64_t when(uint8_t source) const;
+
+        // Cap next at cycle, so the CPU's run loop stops there too
+        void setDeadline(uint64_t cycle);
+
+        // Run the handler of every event due at cycle, earliest first.
+        // Handlers may schedule further events.
+        void dispatch(uint64_t cycle);
+
+        // Drop every pending event, keeping the handlers
+        void clear();
+
+        // The earlier of the first event and the deadline
+        uint64_t next;
+
+    private:
+        void place(size_t index, const scheduled_event_t &event);
+        void siftUp(size_t index);
+        void siftDown(size_t index);
+        void remove(size_t index);
+        void update();
+
+        scheduled_event_t heap[EVENT_COUNT];
+        size_t count;
+        int8_t positions[EVENT_COUNT]; // Index in heap, -1 when not pending
+
+        void *devices[EVENT_COUNT];
+        event_handler_t handlers[EVENT_COUNT];
+
+        uint64_t deadline;
+};
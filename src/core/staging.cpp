@@ -0,0 +1,78 @@
+#include "staging.h"
+
+#include <string.h>
+#include <chrono>
+
+StagingQueue::StagingQueue(size_t slots, size_t slotSize, staging_handler_t handler, void *context) :
+    handler(handler),
+    context(context),
+    size(slotSize),
+    staging(new uint8_t[slots * slotSize]),
+    sizes(new size_t[slots]()),
+    tags(new uint64_t[slots]()),
+    filled(slots),
+    free(slots),
+    current(0),
+    committed(0),
+    handled(0),
+    running(true) {
+
+    for(size_t slot = 0; slot < slots; slot++) free.push(slot);
+
+    thread = std::thread(&StagingQueue::work, this);
+}
+
+StagingQueue::~StagingQueue() {
+    running.store(false, std::memory_order_release);
+    if(thread.joinable()) thread.join();
+}
+
+uint8_t *StagingQueue::acquire() {
+    if(!free.pop(current)) return nullptr;
+    return staging.get() + current * size;
+}
+
+void StagingQueue::commit(size_t used, uint64_t tag) {
+    sizes[current] = used;
+    tags[current] = tag;
+
+    committed.fetch_add(1, std::memory_order_relaxed);
+    filled.push(current);
+}
+
+bool StagingQueue::push(const uint8_t *data, size_t used, uint64_t tag) {
+    uint8_t *slot = acquire();
+    if(!slot) return false;
+
+    memcpy(slot, data, used);
+    commit(used, tag);
+    return true;
+}
+
+void StagingQueue::flush() {
+    while(handled.load(std::memory_order_acquire) < committed.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+    }
+}
+
+// Worker: slots come once a frame at most, so an idle worker sleeps rather
+// than spinning
+void StagingQueue::work() {
+    for(;;) {
+        // Read the flag first so slots committed before shutdown are never lost
+        bool stopping = !running.load(std::memory_order_acquire);
+
+        size_t slot;
+        bool drained = false;
+        while(filled.pop(slot)) {
+            handler(context, staging.get() + slot * size, sizes[slot], tags[slot]);
+
+            free.push(slot);
+            handled.fetch_add(1, std::memory_order_release);
+            drained = true;
+        }
+
+        if(stopping) break;
+        if(!drained) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "ring.h"
+
+// Called on the worker thread for each staged slot, with the size and tag
+// it was committed with
+typedef void (*staging_handler_t)(void *context, const uint8_t *data, size_t size, uint64_t tag);
+
+// Hands fixed-size buffers from the emulation thread to a worker thread.
+// The producer fills one of a few preallocated staging slots, so it never
+// waits on the work; slots travel to the worker through one ring and back
+// through another, and the worker passes each one to handler in order.
+//
+// Owners that give handler their own state should declare the queue last,
+// so the worker is joined before that state goes away.
+class StagingQueue {
+    public:
+        StagingQueue(size_t slots, size_t slotSize, staging_handler_t handler, void *context);
+        ~StagingQueue();
+
+        StagingQueue(const StagingQueue &) = delete;
+        StagingQueue &operator=(const StagingQueue &) = delete;
+
+        // Producer. acquire() returns a slot of slotSize bytes to fill, or
+        // null when the worker has fallen a whole ring behind; every slot it
+        // hands out must be committed before the next acquire.
+        uint8_t *acquire();
+        void commit(size_t size, uint64_t tag);
+
+        // acquire, copy size bytes of data in and commit. False, dropping
+        // the data, when no slot is free.
+        bool push(const uint8_t *data, size_t size, uint64_t tag);
+
+        // Wait until every committed slot has been handled
+        void flush();
+
+    private:
+        void work();
+
+        staging_handler_t handler;
+        void *context;
+
+        size_t size;
+        std::unique_ptr<uint8_t[]> staging;
+        std::unique_ptr<size_t[]> sizes;
+        std::unique_ptr<uint64_t[]> tags;
+        SpscRing<size_t> filled;
+        SpscRing<size_t> free;
+        size_t current; // Slot handed out by acquire
+        std::atomic<size_t> committed;
+        std::atomic<size_t> handled;
+
+        std::atomic<bool> running;
+        std::thread thread;
+};
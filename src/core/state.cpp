@@ -0,0 +1,187 @@
+#include "state.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "input.h"
+
+#include <string.h>
+
+StateWriter::StateWriter(uint8_t *buffer, size_t capacity) : buffer(buffer), capacity(capacity) {
+    size = 0;
+    overflow = false;
+    chunk = 0;
+}
+
+void StateWriter::begin(const char *tag) {
+    chunk = size;
+    bytes(tag, 4);
+    u32(0); // Patched by end
+}
+
+void StateWriter::end() {
+    if(overflow) return;
+
+    uint32_t length = size - chunk - STATE_CHUNK_HEADER_SIZE;
+    for(int i = 0; i < 4; i++) buffer[chunk + 4 + i] = length >> (i * 8);
+}
+
+void StateWriter::u8(uint8_t value) {
+    bytes(&value, 1);
+}
+
+void StateWriter::u16(uint16_t value) {
+    uint8_t data[2] = { (uint8_t) value, (uint8_t) (value >> 8) };
+    bytes(data, 2);
+}
+
+void StateWriter::u32(uint32_t value) {
+    u16(value);
+    u16(value >> 16);
+}
+
+void StateWriter::u64(uint64_t value) {
+    u32(value);
+    u32(value >> 32);
+}
+
+void StateWriter::bytes(const void *data, size_t length) {
+    if(overflow || capacity - size < length) {
+        overflow = true;
+        return;
+    }
+
+    memcpy(buffer + size, data, length);
+    size += length;
+}
+
+StateReader::StateReader(const uint8_t *buffer, size_t size) : buffer(buffer), size(size) {
+    error = false;
+    version = 0;
+
+    // Read the header as if it were a chunk
+    position = 0;
+    limit = size < STATE_HEADER_SIZE ? size : STATE_HEADER_SIZE;
+
+    uint32_t magic = u32();
+    version = u16();
+    if(magic != STATE_MAGIC) error = true;
+
+    position = limit = 0;
+}
+
+bool StateReader::valid() const {
+    return size >= STATE_HEADER_SIZE && !error && version >= 1 && version <= STATE_VERSION;
+}
+
+bool StateReader::chunk(const char *tag) {
+    size_t offset = STATE_HEADER_SIZE;
+
+    while(offset <= size && size - offset >= STATE_CHUNK_HEADER_SIZE) {
+        const uint8_t *header = buffer + offset;
+        uint32_t length = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t) header[7] << 24);
+
+        offset += STATE_CHUNK_HEADER_SIZE;
+        if(length > size - offset) return false; // Truncated
+
+        if(!memcmp(header, tag, 4)) {
+            position = offset;
+            limit = offset + length;
+            return true;
+        }
+
+        offset += length;
+    }
+
+    return false;
+}
+
+size_t StateReader::remaining() const {
+    return limit - position;
+}
+
+uint8_t StateReader::u8() {
+    uint8_t value = 0;
+    bytes(&value, 1);
+    return value;
+}
+
+uint16_t StateReader::u16() {
+    uint8_t data[2] = { 0, 0 };
+    bytes(data, 2);
+    return data[0] | (data[1] << 8);
+}
+
+uint32_t StateReader::u32() {
+    uint32_t low = u16();
+    return low | ((uint32_t) u16() << 16);
+}
+
+uint64_t StateReader::u64() {
+    uint64_t low = u32();
+    return low | ((uint64_t) u32() << 32);
+}
+
+void StateReader::bytes(void *data, size_t length) {
+    if(error || limit - position < length) {
+        error = true;
+        memset(data, 0, length);
+        return;
+    }
+
+    memcpy(data, buffer + position, length);
+    position += length;
+}
+
+size_t stateSize(const CPU &cpu) {
+    size_t size = STATE_HEADER_SIZE;
+
+    size += STATE_CHUNK_HEADER_SIZE + CPU_STATE_SIZE;
+    size += STATE_CHUNK_HEADER_SIZE + CPU_RAM_STATE_SIZE;
+    if(cpu.ppu) size += STATE_CHUNK_HEADER_SIZE + cpu.ppu->stateSize();
+    if(cpu.apu) size += STATE_CHUNK_HEADER_SIZE + cpu.apu->stateSize();
+    if(cpu.input) size += STATE_CHUNK_HEADER_SIZE + cpu.input->stateSize();
+
+    return size;
+}
+
+size_t saveState(const CPU &cpu, uint8_t *buffer, size_t capacity) {
+    StateWriter out(buffer, capacity);
+
+    out.u32(STATE_MAGIC);
+    out.u16(STATE_VERSION);
+    out.u16(0);
+
+    cpu.saveState(out);
+    if(cpu.ppu) cpu.ppu->saveState(out);
+    if(cpu.apu) cpu.apu->saveState(out);
+    if(cpu.input) cpu.input->saveState(out);
+
+    return out.overflow ? 0 : out.size;
+}
+
+bool loadState(CPU &cpu, const uint8_t *buffer, size_t size) {
+    StateReader in(buffer, size);
+    if(!in.valid()) return false;
+
+    // Check every chunk is there and the right size before changing anything
+    if(!in.chunk("CPU ") || in.remaining() != CPU_STATE_SIZE) return false;
+    if(!in.chunk("RAM ") || in.remaining() != CPU_RAM_STATE_SIZE) return false;
+    if(cpu.ppu && (!in.chunk("PPU ") || in.remaining() != cpu.ppu->stateSize())) return false;
+
+    // Version 1 states predate the APU chunk and reset the APU instead
+    bool apu = cpu.apu && in.chunk("APU ");
+    if(apu && in.remaining() != cpu.apu->stateSize()) return false;
+    if(cpu.apu && !apu && in.version >= 2) return false;
+
+    // Likewise the input chunk and version 3, but input is left as it is
+    bool input = cpu.input && in.chunk("INP ");
+    if(input && in.remaining() != cpu.input->stateSize()) return false;
+    if(cpu.input && !input && in.version >= 3) return false;
+
+    cpu.loadState(in);
+    if(cpu.ppu) cpu.ppu->loadState(in);
+    if(cpu.apu) cpu.apu->loadState(in);
+    if(cpu.input) cpu.input->loadState(in);
+
+    return !in.error;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+class CPU;
+
+// Save states are a header followed by chunks, all little endian:
+//
+//   "NESS" u16 version u16 reserved
+//   then per chunk: char tag[4] u32 size, size bytes of payload
+//
+// Each component writes its own chunk ("CPU ", "RAM ", "PPU ", ...). Loading
+// looks chunks up by tag and skips unknown ones, so new components can add
+// chunks without breaking older states. A change to an existing chunk's
+// layout, or a new chunk every state of a machine must have, bumps
+// STATE_VERSION. Version 2 added the APU chunk, version 3 the input chunk.
+const uint32_t STATE_MAGIC   = 0x5353454E; // "NESS"
+const uint16_t STATE_VERSION = 3;
+
+const size_t STATE_HEADER_SIZE = 8;
+const size_t STATE_CHUNK_HEADER_SIZE = 8;
+
+// Writes into a caller-supplied buffer and never allocates. Writing past the
+// end sets overflow and drops the data, so a whole state can be written and
+// checked once.
+class StateWriter {
+    public:
+        StateWriter(uint8_t *buffer, size_t capacity);
+
+        void begin(const char *tag);
+        void end();
+
+        void u8(uint8_t value);
+        void u16(uint16_t value);
+        void u32(uint32_t value);
+        void u64(uint64_t value);
+        void bytes(const void *data, size_t size);
+
+        size_t size;
+        bool overflow;
+
+    private:
+        uint8_t *buffer;
+        size_t capacity;
+        size_t chunk; // Start of the open chunk's header
+};
+
+// Reads one chunk at a time out of a state. Reading past the end of the
+// chunk sets error and returns zeros.
+class StateReader {
+    public:
+        StateReader(const uint8_t *buffer, size_t size);
+
+        // Whether the header is valid and of a version this build reads
+        bool valid() const;
+
+        // Position on the chunk with the given tag, false if there is none
+        bool chunk(const char *tag);
+        size_t remaining() const;
+
+        uint8_t u8();
+        uint16_t u16();
+        uint32_t u32();
+        uint64_t u64();
+        void bytes(void *data, size_t size);
+
+        uint16_t version;
+        bool error;
+
+    private:
+        const uint8_t *buffer;
+        size_t size;
+        size_t position;
+        size_t limit;
+};
+
+// Upper bound of the state size of cpu and the devices attached to it
+size_t stateSize(const CPU &cpu);
+
+// Write the CPU, its memory and attached devices into buffer. Returns the
+// number of bytes written, 0 if capacity was too small.
+size_t saveState(const CPU &cpu, uint8_t *buffer, size_t capacity);
+
+// Restore a state saved from a CPU with the same devices attached. Fails,
+// leaving cpu untouched, if the state is malformed or from a newer version.
+bool loadState(CPU &cpu, const uint8_t *buffer, size_t size);
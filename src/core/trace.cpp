@@ -0,0 +1,89 @@
+#include "trace.h"
+#include "cpu.h"
+
+static const char *MNEMONICS[] = {
+    "ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL",
+    "BRK", "BVC", "BVS", "CLC", "CLD", "CLI", "CLV", "CMP", "CPX", "CPY",
+    "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP", "JSR", "LDA",
+    "LDX", "LDY", "LSR", "NOP", "ORA", "PHA", "PHP", "PLA", "PLP", "ROL",
+    "ROR", "RTI", "RTS", "SBC", "SEC", "SED", "SEI", "STA", "STX", "STY",
+    "TAX", "TAY", "TSX", "TXA", "TXS", "TYA", "???",
+};
+
+TraceWriter::TraceWriter(TraceBuffer &buffer, FILE *out) : buffer(buffer), out(out), running(true) {
+    thread = std::thread(&TraceWriter::drain, this);
+}
+
+TraceWriter::~TraceWriter() {
+    stop();
+}
+
+void TraceWriter::stop() {
+    running.store(false, std::memory_order_release);
+    if(thread.joinable()) thread.join();
+    fflush(out);
+}
+
+void TraceWriter::drain() {
+    trace_record_t record;
+    char line[128];
+
+    for(;;) {
+        // Read the flag first so records pushed before stop() are never lost
+        bool stopping = !running.load(std::memory_order_acquire);
+
+        bool drained = false;
+        while(buffer.pop(record)) {
+            format(record, line, sizeof(line));
+            fputs(line, out);
+            drained = true;
+        }
+
+        if(stopping) break;
+        if(!drained) std::this_thread::yield();
+    }
+}
+
+// C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD CYC:7
+void TraceWriter::format(const trace_record_t &record, char *line, size_t size) {
+    const instruction_t &instr = instructionSet[record.opcode];
+    uint16_t absolute = (((uint16_t) record.arg1) << 8) | record.arg0;
+
+    char bytes[16];
+    switch(instr.bytes) {
+        case 1:  snprintf(bytes, sizeof(bytes), "%02X", record.opcode); break;
+        case 2:  snprintf(bytes, sizeof(bytes), "%02X %02X", record.opcode, record.arg0); break;
+        default: snprintf(bytes, sizeof(bytes), "%02X %02X %02X", record.opcode, record.arg0, record.arg1); break;
+    }
+
+    char operand[16] = "";
+    switch(instr.mode) {
+        case Immediate:  snprintf(operand, sizeof(operand), "#$%02X", record.arg0); break;
+        case ZeroPage:   snprintf(operand, sizeof(operand), "$%02X", record.arg0); break;
+        case ZeroPage_X: snprintf(operand, sizeof(operand), "$%02X,X", record.arg0); break;
+        case ZeroPage_Y: snprintf(operand, sizeof(operand), "$%02X,Y", record.arg0); break;
+        case Absolute:   snprintf(operand, sizeof(operand), "$%04X", absolute); break;
+        case Absolute_X: snprintf(operand, sizeof(operand), "$%04X,X", absolute); break;
+        case Absolute_Y: snprintf(operand, sizeof(operand), "$%04X,Y", absolute); break;
+        case Indirect:   snprintf(operand, sizeof(operand), "($%04X)", absolute); break;
+        case Indirect_X: snprintf(operand, sizeof(operand), "($%02X,X)", record.arg0); break;
+        case Indirect_Y: snprintf(operand, sizeof(operand), "($%02X),Y", record.arg0); break;
+        case Relative:
+            snprintf(operand, sizeof(operand), "$%04X", (uint16_t) (record.PC + 2 + (int8_t) record.arg0));
+            break;
+        default:
+            // Accumulator shifts and rotates
+            if(instr.name == INSTR_ASL || instr.name == INSTR_LSR || instr.name == INSTR_ROL || instr.name == INSTR_ROR) {
+                snprintf(operand, sizeof(operand), "A");
+            }
+            break;
+    }
+
+    char disassembly[32];
+    snprintf(disassembly, sizeof(disassembly), "%s %s", MNEMONICS[instr.name], operand);
+
+    snprintf(line, size, "%04X  %-8s  %-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu\n",
+        record.PC, bytes, disassembly,
+        record.A, record.X, record.Y, record.P, record.SP,
+        (unsigned long long) record.cycle);
+}
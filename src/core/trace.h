@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+
+#include "ring.h"
+
+// Per-instruction tracing is compiled in only when building with -DTRACE=1.
+// Otherwise every trace hook in the CPU is discarded at compile time.
+#ifndef TRACE
+#define TRACE 0
+#endif
+
+constexpr bool TRACE_ENABLED = TRACE;
+
+// CPU state before an instruction executes
+typedef struct trace_record {
+    uint64_t cycle;
+    uint16_t PC;
+    uint8_t  opcode;
+    uint8_t  arg0;
+    uint8_t  arg1;
+    uint8_t  A;
+    uint8_t  X;
+    uint8_t  Y;
+    uint8_t  P;
+    uint8_t  SP;
+} trace_record_t;
+
+typedef SpscRing<trace_record_t> TraceBuffer;
+
+// Drains a trace buffer to a file in nestest log format on its own thread
+class TraceWriter {
+    public:
+        TraceWriter(TraceBuffer &buffer, FILE *out);
+        ~TraceWriter();
+
+        // Write out whatever is left in the buffer and join the thread
+        void stop();
+
+        static void format(const trace_record_t &record, char *line, size_t size);
+
+    private:
+        void drain();
+
+        TraceBuffer &buffer;
+        FILE *out;
+        std::atomic<bool> running;
+        std::thread thread;
+};
@@ -0,0 +1,231 @@
+#include "video.h"
+#include "palette.h"
+#include "png.h"
+#include "platform.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// BT.601 limited range in 8.8 fixed point, as both paths compute it
+static inline uint8_t luma(int r, int g, int b) {
+    return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline uint8_t chromaU(int r, int g, int b) {
+    return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline uint8_t chromaV(int r, int g, int b) {
+    return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+// Columns [from, to) of a pair of rows
+static void convertPairScalar(const uint32_t *top, const uint32_t *bottom, int from, int to,
+                              uint8_t *yTop, uint8_t *yBottom, uint8_t *u, uint8_t *v) {
+    for(int x = from; x < to; x += 2) {
+        uint32_t block[4] = { top[x], top[x + 1], bottom[x], bottom[x + 1] };
+        int r = 2, g = 2, b = 2;
+
+        for(int i = 0; i < 4; i++) {
+            int pr = block[i] & 0xFF, pg = (block[i] >> 8) & 0xFF, pb = (block[i] >> 16) & 0xFF;
+            (i < 2 ? yTop : yBottom)[x + (i & 1)] = luma(pr, pg, pb);
+            r += pr;
+            g += pg;
+            b += pb;
+        }
+
+        u[x / 2] = chromaU(r >> 2, g >> 2, b >> 2);
+        v[x / 2] = chromaV(r >> 2, g >> 2, b >> 2);
+    }
+}
+
+void convertI420Scalar(const uint32_t *rgba, int width, int height, uint8_t *y, uint8_t *u, uint8_t *v) {
+    for(int row = 0; row < height; row += 2) {
+        const uint32_t *top = rgba + (size_t) row * width;
+        uint8_t *yTop = y + (size_t) row * width;
+        size_t chroma = (size_t) (row / 2) * (width / 2);
+
+        convertPairScalar(top, top + width, 0, width, yTop, yTop + width, u + chroma, v + chroma);
+    }
+}
+
+#if defined(__SSE2__)
+
+// Products stay in 16 bit lanes. Luma sums reach 56228, which wraps as
+// signed but is exact once shifted as unsigned; chroma sums fit either way.
+
+// R, G and B of eight pixels, one per 16 bit lane
+static inline void unpackRGB(const uint32_t *pixels, __m128i &r, __m128i &g, __m128i &b) {
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    __m128i lo = _mm_loadu_si128((const __m128i *) pixels);
+    __m128i hi = _mm_loadu_si128((const __m128i *) (pixels + 4));
+
+    r = _mm_packs_epi32(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask));
+    g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), mask), _mm_and_si128(_mm_srli_epi32(hi, 8), mask));
+    b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), mask), _mm_and_si128(_mm_srli_epi32(hi, 16), mask));
+}
+
+static inline __m128i weigh(__m128i r, __m128i g, __m128i b, short cr, short cg, short cb) {
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(cr)), _mm_mullo_epi16(g, _mm_set1_epi16(cg)));
+    return _mm_add_epi16(_mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(cb))), _mm_set1_epi16(128));
+}
+
+static inline __m128i lumaSSE2(__m128i r, __m128i g, __m128i b) {
+    return _mm_add_epi16(_mm_srli_epi16(weigh(r, g, b, 66, 129, 25), 8), _mm_set1_epi16(16));
+}
+
+static inline __m128i chromaSSE2(__m128i r, __m128i g, __m128i b, short cr, short cg, short cb) {
+    return _mm_add_epi16(_mm_srai_epi16(weigh(r, g, b, cr, cg, cb), 8), _mm_set1_epi16(128));
+}
+
+// Sums of both rows for 16 columns in, averages of each column pair out
+static inline __m128i average(__m128i left, __m128i right) {
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i sums = _mm_packs_epi32(_mm_madd_epi16(left, one), _mm_madd_epi16(right, one));
+    return _mm_srli_epi16(_mm_add_epi16(sums, _mm_set1_epi16(2)), 2);
+}
+
+void convertI420(const uint32_t *rgba, int width, int height, uint8_t *y, uint8_t *u, uint8_t *v) {
+    for(int row = 0; row < height; row += 2) {
+        const uint32_t *top = rgba + (size_t) row * width;
+        const uint32_t *bottom = top + width;
+        uint8_t *yTop = y + (size_t) row * width;
+        uint8_t *yBottom = yTop + width;
+        uint8_t *uRow = u + (size_t) (row / 2) * (width / 2);
+        uint8_t *vRow = v + (size_t) (row / 2) * (width / 2);
+
+        int x = 0;
+        for(; x + 16 <= width; x += 16) {
+            __m128i r0, g0, b0, r1, g1, b1, r2, g2, b2, r3, g3, b3;
+            unpackRGB(top + x, r0, g0, b0);
+            unpackRGB(top + x + 8, r1, g1, b1);
+            unpackRGB(bottom + x, r2, g2, b2);
+            unpackRGB(bottom + x + 8, r3, g3, b3);
+
+            _mm_storeu_si128((__m128i *) (yTop + x), _mm_packus_epi16(lumaSSE2(r0, g0, b0), lumaSSE2(r1, g1, b1)));
+            _mm_storeu_si128((__m128i *) (yBottom + x), _mm_packus_epi16(lumaSSE2(r2, g2, b2), lumaSSE2(r3, g3, b3)));
+
+            __m128i r = average(_mm_add_epi16(r0, r2), _mm_add_epi16(r1, r3));
+            __m128i g = average(_mm_add_epi16(g0, g2), _mm_add_epi16(g1, g3));
+            __m128i b = average(_mm_add_epi16(b0, b2), _mm_add_epi16(b1, b3));
+
+            _mm_storel_epi64((__m128i *) (uRow + x / 2), _mm_packus_epi16(chromaSSE2(r, g, b, -38, -74, 112), _mm_setzero_si128()));
+            _mm_storel_epi64((__m128i *) (vRow + x / 2), _mm_packus_epi16(chromaSSE2(r, g, b, 112, -94, -18), _mm_setzero_si128()));
+        }
+
+        convertPairScalar(top, bottom, x, width, yTop, yBottom, uRow, vRow);
+    }
+}
+
+#else
+
+void convertI420(const uint32_t *rgba, int width, int height, uint8_t *y, uint8_t *u, uint8_t *v) {
+    convertI420Scalar(rgba, width, height, y, u, v);
+}
+
+#endif
+
+VideoWriter::VideoWriter(FILE *out, VIDEO_FORMAT format) :
+    frames(0),
+    failed(false),
+    out(out),
+    format(format),
+    rgba(new uint32_t[VIDEO_FRAME_SIZE]),
+    planes(new uint8_t[VIDEO_FRAME_SIZE * 3]),
+    queue(VIDEO_STAGING_SLOTS, VIDEO_FRAME_SIZE, encode, this) {
+
+    buildPaletteLUT(NES_PALETTE, lut);
+
+    // Chroma is sited between the four pixels it was averaged from
+    if(format == VIDEO_Y4M && fprintf(out, "YUV4MPEG2 W%d H%d F%u:%u Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+                                      PPU_WIDTH, PPU_HEIGHT, VIDEO_RATE_NUMERATOR, VIDEO_RATE_DENOMINATOR) < 0) {
+        failed = true;
+    }
+}
+
+bool VideoWriter::write(const uint8_t *framebuffer, uint64_t frame) {
+    return queue.push(framebuffer, VIDEO_FRAME_SIZE, frame);
+}
+
+void VideoWriter::flush() {
+    queue.flush();
+    if(fflush(out)) failed = true;
+}
+
+std::string VideoWriter::describe() {
+    char text[256];
+    snprintf(text, sizeof(text),
+        "{ \"format\": \"rawvideo\", \"pixel_format\": \"rgb24\", \"width\": %d, \"height\": %d, \"framerate\": \"%u/%u\" }\n",
+        PPU_WIDTH, PPU_HEIGHT, VIDEO_RATE_NUMERATOR, VIDEO_RATE_DENOMINATOR);
+    return text;
+}
+
+void VideoWriter::encode(void *context, const uint8_t *pixels, size_t, uint64_t frame) {
+    VideoWriter *writer = (VideoWriter *) context;
+    if(writer->failed) return;
+
+    convertFrame(writer->lut, pixels, writer->rgba.get(), VIDEO_FRAME_SIZE);
+
+    uint8_t *planes = writer->planes.get();
+    size_t size;
+    if(writer->format == VIDEO_Y4M) {
+        uint8_t *u = planes + VIDEO_FRAME_SIZE;
+        uint8_t *v = u + VIDEO_FRAME_SIZE / 4;
+        convertI420(writer->rgba.get(), PPU_WIDTH, PPU_HEIGHT, planes, u, v);
+        size = VIDEO_FRAME_SIZE * 3 / 2;
+
+        if(fputs("FRAME\n", writer->out) < 0) writer->failed = true;
+    } else {
+        for(size_t i = 0; i < VIDEO_FRAME_SIZE; i++) {
+            uint32_t color = writer->rgba[i];
+            planes[i * 3 + 0] = color;
+            planes[i * 3 + 1] = color >> 8;
+            planes[i * 3 + 2] = color >> 16;
+        }
+        size = VIDEO_FRAME_SIZE * 3;
+    }
+
+    if(fwrite(planes, 1, size, writer->out) != size) writer->failed = true;
+    if(!writer->failed) writer->frames.fetch_add(1, std::memory_order_relaxed);
+}
+
+SnapshotWriter::SnapshotWriter(const char *directory) :
+    written(0),
+    failed(false),
+    directory(directory),
+    queue(VIDEO_STAGING_SLOTS, VIDEO_FRAME_SIZE, encode, this) {
+}
+
+bool SnapshotWriter::write(const uint8_t *framebuffer, uint64_t frame) {
+    return queue.push(framebuffer, VIDEO_FRAME_SIZE, frame);
+}
+
+void SnapshotWriter::flush() {
+    queue.flush();
+}
+
+void SnapshotWriter::encode(void *context, const uint8_t *pixels, size_t, uint64_t frame) {
+    SnapshotWriter *writer = (SnapshotWriter *) context;
+
+    char name[32];
+    snprintf(name, sizeof(name), "/frame-%06llu.png", (unsigned long long) frame);
+    std::string path = writer->directory + name;
+
+    writer->png.clear();
+    encodePNG(pixels, PPU_WIDTH, PPU_HEIGHT, NES_PALETTE, NES_PALETTE_SIZE, writer->png);
+
+    FILE *file = fopen(path.c_str(), "wb");
+    bool ok = file && fwrite(writer->png.data(), 1, writer->png.size(), file) == writer->png.size();
+    if(file && fclose(file)) ok = false;
+
+    if(!ok) {
+        platformLog("snapshot: cannot write %s", path.c_str());
+        writer->failed = true;
+        return;
+    }
+
+    writer->written.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "staging.h"
+#include "ppu.h"
+
+const size_t VIDEO_STAGING_SLOTS = 8;
+const size_t VIDEO_FRAME_SIZE    = PPU_WIDTH * PPU_HEIGHT;
+
+// NES frame rate as the ratio Y4M and ffmpeg take
+const uint32_t VIDEO_RATE_NUMERATOR   = (uint32_t) (CPU_CLOCK_HZ * 3);
+const uint32_t VIDEO_RATE_DENOMINATOR = PPU_DOTS_PER_FRAME;
+
+// Convert a frame of packed 0xAABBGGRR colours, as convertFrame makes, to
+// planar YUV 4:2:0: BT.601 limited range, with each chroma sample taken from
+// the average of a 2x2 block. width and height must be even. The SSE2 path
+// works on 16 pixels at a time and gives the same bytes as the scalar one.
+void convertI420(const uint32_t *rgba, int width, int height, uint8_t *y, uint8_t *u, uint8_t *v);
+void convertI420Scalar(const uint32_t *rgba, int width, int height, uint8_t *y, uint8_t *u, uint8_t *v);
+
+enum VIDEO_FORMAT {
+    VIDEO_Y4M,   // YUV4MPEG2, 4:2:0
+    VIDEO_RGB24  // Bare frames of packed RGB, described by describe()
+};
+
+// Streams every frame to a file or pipe for ffmpeg and the like to consume.
+// write() only stages a copy of the frame, tagged with its number; colour
+// conversion and writing happen on the queue's worker.
+class VideoWriter {
+    public:
+        // out stays open and owned by the caller. The Y4M stream header is
+        // written straight away.
+        VideoWriter(FILE *out, VIDEO_FORMAT format);
+
+        // Emulation thread, once per frame. Returns false, dropping the
+        // frame, when the worker has fallen a whole staging ring behind.
+        bool write(const uint8_t *framebuffer, uint64_t frame);
+
+        // Wait for the worker and flush out
+        void flush();
+
+        // Sidecar for an RGB24 stream: the format as JSON, for ffmpeg's
+        // -f rawvideo -pixel_format -video_size and -framerate options
+        static std::string describe();
+
+        // Frames written so far, and whether a write to out failed
+        std::atomic<uint64_t> frames;
+        std::atomic<bool> failed;
+
+    private:
+        static void encode(void *context, const uint8_t *pixels, size_t size, uint64_t frame);
+
+        FILE *out;
+        VIDEO_FORMAT format;
+
+        // Worker side
+        uint32_t lut[64];
+        std::unique_ptr<uint32_t[]> rgba;
+        std::unique_ptr<uint8_t[]> planes;
+
+        // Last, so the worker is joined before the buffers it uses go away
+        StagingQueue queue;
+};
+
+// Saves selected frames as PNG files named frame-NNNNNN.png in a directory,
+// encoding them on the queue's worker.
+class SnapshotWriter {
+    public:
+        SnapshotWriter(const char *directory);
+
+        bool write(const uint8_t *framebuffer, uint64_t frame);
+        void flush();
+
+        std::atomic<uint64_t> written;
+        std::atomic<bool> failed;
+
+    private:
+        static void encode(void *context, const uint8_t *pixels, size_t size, uint64_t frame);
+
+        std::string directory;
+        std::vector<uint8_t> png;
+
+        StagingQueue queue;
+};
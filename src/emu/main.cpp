@@ -1,10 +1,13 @@
 // Dependencies
-#include <emscripten.h>
+#include <time.h>
 
 // Modules
+#include "../core/platform.h"
 #include "../core/memory.h"
-#include "../core/cpu.h"
+#include "../core/machine.h"
 #include "../core/graphics.h"
+#include "../core/audio.h"
+#include "../core/pacer.h"
 
 uint8_t program[] = {
     0x20, 0x06, 0x06, 0x20, 0x38, 0x06, 0x20, 0x0d, 0x06, 0x20, 0x2a, 0x06, 0x60, 0xa9, 0x02, 0x85,
@@ -29,21 +32,70 @@ uint8_t program[] = {
     0xea, 0xca, 0xd0, 0xfb, 0x60
 };
 
-void callback() {
-    render(&(memory[0x0200]), 32, 32);
+// Every session is recorded from power on; F2 saves it for nes-run --play.
+// F3 logs and resets the pacing statistics.
+const char *MOVIE_PATH = "snake.nesm";
+
+Machine machine;
+Movie movie;
+Renderer renderer;
+AudioOutput audio;
+Pacer pacer;
+uint8_t key = 0;
+
+void pollInput() {
+    SDL_Event event;
+    while(SDL_PollEvent(&event)) {
+        if(event.type != SDL_KEYDOWN) continue;
+
+        SDLKey sym = event.key.keysym.sym;
+        if(sym == SDLK_F2) {
+            if(movie.save(MOVIE_PATH)) platformLog("saved %zu frames to %s", movie.inputs.size(), MOVIE_PATH);
+            else platformLog("%s: %s", MOVIE_PATH, movie.error);
+        } else if(sym == SDLK_F3) {
+            const pacer_stats_t &stats = pacer.stats;
+            platformLog("host %.2f Hz, interval %.2f ms, jitter %.2f ms, max %.2f ms, %llu idle, %llu doubled, %llu dropped, ratio %.4f",
+                pacer.hostRate, stats.meanInterval * 1e3, stats.jitter * 1e3, stats.maxInterval * 1e3,
+                (unsigned long long) stats.idle, (unsigned long long) stats.doubled,
+                (unsigned long long) stats.dropped, stats.ratio);
+            pacer.resetStats();
+        } else if(sym < 0x80) {
+            key = sym;
+        }
+    }
 }
 
-void loop(void* cpu) {
-    ((CPU*)cpu)->run(callback);
+void loop(void* arg) {
+    pollInput();
+
+    int frames = pacer.tick(platformTime());
+    for(int i = 0; i < frames; i++) machine.runFrame(key);
+
+    if(frames) renderer.draw(machine.cpu.bus.pointer(0x0200));
 }
 
 int main(int argc, char** argv) {
-    // Initialize CPU
-    CPU cpu;
-    
+    // The demo draws with the easy6502 colours of getColor, where 15 and up
+    // are cyan. The renderer only looks at the low 6 bits of each pixel.
+    NES_COLOR_RGB palette[NES_PALETTE_SIZE];
+    for(int i = 0; i < NES_PALETTE_SIZE; i++) {
+        palette[i] = *getColor(i);
+    }
+
+    if(!renderer.init(32, 32)) return 1;
+    renderer.setPalette(palette);
+
     // Load program into memory
-    cpu.load(program, sizeof(program));
-    emscripten_set_main_loop_arg(loop, (void*) &cpu, 30, 1);
+    machine.load(program, sizeof(program));
+
+    // Raw programs have no APU attached and play silence; cartridges are heard,
+    // and then the audio device's clock steers the pacing
+    if(audio.init(machine.apu.samples) && machine.cpu.apu) pacer.syncAudio(&machine.apu);
+
+    machine.record(&movie, time(nullptr));
+
+    // Driven at the display's refresh rate, so frames are never torn
+    platformMainLoop(loop, nullptr, 0);
     
 
     // Execute program
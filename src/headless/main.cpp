@@ -0,0 +1,393 @@
+// Dependencies
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Modules
+#include "../core/platform.h"
+#include "../core/memory.h"
+#include "../core/machine.h"
+#include "../core/batch.h"
+#include "../core/state.h"
+#include "../core/rewind.h"
+#include "../core/pacer.h"
+#include "../core/video.h"
+
+// Headless runner: executes a ROM and reports throughput. iNES images start
+// from their reset vector with the PPU rendering offscreen, anything else is
+// treated as a raw program and loaded at MEM_PROGRAM_START. --rewind records
+// every frame into the rewind history and reports how much it takes.
+// --realtime paces frames to NES speed from a 60 Hz host loop and reports
+// the loop's jitter, as a front end would see it.
+//
+// Runs take no input but a seed for the random byte raw programs read.
+// --record saves them as a movie; --play replays a movie as fast as
+// possible with rendering off, and ignores --frames.
+//
+// --video streams every frame as Y4M to a file, or to stdout with -, for
+// ffmpeg to consume; the report then goes to stderr. With --raw the stream is
+// bare RGB24 frames instead, described in FILE.json (logged for stdout).
+// --png saves PNG snapshots into a directory: of the frames listed in
+// --png-frames, every Nth frame with --png-every, or else the last one.
+// Conversion and encoding run on their own threads.
+//
+// --batch runs every ROM listed in a file for --frames frames each on a
+// fresh machine, spread over --threads threads (all of them by default), and
+// reports aggregate frames per second. Lines are a ROM path, optionally
+// followed by a movie to play on it instead; # starts a comment.
+//
+//   nes-run <rom.nes | program.bin> [--frames N | --cycles N] [--trace FILE] [--rewind]
+//           [--seed N] [--record FILE | --play FILE] [--realtime]
+//           [--video FILE [--raw]] [--png DIR [--png-frames N,N... | --png-every N]]
+//   nes-run --batch LIST [--frames N] [--threads N]
+
+void usage() {
+    fprintf(stderr, "usage: nes-run <rom.nes | program.bin> [--frames N | --cycles N] [--trace FILE] [--rewind]\n");
+    fprintf(stderr, "               [--seed N] [--record FILE | --play FILE] [--realtime]\n");
+    fprintf(stderr, "               [--video FILE [--raw]] [--png DIR [--png-frames N,N... | --png-every N]]\n");
+    fprintf(stderr, "       nes-run --batch LIST [--frames N] [--threads N]\n");
+}
+
+// Lines of "ROM [MOVIE]", paths without spaces
+bool readList(const char *path, std::vector<std::string> &roms, std::vector<std::string> &movies) {
+    FILE *file = fopen(path, "r");
+    if(!file) return false;
+
+    char line[4096];
+    while(fgets(line, sizeof(line), file)) {
+        char rom[4096];
+        char movie[4096] = "";
+        if(line[0] == '#' || sscanf(line, "%4095s %4095s", rom, movie) < 1) continue;
+
+        roms.push_back(rom);
+        movies.push_back(movie);
+    }
+
+    fclose(file);
+    return true;
+}
+
+int runBatch(const char *listPath, uint64_t frames, size_t threads) {
+    std::vector<std::string> paths;
+    std::vector<std::string> moviePaths;
+    if(!readList(listPath, paths, moviePaths)) {
+        platformLog("nes-run: cannot read %s", listPath);
+        return 1;
+    }
+
+    std::vector<batch_job_t> jobs(paths.size());
+    std::vector<Movie> movies(paths.size());
+    for(size_t i = 0; i < paths.size(); i++) {
+        const Movie *movie = nullptr;
+        if(!moviePaths[i].empty()) {
+            if(!movies[i].open(moviePaths[i].c_str())) {
+                platformLog("nes-run: %s: %s", moviePaths[i].c_str(), movies[i].error);
+                return 1;
+            }
+            movie = &movies[i];
+        }
+
+        jobs[i] = { paths[i].c_str(), nullptr, 0, frames, movie };
+    }
+
+    std::vector<batch_result_t> results(jobs.size());
+    BatchRunner runner(threads);
+    runner.run(jobs.data(), results.data(), jobs.size());
+
+    size_t failed = 0;
+    for(size_t i = 0; i < results.size(); i++) {
+        if(results[i].ok) continue;
+
+        platformLog("nes-run: %s: %s", paths[i].c_str(), results[i].error);
+        failed++;
+    }
+
+    printf("jobs          %zu (%zu failed)\n", jobs.size(), failed);
+    printf("threads       %zu\n", runner.threads);
+    printf("frames        %llu\n", (unsigned long long) runner.frames);
+    printf("seconds       %.6f\n", runner.seconds);
+    printf("frames/sec    %.0f\n", runner.framesPerSecond());
+    printf("steals        %llu\n", (unsigned long long) runner.steals);
+
+    return failed ? 1 : 0;
+}
+
+// Where each frame goes once it has run
+typedef struct frame_sinks {
+    Rewind *rewind;
+    VideoWriter *video;
+    SnapshotWriter *snapshots;
+    std::vector<uint64_t> shots; // Frames to snapshot
+    uint64_t every;
+} frame_sinks_t;
+
+typedef struct paced_run {
+    Machine *machine;
+    frame_sinks_t *sinks;
+    Pacer pacer;
+    uint64_t frames;
+} paced_run_t;
+
+void runFrame(Machine &machine, frame_sinks_t &sinks) {
+    machine.runFrame(0);
+
+    uint64_t frame = machine.cpu.frames;
+    const uint8_t *framebuffer = machine.ppu.framebuffer;
+    bool shot = sinks.every ? frame % sinks.every == 0 : std::count(sinks.shots.begin(), sinks.shots.end(), frame);
+
+    // Unpaced runs outrun the workers, wait for them rather than drop frames
+    while(sinks.rewind && !sinks.rewind->record(machine.cpu)) sinks.rewind->flush();
+    while(sinks.video && !sinks.video->write(framebuffer, frame)) sinks.video->flush();
+    while(sinks.snapshots && shot && !sinks.snapshots->write(framebuffer, frame)) sinks.snapshots->flush();
+}
+
+// Comma separated frame numbers
+bool parseFrames(const char *list, std::vector<uint64_t> &frames) {
+    while(*list) {
+        char *end;
+        frames.push_back(strtoull(list, &end, 0));
+        if(end == list || (*end && *end != ',')) return false;
+        list = *end ? end + 1 : end;
+    }
+
+    return !frames.empty();
+}
+
+void runPaced(void *arg) {
+    paced_run_t *run = (paced_run_t *) arg;
+    CPU &cpu = run->machine->cpu;
+
+    int frames = run->pacer.tick(platformTime());
+    for(int i = 0; i < frames && cpu.frames < run->frames; i++) runFrame(*run->machine, *run->sinks);
+
+    if(cpu.frames >= run->frames) platformStopMainLoop();
+}
+
+int main(int argc, char** argv) {
+    const char *path = nullptr;
+    const char *tracePath = nullptr;
+    const char *batchPath = nullptr;
+    size_t threads = 0;
+    uint64_t frames = 600;
+    uint64_t budget = 0;
+    bool rewinding = false;
+    bool realtime = false;
+    const char *recordPath = nullptr;
+    const char *playPath = nullptr;
+    uint32_t seed = 0;
+    const char *videoPath = nullptr;
+    bool raw = false;
+    const char *pngPath = nullptr;
+    frame_sinks_t sinks = {};
+    bool frameList = true;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            frames = strtoull(argv[++i], nullptr, 0);
+            budget = 0;
+        } else if(!strcmp(argv[i], "--cycles") && i + 1 < argc) {
+            budget = strtoull(argv[++i], nullptr, 0);
+            frames = 0;
+        } else if(!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if(!strcmp(argv[i], "--batch") && i + 1 < argc) {
+            batchPath = argv[++i];
+        } else if(!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threads = strtoull(argv[++i], nullptr, 0);
+        } else if(!strcmp(argv[i], "--realtime")) {
+            realtime = true;
+        } else if(!strcmp(argv[i], "--rewind")) {
+            rewinding = true;
+        } else if(!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            seed = strtoul(argv[++i], nullptr, 0);
+        } else if(!strcmp(argv[i], "--record") && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if(!strcmp(argv[i], "--play") && i + 1 < argc) {
+            playPath = argv[++i];
+        } else if(!strcmp(argv[i], "--video") && i + 1 < argc) {
+            videoPath = argv[++i];
+        } else if(!strcmp(argv[i], "--raw")) {
+            raw = true;
+        } else if(!strcmp(argv[i], "--png") && i + 1 < argc) {
+            pngPath = argv[++i];
+        } else if(!strcmp(argv[i], "--png-frames") && i + 1 < argc) {
+            frameList = parseFrames(argv[++i], sinks.shots);
+        } else if(!strcmp(argv[i], "--png-every") && i + 1 < argc) {
+            sinks.every = strtoull(argv[++i], nullptr, 0);
+        } else if(argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    if(batchPath && !path && frames) return runBatch(batchPath, frames, threads);
+
+    // Video and snapshots come from the frame loop
+    bool frameSinks = videoPath || pngPath;
+    if(!path || batchPath || (recordPath && playPath) || !frameList || (frameSinks && (playPath || budget))) {
+        usage();
+        return 2;
+    }
+
+    Machine machine;
+    if(!machine.open(path)) {
+        platformLog("nes-run: %s: %s", path, machine.error);
+        return 1;
+    }
+
+    CPU &cpu = machine.cpu;
+
+    if(frameSinks && !cpu.ppu) {
+        platformLog("nes-run: %s: --video and --png need an iNES image", path);
+        return 1;
+    }
+
+    Movie movie;
+    if(playPath && !movie.open(playPath)) {
+        platformLog("nes-run: %s: %s", playPath, movie.error);
+        return 1;
+    }
+
+    machine.record(recordPath ? &movie : nullptr, seed);
+
+    FILE *traceFile = nullptr;
+    std::unique_ptr<TraceBuffer> traceBuffer;
+    std::unique_ptr<TraceWriter> traceWriter;
+
+    if(tracePath) {
+        if(!TRACE_ENABLED) {
+            platformLog("nes-run: built without TRACE=1, --trace ignored");
+        } else if(!(traceFile = fopen(tracePath, "w"))) {
+            platformLog("nes-run: cannot write %s", tracePath);
+            return 1;
+        } else {
+            traceBuffer.reset(new TraceBuffer(1 << 16));
+            traceWriter.reset(new TraceWriter(*traceBuffer, traceFile));
+            cpu.trace = traceBuffer.get();
+        }
+    }
+
+    std::unique_ptr<Rewind> rewind;
+    if(rewinding) rewind.reset(new Rewind(stateSize(cpu)));
+    sinks.rewind = rewind.get();
+
+    // The report moves to stderr when the video takes stdout
+    bool videoStdout = videoPath && !strcmp(videoPath, "-");
+    FILE *report = videoStdout ? stderr : stdout;
+
+    FILE *videoFile = nullptr;
+    std::unique_ptr<VideoWriter> video;
+    if(videoPath) {
+        if(!(videoFile = videoStdout ? stdout : fopen(videoPath, "wb"))) {
+            platformLog("nes-run: cannot write %s", videoPath);
+            return 1;
+        }
+
+        if(raw) {
+            std::string description = VideoWriter::describe();
+            std::string sidecarPath = std::string(videoPath) + ".json";
+            FILE *sidecar = videoStdout ? nullptr : fopen(sidecarPath.c_str(), "w");
+
+            if(sidecar) {
+                fputs(description.c_str(), sidecar);
+                fclose(sidecar);
+            } else if(videoStdout) {
+                platformLog("nes-run: %s", description.c_str());
+            } else {
+                platformLog("nes-run: cannot write %s", sidecarPath.c_str());
+                return 1;
+            }
+        }
+
+        video.reset(new VideoWriter(videoFile, raw ? VIDEO_RGB24 : VIDEO_Y4M));
+        sinks.video = video.get();
+    }
+
+    std::unique_ptr<SnapshotWriter> snapshots;
+    if(pngPath) {
+        if(sinks.shots.empty() && !sinks.every) sinks.shots.push_back(frames);
+        snapshots.reset(new SnapshotWriter(pngPath));
+        sinks.snapshots = snapshots.get();
+    }
+
+    paced_run_t paced;
+
+    auto start = std::chrono::steady_clock::now();
+    if(playPath) {
+        if(!machine.play(movie)) {
+            platformLog("nes-run: %s: %s", playPath, machine.error);
+            return 1;
+        }
+    } else if(budget) {
+        cpu.runCycles(budget);
+    } else if(realtime) {
+        paced.machine = &machine;
+        paced.sinks = &sinks;
+        paced.frames = frames;
+        platformMainLoop(runPaced, &paced, 60);
+    } else {
+        while(cpu.frames < frames) runFrame(machine, sinks);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    if(traceWriter) {
+        traceWriter->stop();
+        fclose(traceFile);
+    }
+
+    if(video) {
+        video->flush();
+        if(!videoStdout) fclose(videoFile);
+        if(video->failed) {
+            platformLog("nes-run: cannot write %s", videoPath);
+            return 1;
+        }
+    }
+
+    if(snapshots) {
+        snapshots->flush();
+        if(snapshots->failed) return 1;
+    }
+
+    if(recordPath && !movie.save(recordPath)) {
+        platformLog("nes-run: %s: %s", recordPath, movie.error);
+        return 1;
+    }
+
+    uint64_t cycles = cpu.cycles;
+    uint64_t instructions = cpu.instructions;
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    fprintf(report, "instructions  %llu\n", (unsigned long long) instructions);
+    fprintf(report, "cycles        %llu\n", (unsigned long long) cycles);
+    fprintf(report, "frames        %llu\n", (unsigned long long) (cycles / CPU_CYCLES_PER_FRAME));
+    fprintf(report, "seconds       %.6f\n", seconds);
+    fprintf(report, "MIPS          %.2f\n", instructions / seconds / 1e6);
+    fprintf(report, "emulated MHz  %.2f (%.1fx realtime)\n", cycles / seconds / 1e6, cycles / seconds / CPU_CLOCK_HZ);
+    fprintf(report, "checksum      %016llx\n", (unsigned long long) machine.checksum());
+
+    if(realtime) {
+        const pacer_stats_t &stats = paced.pacer.stats;
+        fprintf(report, "pacing        %.2f Hz host, jitter %.3f ms, max %.3f ms, %llu idle, %llu doubled, %llu dropped\n",
+            paced.pacer.hostRate, stats.jitter * 1e3, stats.maxInterval * 1e3,
+            (unsigned long long) stats.idle, (unsigned long long) stats.doubled, (unsigned long long) stats.dropped);
+    }
+
+    if(video) fprintf(report, "video         %llu frames\n", (unsigned long long) video->frames);
+    if(snapshots) fprintf(report, "snapshots     %llu PNG\n", (unsigned long long) snapshots->written);
+
+    if(rewind) {
+        rewind->flush();
+        fprintf(report, "rewind        %zu frames in %zu KB\n", rewind->frames(), rewind->used() >> 10);
+    }
+
+    return 0;
+}
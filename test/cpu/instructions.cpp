@@ -1,15 +1,37 @@
 // Dependencies
-#include <emscripten.h>
 #include <assert.h>
 
+#include "../../src/core/platform.h"
 #include "../../src/core/instructions.h"
 #include "../../src/core/cpu.h"
+#include "../../src/core/cartridge.h"
+#include "../../src/core/pattern.h"
+#include "../../src/core/palette.h"
+#include "../../src/core/ppu.h"
+#include "../../src/core/apu.h"
+#include "../../src/core/pacer.h"
+#include "../../src/core/state.h"
+#include "../../src/core/rewind.h"
+#include "../../src/core/machine.h"
+#include "../../src/core/batch.h"
+#include "../../src/core/env.h"
+#include "../../src/core/video.h"
+#include "../../src/core/png.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+int failures = 0;
 
 void validate(bool condition, const char *func) {
     if(condition) {
-        emscripten_log(EM_LOG_CONSOLE, "    %s passed", func);
+        platformLog("    %s passed", func);
     } else {
-        emscripten_log(EM_LOG_CONSOLE, "!!! %s failed", func);
+        platformLog("!!! %s failed", func);
+        failures++;
     }
 }
 
@@ -65,6 +87,42 @@ void test_adc_add_with_overflow() {
     validate(cpu.registers.P & FLAG_OVERFLOW, __func__);
 }
 
+void test_sbc_borrow() {
+    CPU cpu;
+
+    uint8_t program[] = {
+        0x38,       // SEC
+        0xA9, 0x10, // LDA Imm
+        0xE9, 0x20, // SBC Imm
+        0x00,       // BRK
+    };
+
+    cpu.load_and_run(program, sizeof(program));
+
+    validate(cpu.registers.A == 0xF0
+             && !(cpu.registers.P & FLAG_CARRY)
+             && cpu.registers.P & FLAG_NEGATIVE
+             && !(cpu.registers.P & FLAG_OVERFLOW), __func__);
+}
+
+void test_cmp_clears_carry_and_zero() {
+    CPU cpu;
+
+    cpu.registers.P |= FLAG_CARRY | FLAG_ZERO;
+
+    uint8_t program[] = {
+        0xA9, 0x10, // LDA Imm
+        0xC9, 0x20, // CMP Imm
+        0x00,       // BRK
+    };
+
+    cpu.load_and_run(program, sizeof(program));
+
+    validate(!(cpu.registers.P & FLAG_CARRY)
+             && !(cpu.registers.P & FLAG_ZERO)
+             && cpu.registers.P & FLAG_NEGATIVE, __func__);
+}
+
 void test_and_with_immediate() {
     CPU cpu;
 
@@ -468,7 +526,44 @@ void test_brk() {
 
     cpu.load_and_run(program, sizeof(program));
 
-    validate(cpu.registers.P & FLAG_BREAK, __func__);
+    // B only exists in the copy of P that BRK pushes
+    uint8_t pushed = cpu.memoryRead(MEM_SYSTEM_STACK_START + cpu.registers.SP);
+
+    validate((pushed & FLAG_BREAK) && !(cpu.status() & FLAG_BREAK), __func__);
+}
+
+void test_brk_handler_sees_no_b_flag() {
+    CPU cpu;
+
+    uint8_t program[] = {
+        0x00, // BRK
+    };
+
+    cpu.load(program, sizeof(program));
+    cpu.memoryWrite(MEM_BRK_HANDLER, 0x00);
+    cpu.memoryWrite(MEM_BRK_HANDLER + 1, 0x07);
+    cpu.run();
+
+    // Inside the handler P has I set and no B bit
+    validate(cpu.registers.PC == 0x0700 && (cpu.status() & FLAG_INTERRUPT) && !(cpu.status() & FLAG_BREAK), __func__);
+}
+
+void test_php_leaves_b_out_of_p() {
+    CPU cpu;
+
+    uint8_t program[] = {
+        0x08, // PHP
+        0x28, // PLP
+        0x00, // BRK
+    };
+
+    cpu.load(program, sizeof(program));
+    cpu.step();
+    uint8_t pushed = cpu.memoryRead(MEM_SYSTEM_STACK_START + cpu.registers.SP);
+    bool live = cpu.status() & FLAG_BREAK;
+    cpu.step();
+
+    validate((pushed & FLAG_BREAK) && (pushed & FLAG_UNUSED) && !live && !(cpu.status() & FLAG_BREAK), __func__);
 }
 
 void test_bvc_branch_with_overflow_clear() {
@@ -585,7 +680,8 @@ void test_cli() {
 
     cpu.load_and_run(program, sizeof(program));
 
-    validate(!(cpu.registers.P & FLAG_INTERRUPT), __func__);
+    // BRK sets I again, after pushing P as CLI left it
+    validate(!(cpu.popStack() & FLAG_INTERRUPT), __func__);
 }
 
 void test_clv() {
@@ -918,11 +1014,1371 @@ void test_inx_overflow() {
     validate(cpu.registers.X == 0x01, __func__);
 }
 
-int main() {
+void test_cycles_absolute_x_same_page() {
+    CPU cpu;
+
+    uint8_t program[] = {
+        0xA2, // LDX Imm
+        0x10,
+        0xBD, // LDA Absolute_X
+        0x00,
+        0x12,
+        0x00, // BRK
+    };
+
+    cpu.load_and_run(program, sizeof(program));
+
+    validate(cpu.cycles == 2 + 4 + 7, __func__);
+}
+
+void test_cycles_absolute_x_page_crossed() {
+    CPU cpu;
+
+    uint8_t program[] = {
+        0xA2, // LDX Imm
+        0x10,
+        0xBD, // LDA Absolute_X
+        0xF8,
+        0x12,
+        0x00, // BRK
+    };
+
+    cpu.load_and_run(program, sizeof(program));
+
+    validate(cpu.cycles == 2 + 5 + 7, __func__);
+}
+
+void test_cycles_store_absolute_x_page_crossed() {
+    CPU cpu;
+
+    uint8_t program[] = {
+        0xA2, // LDX Imm
+        0x10,
+        0x9D, // STA Absolute_X
+        0xF8,
+        0x12,
+        0x00, // BRK
+    };
+
+    cpu.load_and_run(program, sizeof(program));
+
+    validate(cpu.cycles == 2 + 5 + 7, __func__);
+}
+
+void test_cycles_branch_not_taken() {
+    CPU cpu;
+
+    cpu.registers.P |= FLAG_CARRY;
+
+    uint8_t program[] = {
+        0x90, // BCC
+        0x02, // +2
+        0x00, // BRK
+    };
+
+    cpu.load_and_run(program, sizeof(program));
+
+    validate(cpu.cycles == 2 + 7, __func__);
+}
+
+void test_cycles_branch_taken() {
+    CPU cpu;
+
+    uint8_t program[] = {
+        0x90, // BCC
+        0x01, // +1
+        0xE8, // INX
+        0x00, // BRK
+    };
+
+    cpu.load_and_run(program, sizeof(program));
+
+    validate(cpu.cycles == 3 + 7, __func__);
+}
+
+void test_cycles_branch_taken_new_page() {
+    CPU cpu;
+
+    uint8_t oldValue0 = cpu.memoryRead(0x05F2);
+    cpu.memoryWrite(0x05F2, 0x00); // BRK
+
+    uint8_t program[] = {
+        0x90, // BCC
+        0xF0, // -16
+    };
+
+    cpu.load_and_run(program, sizeof(program));
+
+    // BRK at $05F2 returns past its padding byte
+    cpu.popStack();
+    validate(cpu.cycles == 4 + 7 && cpu.popStacku16() == 0x05F4, __func__);
+
+    cpu.memoryWrite(0x05F2, oldValue0);
+}
+
+void test_reset_from_cartridge() {
+    CPU cpu;
+    Cartridge cartridge;
+
+    // NROM-128: header, one 16 KB PRG bank, one 8 KB CHR bank
+    std::vector<uint8_t> image(INES_HEADER_SIZE + PRG_BANK_SIZE + CHR_BANK_SIZE, 0x00);
+    uint8_t header[] = { 'N', 'E', 'S', 0x1A, 0x01, 0x01 };
+    std::copy(header, header + sizeof(header), image.begin());
+
+    uint8_t *prg = &image[INES_HEADER_SIZE];
+    prg[0x0000] = 0xA9; // LDA Imm
+    prg[0x0001] = 0x42;
+    prg[0x0002] = 0x00; // BRK
+    prg[0x3FFC] = 0x00; // Reset vector, $8000
+    prg[0x3FFD] = 0x80;
+
+    bool loaded = cartridge.load(image.data(), image.size()) && cartridge.attach(cpu.bus);
+    cpu.reset();
+
+    uint16_t start = cpu.registers.PC;
+    uint8_t opcode;
+    do {
+        opcode = cpu.memoryRead(cpu.registers.PC);
+        cpu.run();
+    } while(opcode != 0x00);
+
+    cpu.memoryWrite(0x8000, 0xFF);
+
+    validate(loaded
+             && start == 0x8000
+             && cpu.registers.A == 0x42
+             && cpu.memoryRead(0xC000) == 0xA9
+             && cpu.memoryRead(0x8000) == 0xA9, __func__);
+}
+
+void test_cartridge_rejects_unsupported_mapper() {
+    Cartridge cartridge;
+
+    std::vector<uint8_t> image(INES_HEADER_SIZE + PRG_BANK_SIZE, 0x00);
+    uint8_t header[] = { 'N', 'E', 'S', 0x1A, 0x01, 0x00, 0x00 };
+    std::copy(header, header + sizeof(header), image.begin());
+    bool accepted = cartridge.load(image.data(), image.size());
+
+    // Mapper 1, rejected after a good image: nothing is left to attach
+    image[6] = 0x10;
+    CPU cpu;
+    bool rejected = !cartridge.load(image.data(), image.size()) && cartridge.error;
+
+    validate(accepted && rejected && !cartridge.attach(cpu.bus), __func__);
+}
+
+void test_pattern_decode_matches_scalar() {
+    uint8_t low[33], high[33];
+    uint8_t pixels[33 * 8], expected[33 * 8];
+
+    srand(1);
+    for(int i = 0; i < 33; i++) {
+        low[i] = rand();
+        high[i] = rand();
+    }
+
+    decodePatternRows(low, high, pixels, 33);
+    decodePatternRowsScalar(low, high, expected, 33);
+
+    validate(!memcmp(pixels, expected, sizeof(pixels))
+             && expected[0] == ((low[0] >> 7) | ((high[0] >> 7) << 1)), __func__);
+}
+
+void test_ppu_buffered_read_and_vblank() {
+    CPU cpu;
+    Cartridge cartridge;
+    PPU ppu;
+
+    std::vector<uint8_t> image(INES_HEADER_SIZE + PRG_BANK_SIZE + CHR_BANK_SIZE, 0x00);
+    uint8_t header[] = { 'N', 'E', 'S', 0x1A, 0x01, 0x01 };
+    std::copy(header, header + sizeof(header), image.begin());
+
+    // Write $55 to $2000 in VRAM through PPUADDR and PPUDATA, then spin
+    uint8_t program[] = {
+        0xA9, 0x20, 0x8D, 0x06, 0x20, // LDA #$20, STA $2006
+        0xA9, 0x00, 0x8D, 0x06, 0x20, // LDA #$00, STA $2006
+        0xA9, 0x55, 0x8D, 0x07, 0x20, // LDA #$55, STA $2007
+        0x4C, 0x0F, 0x80,             // JMP $800F
+    };
+
+    uint8_t *prg = &image[INES_HEADER_SIZE];
+    std::copy(program, program + sizeof(program), prg);
+    prg[0x3FFC] = 0x00;
+    prg[0x3FFD] = 0x80;
+
+    bool loaded = cartridge.load(image.data(), image.size()) && cartridge.attach(cpu.bus);
+    ppu.attach(cpu, cartridge);
+    cpu.reset();
+    cpu.runFrame();
+
+    uint8_t status = cpu.memoryRead(0x2002);
+    uint8_t cleared = cpu.memoryRead(0x2002);
+
+    cpu.memoryWrite(0x2006, 0x20);
+    cpu.memoryWrite(0x2006, 0x00);
+    uint8_t stale = cpu.memoryRead(0x2007);
+    uint8_t value = cpu.memoryRead(0x3FFF); // Mirror of $2007
+
+    validate(loaded
+             && ppu.frame == 1
+             && (status & PPUSTATUS_VBLANK)
+             && !(cleared & PPUSTATUS_VBLANK)
+             && stale == 0x00
+             && value == 0x55, __func__);
+}
+
+void test_convert_frame_through_lut() {
+    uint32_t lut[NES_PALETTE_SIZE];
+    buildPaletteLUT(NES_PALETTE, lut);
+
+    uint8_t pixels[] = { 0x00, 0x30, 0x70, 0x0F };
+    uint32_t out[4];
+    convertFrame(lut, pixels, out, 4);
+
+    validate(out[0] == 0xFF545454
+             && out[1] == 0xFFECEEEC
+             && out[2] == out[1] // Only the low 6 bits select a colour
+             && out[3] == 0xFF000000, __func__);
+}
+
+void test_threaded_matches_switched() {
+#if THREADED_SUPPORTED
+    // Countdown loop with a subroutine call and an indexed store per pass
+    uint8_t program[] = {
+        0xA2, 0x40,       // LDX #$40
+        0x20, 0x0B, 0x06, // JSR $060B
+        0x9D, 0x00, 0x02, // STA $0200,X
+        0xCA,             // DEX
+        0xD0, 0xF7,       // BNE -9
+        0x69, 0x03,       // ADC #$03
+        0x60,             // RTS
+    };
+
+    CPU switched;
+    CPU threaded;
+    switched.load(program, sizeof(program));
+    threaded.load(program, sizeof(program));
+
+    switched.runSwitched(2000);
+    threaded.runThreaded(2000);
+
+    validate(switched.cycles == threaded.cycles
+             && switched.instructions == threaded.instructions
+             && switched.registers.PC == threaded.registers.PC
+             && switched.registers.A == threaded.registers.A
+             && switched.registers.X == threaded.registers.X
+             && switched.registers.P == threaded.registers.P
+             && switched.memoryRead(0x0220) == threaded.memoryRead(0x0220), __func__);
+#endif
+}
+
+void test_cached_matches_switched_with_self_modifying_code() {
+    // Each pass stores A into the operand of its own LDA, so a stale block
+    // would keep loading the old immediate
+    uint8_t program[] = {
+        0xA2, 0x05,       // LDX #$05
+        0xA9, 0x00,       // LDA #$00
+        0x18,             // CLC
+        0x69, 0x01,       // ADC #$01
+        0x8D, 0x03, 0x06, // STA $0603
+        0xCA,             // DEX
+        0xD0, 0xF6,       // BNE -10
+        0x4C, 0x0D, 0x06, // JMP $060D
+    };
+
+    CPU switched;
+    CPU cached;
+    switched.load(program, sizeof(program));
+    cached.load(program, sizeof(program));
+
+    switched.runSwitched(200);
+    cached.runCached(200);
+
+    validate(cached.registers.A == 5
+             && cached.memoryRead(0x0603) == 5
+             && switched.cycles == cached.cycles
+             && switched.instructions == cached.instructions
+             && switched.registers.PC == cached.registers.PC
+             && switched.registers.A == cached.registers.A
+             && switched.registers.P == cached.registers.P, __func__);
+}
+
+#if DYNAREC_SUPPORTED
+static void countWrite(void *device, uint16_t address, uint8_t value) {
+    (*(int *) device)++;
+}
+
+static bool sameState(CPU &a, CPU &b) {
+    return a.cycles == b.cycles
+        && a.instructions == b.instructions
+        && a.registers.PC == b.registers.PC
+        && a.registers.SP == b.registers.SP
+        && a.registers.A == b.registers.A
+        && a.registers.X == b.registers.X
+        && a.registers.Y == b.registers.Y
+        && a.registers.P == b.registers.P
+        && memcmp(a.bus.ram.get(), b.bus.ram.get(), 0x10000) == 0;
+}
+
+// Raises an NMI every NMI_PERIOD cycles and records the cycle each event
+// was serviced at
+const uint64_t NMI_PERIOD = 101;
+
+typedef struct nmi_source {
+    CPU *cpu;
+    std::vector<uint64_t> serviced;
+} nmi_source_t;
+
+static void periodicNMI(void *device, uint64_t cycle) {
+    nmi_source_t *source = (nmi_source_t *) device;
+    source->serviced.push_back(source->cpu->cycles);
+    source->cpu->raiseNMI();
+    source->cpu->events.schedule(EVENT_MAPPER, cycle + NMI_PERIOD);
+}
+
+// Run a program a slice of cycles at a time, which cuts translated blocks
+// at varying points, stepping the interpreter up to the same instruction
+// after each slice, until cycles have passed. Writes to $4000 are counted
+// to check that I/O leaves translated code. With an NMI handler, periodic
+// NMIs must be taken at the same instruction in both.
+static bool dynarecMatchesInterpreter(uint8_t program[], size_t size, uint64_t cycles, uint16_t nmiHandler = 0) {
+    CPU reference;
+    CPU translated;
+    int referenceWrites = 0;
+    int translatedWrites = 0;
+    nmi_source_t referenceNMI = { &reference, {} };
+    nmi_source_t translatedNMI = { &translated, {} };
+
+    reference.bus.mapRegister(0x4000, &referenceWrites, nullptr, countWrite);
+    translated.bus.mapRegister(0x4000, &translatedWrites, nullptr, countWrite);
+    reference.load(program, size);
+    translated.load(program, size);
+
+    if(nmiHandler) {
+        for(CPU *cpu : { &reference, &translated }) {
+            cpu->memoryWrite(MEM_INTERRUPT_HANDLER, nmiHandler & 0xFF);
+            cpu->memoryWrite(MEM_INTERRUPT_HANDLER + 1, nmiHandler >> 8);
+            cpu->events.schedule(EVENT_MAPPER, NMI_PERIOD);
+        }
+        reference.events.setHandler(EVENT_MAPPER, &referenceNMI, periodicNMI);
+        translated.events.setHandler(EVENT_MAPPER, &translatedNMI, periodicNMI);
+    }
+
+    while(translated.cycles < cycles) {
+        translated.runDynarec(23);
+        while(reference.instructions < translated.instructions) reference.step();
+
+        // An interrupt taken after the slice's last instruction
+        if(reference.cycles < translated.cycles && reference.cycles >= reference.events.next) reference.serviceEvents();
+
+        if(!sameState(reference, translated) || referenceWrites != translatedWrites
+           || referenceNMI.serviced != translatedNMI.serviced) return false;
+    }
+
+    return translated.dynarec->compiled > 0 && (!nmiHandler || translatedNMI.serviced.size() > 10);
+}
+#endif
+
+void test_dynarec_matches_interpreter() {
+#if DYNAREC_SUPPORTED
+    uint8_t arithmetic[] = {
+        0xA2, 0x00,       // LDX #$00
+        0x18,             // CLC
+        0x69, 0x37,       // ADC #$37
+        0xE9, 0x11,       // SBC #$11
+        0xC9, 0x40,       // CMP #$40
+        0x49, 0xFF,       // EOR #$FF
+        0x2A,             // ROL A
+        0xE8,             // INX
+        0xD0, 0xF3,       // BNE -13
+        0x4C, 0x00, 0x06, // JMP $0600
+    };
+
+    // Stores into its own LDA operand, see the cached core's test
+    uint8_t selfModifying[] = {
+        0xA2, 0x05,       // LDX #$05
+        0xA9, 0x00,       // LDA #$00
+        0x18,             // CLC
+        0x69, 0x01,       // ADC #$01
+        0x8D, 0x03, 0x06, // STA $0603
+        0xCA,             // DEX
+        0xD0, 0xF6,       // BNE -10
+        0x4C, 0x0D, 0x06, // JMP $060D
+    };
+
+    // Shifts, BIT, overflow, an I/O store, INC and a subroutine that the
+    // interpreter runs between translated blocks
+    uint8_t mixed[] = {
+        0xA2, 0x10,       // LDX #$10
+        0xA9, 0x80,       // LDA #$80
+        0x0A,             // ASL A
+        0x6A,             // ROR A
+        0x4A,             // LSR A
+        0x2A,             // ROL A
+        0x2C, 0xC1, 0x00, // BIT $00C1
+        0x30, 0x01,       // BMI +1
+        0xEA,             // NOP
+        0x38,             // SEC
+        0xE9, 0x01,       // SBC #$01
+        0x70, 0x01,       // BVS +1
+        0xEA,             // NOP
+        0x8D, 0x00, 0x40, // STA $4000
+        0x8D, 0x00, 0x03, // STA $0300
+        0xEE, 0x01, 0x03, // INC $0301
+        0x20, 0x26, 0x06, // JSR $0626
+        0xCA,             // DEX
+        0xD0, 0xDF,       // BNE -33
+        0x4C, 0x23, 0x06, // JMP $0623
+        0xC8,             // INY
+        0x98,             // TYA
+        0xC9, 0x08,       // CMP #$08
+        0x90, 0x02,       // BCC +2
+        0xA0, 0x00,       // LDY #$00
+        0x60,             // RTS
+    };
+
+    // Long translated blocks of NOPs, interrupted by an NMI whose handler
+    // counts in Y
+    uint8_t interrupted[] = {
+        0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, // NOP x 16
+        0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA, 0xEA,
+        0xE8,             // INX
+        0x4C, 0x00, 0x06, // JMP $0600
+        0xC8,             // INY
+        0x40,             // RTI
+    };
+
+    validate(dynarecMatchesInterpreter(arithmetic, sizeof(arithmetic), 20000)
+             && dynarecMatchesInterpreter(selfModifying, sizeof(selfModifying), 2000)
+             && dynarecMatchesInterpreter(mixed, sizeof(mixed), 20000)
+             && dynarecMatchesInterpreter(interrupted, sizeof(interrupted), 5000, 0x0614), __func__);
+#endif
+}
+
+// Paths of the optional test ROMs, from --klaus and --nestest
+const char *klausROM = nullptr;
+const char *nestestROM = nullptr;
+
+#if DYNAREC_SUPPORTED
+const uint16_t KLAUS_START          = 0x0400;
+const uint64_t KLAUS_INSTRUCTIONS   = 40000000; // More than a full pass takes
+const uint16_t NESTEST_START        = 0xC000;
+const uint64_t NESTEST_INSTRUCTIONS = 8991;     // Length of the automated run
+
+// Longer than any block runs, so blocks are never cut short
+const uint64_t BLOCK_BUDGET = 1024;
+
+// Compare all of RAM after this many blocks, and registers after each one
+const uint64_t RAM_COMPARE_INTERVAL = 4096;
+
+// Run translated code one block at a time, stepping the interpreter up to
+// the same instruction after each, until instructions have run or the
+// program traps in a jump to itself. Reports where the two first differ.
+static bool blocksMatchStepping(CPU &reference, CPU &translated, uint64_t instructions) {
+    translated.dynarec.reset(new Dynarec(translated));
+
+    for(uint64_t blocks = 1; translated.instructions < instructions; blocks++) {
+        uint16_t pc = translated.registers.PC;
+        uint64_t executed = translated.instructions;
+
+        dynarec_code_t code = translated.dynarec->lookup(pc);
+        if(code) {
+            translated.setStatus(translated.registers.P);
+            code(&translated, BLOCK_BUDGET);
+            translated.registers.P = translated.status();
+        }
+        if(translated.instructions == executed) translated.step();
+
+        while(reference.instructions < translated.instructions) reference.step();
+
+        bool same = blocks % RAM_COMPARE_INTERVAL ? reference.cycles == translated.cycles
+                && reference.instructions == translated.instructions
+                && reference.registers.PC == translated.registers.PC
+                && reference.registers.SP == translated.registers.SP
+                && reference.registers.A == translated.registers.A
+                && reference.registers.X == translated.registers.X
+                && reference.registers.Y == translated.registers.Y
+                && reference.registers.P == translated.registers.P
+            : sameState(reference, translated);
+
+        if(!same) {
+            platformLog("    block at $%04X, instruction %llu, differs from stepping", pc, (unsigned long long) executed);
+            return false;
+        }
+
+        if(translated.instructions == executed + 1 && translated.registers.PC == pc) break;
+    }
+
+    return sameState(reference, translated) && translated.dynarec->compiled > 0;
+}
+
+static bool readImage(const char *path, std::vector<uint8_t> &image) {
+    FILE *file = fopen(path, "rb");
+    if(!file) return false;
+
+    uint8_t block[4096];
+    size_t size;
+    while((size = fread(block, 1, sizeof(block), file)) > 0) {
+        image.insert(image.end(), block, block + size);
+    }
+
+    fclose(file);
+    return true;
+}
+#endif
+
+// With ROM paths given, run Klaus Dormann's functional test and nestest's
+// automation mode block by block against the interpreter. Skipped otherwise.
+void test_dynarec_blocks_match_stepping_on_roms() {
+#if DYNAREC_SUPPORTED
+    if(!klausROM && !nestestROM) {
+        platformLog("    %s skipped, no --klaus or --nestest given", __func__);
+        return;
+    }
+
+    bool klaus = true;
+    if(klausROM) {
+        std::vector<uint8_t> image;
+        CPU reference;
+        CPU translated;
+
+        klaus = readImage(klausROM, image) && image.size() == 0x10000;
+        for(CPU *cpu : { &reference, &translated }) {
+            cpu->bus.mapFlat();
+            for(size_t i = 0; klaus && i < image.size(); i++) cpu->memoryWrite(i, image[i]);
+            cpu->registers.PC = KLAUS_START;
+        }
+
+        klaus = klaus && blocksMatchStepping(reference, translated, KLAUS_INSTRUCTIONS);
+    }
+
+    bool nestest = true;
+    if(nestestROM) {
+        Cartridge cartridge;
+        CPU reference;
+        CPU translated;
+
+        nestest = cartridge.open(nestestROM);
+        for(CPU *cpu : { &reference, &translated }) {
+            if(nestest) cartridge.attach(cpu->bus);
+            cpu->registers.PC = NESTEST_START;
+            cpu->registers.SP = 0xFD;
+            cpu->registers.P  = 0x24;
+        }
+
+        nestest = nestest && blocksMatchStepping(reference, translated, NESTEST_INSTRUCTIONS);
+    }
+
+    validate(klaus && nestest, __func__);
+#endif
+}
+
+static uint8_t saveStateProgram[] = {
+    0xA2, 0x00,       // LDX #$00
+    0xE8,             // INX
+    0xA9, 0x01,       // LDA #$01
+    0x4C, 0x02, 0x06, // JMP $0602
+};
+
+void test_save_state_round_trip() {
+    CPU cpu;
+    cpu.load(saveStateProgram, sizeof(saveStateProgram));
+    cpu.runCached(20);
+
+    std::vector<uint8_t> state(stateSize(cpu));
+    size_t size = saveState(cpu, state.data(), state.size());
+
+    cpu.runCached(100);
+    uint64_t cycles = cpu.cycles;
+    uint8_t x = cpu.registers.X;
+
+    // Patch the loop and run it, so the block cache holds the new code
+    cpu.memoryWrite(0x0604, 0x02);
+    cpu.runCached(100);
+
+    // Loading puts the old code back, which the cache has to notice
+    bool loaded = loadState(cpu, state.data(), size);
+    cpu.runCached(100);
+
+    validate(size > 0 && loaded && cpu.cycles == cycles && cpu.registers.X == x && cpu.registers.A == 0x01, __func__);
+}
+
+void test_save_state_needs_room_for_the_whole_state() {
+    CPU cpu;
+    cpu.load(saveStateProgram, sizeof(saveStateProgram));
+
+    uint8_t small[64];
+
+    validate(saveState(cpu, small, sizeof(small)) == 0, __func__);
+}
+
+void test_load_state_rejects_a_damaged_header() {
+    CPU cpu;
+    cpu.load(saveStateProgram, sizeof(saveStateProgram));
+    cpu.runCached(20);
+
+    std::vector<uint8_t> state(stateSize(cpu));
+    size_t size = saveState(cpu, state.data(), state.size());
+    cpu.runCached(100);
+
+    // Nothing is loaded, so the CPU carries on where it was
+    state[0] ^= 0xFF;
+    uint16_t pc = cpu.registers.PC;
+
+    validate(size > 0 && !loadState(cpu, state.data(), size) && cpu.registers.PC == pc, __func__);
+}
+
+static uint8_t counterProgram[] = {
+    0xA2, 0x00,       // LDX #$00
+    0xE8,             // INX
+    0x8E, 0x00, 0x02, // STX $0200
+    0x4C, 0x02, 0x06, // JMP $0602
+};
+
+const int REWIND_TEST_FRAMES = 20;
+
+// Record REWIND_TEST_FRAMES frames of counterProgram. x and stored get the
+// counter in X and in RAM at each frame.
+static void recordCounter(CPU &cpu, Rewind &rewind, uint8_t x[], uint8_t stored[]) {
+    for(int frame = 0; frame < REWIND_TEST_FRAMES; frame++) {
+        cpu.runCycles(50);
+        x[frame] = cpu.registers.X;
+        stored[frame] = cpu.memoryRead(0x0200);
+        while(!rewind.record(cpu)) rewind.flush();
+    }
+    rewind.flush();
+}
+
+void test_rewind_stays_within_its_limits() {
+    CPU cpu;
+    cpu.load(counterProgram, sizeof(counterProgram));
+
+    // A small ring and keyframe interval, so recording wraps and drops groups
+    Rewind rewind(stateSize(cpu), 64 << 10, 8, 3);
+
+    uint8_t x[REWIND_TEST_FRAMES], stored[REWIND_TEST_FRAMES];
+    recordCounter(cpu, rewind, x, stored);
+
+    validate(rewind.frames() > 0 && rewind.frames() <= 8 && rewind.used() <= (64 << 10), __func__);
+}
+
+void test_rewind_restores_earlier_frames() {
+    CPU cpu;
+    cpu.load(counterProgram, sizeof(counterProgram));
+
+    // A small ring and keyframe interval, so recording wraps and drops groups
+    Rewind rewind(stateSize(cpu), 64 << 10, 8, 3);
+
+    uint8_t x[REWIND_TEST_FRAMES], stored[REWIND_TEST_FRAMES];
+    recordCounter(cpu, rewind, x, stored);
+
+    // Walk back from the newest frame, each restore matching what was recorded
+    size_t frames = rewind.frames();
+    bool restored = frames > 0;
+    for(size_t i = 0; i < frames; i++) {
+        int frame = REWIND_TEST_FRAMES - 1 - i;
+        restored = restored && rewind.rewind(cpu) && cpu.registers.X == x[frame] && cpu.memoryRead(0x0200) == stored[frame];
+    }
+
+    // Until there is nothing left
+    validate(restored && !rewind.rewind(cpu) && rewind.frames() == 0, __func__);
+}
+
+void test_rewind_encoding_round_trips() {
+    uint8_t base[300], state[300], encoded[700], decoded[300];
+    for(int i = 0; i < 300; i++) base[i] = state[i] = i * 7;
+    state[10] ^= 1;
+    state[200] ^= 0x80;
+
+    // A delta that is mostly zeros stays small, and a truncated one is refused
+    size_t size = Rewind::encode(state, base, sizeof(state), encoded, sizeof(encoded));
+    memcpy(decoded, base, sizeof(decoded));
+    bool decodes = size > 0 && Rewind::decode(encoded, size, decoded, sizeof(decoded));
+
+    validate(decodes && size < 16 && !memcmp(decoded, state, sizeof(state))
+             && !Rewind::decode(encoded, size - 1, decoded, sizeof(decoded)), __func__);
+}
+
+void test_batch_runner_matches_serial_machines() {
+    static uint8_t counter[] = {
+        0xA2, 0x00,       // LDX #$00
+        0xE8,             // INX
+        0x8E, 0x00, 0x02, // STX $0200
+        0x4C, 0x02, 0x06, // JMP $0602
+    };
+    static uint8_t adder[] = {
+        0x18,             // CLC
+        0x69, 0x03,       // ADC #$03
+        0x8D, 0x10, 0x02, // STA $0210
+        0x4C, 0x00, 0x06, // JMP $0600
+    };
+
+    // More jobs than threads, of uneven length, so threads run dry and steal
+    std::vector<batch_job_t> jobs;
+    for(int i = 0; i < 24; i++) {
+        uint8_t *program = i % 2 ? adder : counter;
+        size_t size = i % 2 ? sizeof(adder) : sizeof(counter);
+        jobs.push_back({ nullptr, program, size, (uint64_t) 1 + i % 5 });
+    }
+
+    std::vector<batch_result_t> results(jobs.size());
+    BatchRunner runner(4);
+    runner.run(jobs.data(), results.data(), jobs.size());
+
+    bool same = true;
+    uint64_t frames = 0;
+    for(size_t i = 0; i < jobs.size(); i++) {
+        Machine machine;
+        machine.load(jobs[i].image, jobs[i].size);
+        machine.runFrames(jobs[i].frames);
+
+        same = same && results[i].ok && results[i].frames == jobs[i].frames
+               && results[i].cycles == machine.cpu.cycles && results[i].checksum == machine.checksum();
+        frames += jobs[i].frames;
+    }
+
+    validate(same && runner.frames == frames, __func__);
+}
+
+void test_batch_runner_reports_jobs_that_fail_to_load() {
+    uint8_t program[] = {
+        0x4C, 0x00, 0x06, // JMP $0600
+    };
+
+    batch_job_t jobs[] = {
+        { "/nonexistent.nes", nullptr, 0, 1 },
+        { nullptr, program, sizeof(program), 1 },
+    };
+
+    batch_result_t results[2];
+    BatchRunner runner(2);
+    runner.run(jobs, results, 2);
+
+    validate(!results[0].ok && results[0].error && results[1].ok && runner.frames == 1, __func__);
+}
+
+static uint8_t envProgram[] = {
+    0xA5, 0xFF,       // LDA $FF
+    0x8D, 0x00, 0x02, // STA $0200
+    0xE8,             // INX
+    0x8E, 0x01, 0x02, // STX $0201
+    0x4C, 0x00, 0x06, // JMP $0600
+};
+
+// Three machines of envProgram observing the input and counter it stores
+static env_config_t envConfig() {
+    env_config_t config = {};
+    config.image = envProgram;
+    config.size = sizeof(envProgram);
+    config.count = 3;
+    config.threads = 2;
+    config.framesPerStep = 2;
+    config.observation = ENV_OBSERVE_RAM;
+    config.ramAddress = 0x0200;
+    config.ramSize = 2;
+    config.rewardAddress = 0x0201;
+    config.rewardSize = 1;
+    return config;
+}
+
+void test_env_steps_in_lockstep() {
+    env_config_t config = envConfig();
+    const char *error = nullptr;
+    env_t *env = envCreate(&config, &error);
+    if(!env) {
+        validate(false, __func__);
+        return;
+    }
+
+    uint8_t actions[3] = { 0x11, 0x22, 0x33 };
+    uint8_t observations[3 * 2];
+    float rewards[3];
+    envStep(env, actions, observations, rewards);
+    envStep(env, actions, observations, rewards);
+    size_t observationSize = envObservationSize(env);
+    envDestroy(env);
+
+    // The same two steps on a lone machine
+    Machine machine;
+    machine.load(envProgram, sizeof(envProgram));
+    for(int frame = 0; frame < 2; frame++) machine.runFrame(0x11);
+    uint8_t before = machine.cpu.memoryRead(0x0201);
+    for(int frame = 0; frame < 2; frame++) machine.runFrame(0x11);
+    uint8_t after = machine.cpu.memoryRead(0x0201);
+
+    validate(observationSize == 2 && observations[0] == 0x11 && observations[2] == 0x22 && observations[4] == 0x33
+             && observations[1] == after && rewards[0] == (float) (int8_t) (uint8_t) (after - before), __func__);
+}
+
+void test_env_resets_only_masked_machines() {
+    env_config_t config = envConfig();
+    const char *error = nullptr;
+    env_t *env = envCreate(&config, &error);
+    if(!env) {
+        validate(false, __func__);
+        return;
+    }
+
+    uint8_t actions[3] = { 0x11, 0x22, 0x33 };
+    uint8_t observations[3 * 2];
+    float rewards[3];
+    envStep(env, actions, observations, rewards);
+
+    // Reset the first and last to the state right after loading
+    uint8_t mask[3] = { 1, 0, 1 };
+    memset(observations, 0xAA, sizeof(observations));
+    envReset(env, mask, observations);
+    envDestroy(env);
+
+    validate(observations[1] == 0 && observations[5] == 0 && observations[3] == 0xAA, __func__);
+}
+
+void test_env_rejects_frame_observations_without_a_cartridge() {
+    env_config_t config = envConfig();
+    config.observation = ENV_OBSERVE_FRAME;
+    config.downsample = 2;
+
+    const char *error = nullptr;
+    env_t *env = envCreate(&config, &error);
+    if(env) envDestroy(env);
+
+    validate(!env && error && strstr(error, "cartridge"), __func__);
+}
+
+static uint8_t movieProgram[] = {
+    0xA5, 0xFF,       // LDA $FF
+    0x8D, 0x00, 0x02, // STA $0200
+    0xA6, 0xFE,       // LDX $FE
+    0x8E, 0x01, 0x02, // STX $0201
+    0x4C, 0x00, 0x06, // JMP $0600
+};
+
+// 120 frames of movieProgram, with the input changing every 30 frames
+static void recordMovie(Movie &movie, Machine &recorder) {
+    recorder.load(movieProgram, sizeof(movieProgram));
+    recorder.record(&movie, 1234);
+    for(int frame = 0; frame < 120; frame++) recorder.runFrame(frame / 30 * 'a');
+}
+
+void test_movie_replays_exactly() {
+    Movie movie;
+    Machine recorder;
+    recordMovie(movie, recorder);
+
+    std::vector<uint8_t> file;
+    movie.encode(file);
+
+    Movie loaded;
+    Machine player;
+    player.load(movieProgram, sizeof(movieProgram));
+
+    validate(loaded.load(file.data(), file.size()) && player.play(loaded)
+             && player.checksum() == recorder.checksum() && player.cpu.cycles == recorder.cpu.cycles, __func__);
+}
+
+void test_movie_encodes_runs_of_input() {
+    Movie movie;
+    Machine recorder;
+    recordMovie(movie, recorder);
+
+    std::vector<uint8_t> file;
+    movie.encode(file);
+
+    // Four runs of input take a few bytes each after the header
+    validate(file.size() <= MOVIE_HEADER_SIZE + 4 * 3, __func__);
+}
+
+void test_movie_refuses_truncated_files_and_other_images() {
+    Movie movie;
+    Machine recorder;
+    recordMovie(movie, recorder);
+
+    std::vector<uint8_t> file;
+    movie.encode(file);
+
+    Movie loaded;
+    bool decoded = loaded.load(file.data(), file.size());
+
+    file.pop_back();
+    Machine other;
+    uint8_t different[] = { 0xEA };
+    other.load(different, sizeof(different));
+
+    validate(decoded && !Movie().load(file.data(), file.size()) && !other.play(loaded), __func__);
+}
+
+void test_controller_shifts_out_buttons_in_order() {
+    CPU cpu;
+    Input input;
+    input.attach(cpu, true);
+    input.setFrame(BUTTON_A | BUTTON_RIGHT);
+    cpu.memoryWrite(INPUT_CONTROLLER_PORT, 1);
+    cpu.memoryWrite(INPUT_CONTROLLER_PORT, 0);
+
+    // A first, then 1s once all eight are read
+    uint16_t bits = 0;
+    for(int i = 0; i < 9; i++) bits |= (cpu.memoryRead(INPUT_CONTROLLER_PORT) & 0x01) << i;
+
+    validate(bits == 0x181, __func__);
+}
+
+void test_state_restores_input_mid_movie() {
+    Movie movie;
+    Machine recorder;
+    recorder.load(movieProgram, sizeof(movieProgram));
+    recorder.record(&movie, 1234);
+
+    std::vector<uint8_t> state(stateSize(recorder.cpu));
+    size_t size = 0;
+    for(int frame = 0; frame < 120; frame++) {
+        if(frame == 60) size = saveState(recorder.cpu, state.data(), state.size());
+        recorder.runFrame(frame / 30 * 'a');
+    }
+
+    // A machine with another seed and history picks up where the state left off
+    Machine player;
+    player.load(movieProgram, sizeof(movieProgram));
+    player.record(nullptr, 99);
+    for(int frame = 0; frame < 10; frame++) player.runFrame(0x7F);
+
+    bool loaded = size > 0 && loadState(player.cpu, state.data(), size);
+    for(int frame = 60; frame < 120; frame++) player.runFrame(movie.inputs[frame]);
+
+    validate(loaded && player.checksum() == recorder.checksum() && player.input.random == recorder.input.random, __func__);
+}
+
+void test_state_restores_controller_mid_read() {
+    CPU cpu;
+    Input input;
+    input.attach(cpu, true);
+    input.setFrame(BUTTON_A | BUTTON_START);
+    cpu.memoryWrite(INPUT_CONTROLLER_PORT, 1);
+    cpu.memoryWrite(INPUT_CONTROLLER_PORT, 0);
+    cpu.memoryRead(INPUT_CONTROLLER_PORT);
+
+    std::vector<uint8_t> controller(stateSize(cpu));
+    size_t size = saveState(cpu, controller.data(), controller.size());
+    uint8_t expected = 0;
+    for(int i = 0; i < 7; i++) expected |= (cpu.memoryRead(INPUT_CONTROLLER_PORT) & 0x01) << i;
+
+    // The shift register comes back, not the buttons held now
+    input.setFrame(BUTTON_B);
+    bool restored = loadState(cpu, controller.data(), size);
+    uint8_t bits = 0;
+    for(int i = 0; i < 7; i++) bits |= (cpu.memoryRead(INPUT_CONTROLLER_PORT) & 0x01) << i;
+
+    validate(restored && bits == expected && expected == (BUTTON_START >> 1), __func__);
+}
+
+// Spin in place with pulse 1 and noise held on and pulse 2 about to run out
+static void startTones(CPU &cpu, APU &apu) {
+    uint8_t program[] = {
+        0x4C, 0x00, 0x06, // JMP $0600
+    };
+
+    cpu.load(program, sizeof(program));
+    apu.attach(cpu);
+
+    cpu.memoryWrite(APU_STATUS, 0x0B);
+    cpu.memoryWrite(0x4000, 0xBF); // Pulse 1: halted, constant volume 15
+    cpu.memoryWrite(0x4002, 0xFD);
+    cpu.memoryWrite(0x4003, 0x08);
+    cpu.memoryWrite(0x4004, 0x9F); // Pulse 2: length 2, gone after one frame
+    cpu.memoryWrite(0x4006, 0xFD);
+    cpu.memoryWrite(0x4007, 0x18);
+    cpu.memoryWrite(0x400C, 0x3F); // Noise: halted
+    cpu.memoryWrite(0x400E, 0x03);
+    cpu.memoryWrite(0x400F, 0x08);
+}
+
+void test_apu_length_counters_silence_channels() {
+    CPU cpu;
+    APU apu;
+    startTones(cpu, apu);
+
+    for(int i = 0; i < 2; i++) cpu.runFrame();
+
+    validate((cpu.memoryRead(APU_STATUS) & 0x0F) == 0x09, __func__);
+}
+
+void test_apu_samples_at_the_output_rate() {
+    CPU cpu;
+    APU apu;
+    startTones(cpu, apu);
+
+    for(int i = 0; i < 10; i++) cpu.runFrame();
+
+    // 48000 / 60 samples a frame, and a tone rather than silence
+    size_t expected = (size_t) (cpu.cycles * (double) APU_SAMPLE_RATE / CPU_CLOCK_HZ);
+    size_t count = apu.samples.size();
+    int16_t sample, peak = 0;
+    while(apu.samples.pop(sample)) if(sample > peak) peak = sample;
+
+    validate(count + 2 >= expected && count <= expected && peak > 1000 && apu.dropped == 0, __func__);
+}
+
+void test_apu_state_round_trip() {
+    CPU cpu;
+    APU apu;
+    startTones(cpu, apu);
+    for(int i = 0; i < 2; i++) cpu.runFrame();
+
+    std::vector<uint8_t> state(stateSize(cpu));
+    size_t size = saveState(cpu, state.data(), state.size());
+
+    for(int i = 0; i < 8; i++) cpu.runFrame();
+    uint64_t time = apu.time;
+    uint16_t shift = apu.noise.shift;
+    uint8_t step = apu.pulse[0].step;
+
+    bool loaded = size > 0 && loadState(cpu, state.data(), size);
+    for(int i = 0; i < 8; i++) cpu.runFrame();
+
+    validate(loaded && apu.time == time && apu.noise.shift == shift && apu.pulse[0].step == step, __func__);
+}
+
+// Only a version 1 state may lack the APU chunk, and loading one resets the APU
+void test_apu_chunk_may_only_be_missing_from_version_1_states() {
+    CPU cpu;
+    APU apu;
+    startTones(cpu, apu);
+    for(int i = 0; i < 2; i++) cpu.runFrame();
+
+    std::vector<uint8_t> state(stateSize(cpu));
+    size_t size = saveState(cpu, state.data(), state.size());
+
+    auto tag = std::search(state.begin(), state.begin() + size, "APU ", "APU " + 4);
+    *tag = 'X';
+    bool missing = size > 0 && !loadState(cpu, state.data(), size);
+    state[4] = 1;
+    bool older = loadState(cpu, state.data(), size) && apu.enabled == 0;
+
+    validate(missing && older, __func__);
+}
+
+void test_pacer_locks_to_a_60_hz_host() {
+    // One frame every tick
+    Pacer locked;
+    bool even = true;
+    for(int i = 0; i <= 600; i++) even &= locked.tick(i / 60.0) == 1;
+
+    validate(even, __func__);
+}
+
+void test_pacer_follows_a_faster_host() {
+    // A 144 Hz host runs NES_FRAME_RATE frames a second, some ticks idle
+    Pacer fast;
+    uint64_t frames = 0;
+    for(int i = 1; i <= 1440; i++) frames += fast.tick(i / 144.0);
+
+    validate(frames >= 600 && frames <= 602 && fast.stats.idle > 0 && fast.stats.doubled == 0, __func__);
+}
+
+void test_pacer_drops_time_after_a_stall() {
+    // What it can't catch up is dropped, and shows as jitter
+    Pacer stalled;
+    stalled.tick(0);
+    stalled.tick(1.0 / 30);
+    int burst = stalled.tick(1.0);
+
+    validate(burst == PACER_MAX_FRAMES && stalled.stats.dropped > 0 && stalled.stats.maxInterval > 0.9, __func__);
+}
+
+void test_pacer_slows_samples_when_the_ring_fills() {
+    // A ring fuller than the target slows the samples down
+    APU apu;
+    Pacer audio;
+    audio.syncAudio(&apu);
+    for(int i = 0; i < 4000; i++) apu.samples.push(0);
+    for(int i = 0; i < 60; i++) audio.tick(i / 60.0);
+
+    validate(audio.stats.ratio < 1 && audio.stats.ratio >= 1 - PACER_MAX_RATE_DELTA, __func__);
+}
+
+static void recordEvent(void *device, uint64_t cycle) {
+    ((std::vector<uint64_t> *) device)->push_back(cycle);
+}
+
+void test_scheduler_caps_next_at_the_deadline() {
+    std::vector<uint64_t> fired;
+    Scheduler events;
+    for(int i = 0; i < EVENT_COUNT; i++) events.setHandler(i, &fired, recordEvent);
+    events.schedule(EVENT_APU_FRAME, 300);
+    events.setDeadline(250);
+    bool deadline = events.next == 250;
+    events.schedule(EVENT_APU_DMC, 50);
+
+    validate(deadline && events.next == 50, __func__);
+}
+
+void test_scheduler_fires_events_in_cycle_order() {
+    // Moved and cancelled ones included
+    std::vector<uint64_t> fired;
+    Scheduler events;
+    for(int i = 0; i < EVENT_COUNT; i++) events.setHandler(i, &fired, recordEvent);
+    events.schedule(EVENT_APU_FRAME, 300);
+    events.schedule(EVENT_PPU_VBLANK, 100);
+    events.schedule(EVENT_MAPPER, 200);
+    events.schedule(EVENT_APU_DMC, 50);
+    events.schedule(EVENT_PPU_VBLANK, 400);
+    events.cancel(EVENT_MAPPER);
+    events.setDeadline(250);
+    events.dispatch(350);
+
+    validate(fired == std::vector<uint64_t>({ 50, 300 }) && events.next == 250 && events.when(EVENT_PPU_VBLANK) == 400, __func__);
+}
+
+// A cartridge that counts frames in Y from an NMI on every vertical blank,
+// and APU frame IRQs in X. The cartridge runs from the image without copying
+// it, so the image has to outlive the machine.
+static std::vector<uint8_t> interruptCounter() {
+    std::vector<uint8_t> image(INES_HEADER_SIZE + PRG_BANK_SIZE + CHR_BANK_SIZE, 0x00);
+    uint8_t header[] = { 'N', 'E', 'S', 0x1A, 0x01, 0x01 };
+    std::copy(header, header + sizeof(header), image.begin());
+
+    uint8_t reset[] = {
+        0xA9, 0x80,       // LDA #$80
+        0x8D, 0x00, 0x20, // STA $2000, NMI on
+        0x58,             // CLI
+        0x4C, 0x06, 0x80, // JMP $8006
+    };
+    uint8_t nmi[] = {
+        0xC8,             // INY
+        0x40,             // RTI
+    };
+    uint8_t irq[] = {
+        0xA9, 0x40,       // LDA #$40
+        0x8D, 0x17, 0x40, // STA $4017, acknowledge
+        0xA9, 0x00,       // LDA #$00
+        0x8D, 0x17, 0x40, // STA $4017, and restart the sequence
+        0xE8,             // INX
+        0x40,             // RTI
+    };
+
+    uint8_t *prg = &image[INES_HEADER_SIZE];
+    std::copy(reset, reset + sizeof(reset), prg);
+    std::copy(nmi, nmi + sizeof(nmi), prg + 0x10);
+    std::copy(irq, irq + sizeof(irq), prg + 0x20);
+    uint8_t vectors[] = { 0x10, 0x80, 0x00, 0x80, 0x20, 0x80 };
+    std::copy(vectors, vectors + sizeof(vectors), prg + 0x3FFA);
+
+    return image;
+}
+
+void test_nmi_and_irq_from_scheduled_events() {
+    std::vector<uint8_t> image = interruptCounter();
+    Machine machine;
+    bool loaded = machine.load(image.data(), image.size());
+    machine.apu.output = false;
+    machine.runFrames(20);
+
+    validate(loaded && machine.cpu.registers.Y >= 19 && machine.cpu.registers.Y <= 20
+             && machine.cpu.registers.X >= 18 && machine.cpu.registers.X <= 20, __func__);
+}
+
+void test_state_restores_the_event_schedule() {
+    std::vector<uint8_t> image = interruptCounter();
+    Machine machine;
+    bool loaded = machine.load(image.data(), image.size());
+    machine.apu.output = false;
+    machine.runFrames(10);
+
+    std::vector<uint8_t> state(stateSize(machine.cpu));
+    size_t size = saveState(machine.cpu, state.data(), state.size());
+    machine.runFrames(20);
+    uint8_t frames = machine.cpu.registers.Y;
+    uint8_t irqs = machine.cpu.registers.X;
+
+    // Saved mid-run, the interrupts come back on the same schedule
+    bool restored = size > 0 && loadState(machine.cpu, state.data(), size);
+    machine.runFrames(20);
+
+    validate(loaded && restored && machine.cpu.registers.Y == frames && machine.cpu.registers.X == irqs, __func__);
+}
+
+void test_ppu_catches_up_on_register_access() {
+    CPU cpu;
+    Cartridge cartridge;
+    PPU ppu;
+
+    std::vector<uint8_t> image(INES_HEADER_SIZE + PRG_BANK_SIZE + CHR_BANK_SIZE, 0x00);
+    uint8_t header[] = { 'N', 'E', 'S', 0x1A, 0x01, 0x01 };
+    std::copy(header, header + sizeof(header), image.begin());
+
+    uint8_t *prg = &image[INES_HEADER_SIZE];
+    prg[0x0000] = 0x4C; // JMP $8000
+    prg[0x0001] = 0x00;
+    prg[0x0002] = 0x80;
+    prg[0x3FFC] = 0x00;
+    prg[0x3FFD] = 0x80;
+
+    bool loaded = cartridge.load(image.data(), image.size()) && cartridge.attach(cpu.bus);
+    ppu.attach(cpu, cartridge);
+    cpu.reset();
+
+    // Half a frame from vertical blank leaves the PPU where it started...
+    cpu.runCycles(CPU_CYCLES_PER_FRAME / 2);
+    bool lagging = ppu.scanline == PPU_VBLANK_SCANLINE;
+
+    // ...until a register read brings it to the CPU, 131 lines on
+    cpu.memoryRead(0x2002);
+    bool caughtUp = ppu.scanline == (PPU_VBLANK_SCANLINE + 131) % PPU_SCANLINES;
+
+    // and the vblank event brings it round again without any access
+    cpu.runFrame();
+    bool vblank = ppu.scanline == PPU_VBLANK_SCANLINE && ppu.frame == 1;
+
+    validate(loaded && lagging && caughtUp && vblank, __func__);
+}
+
+void test_i420_matches_scalar() {
+    // 40 columns leave a tail after the 16 pixel vector loop
+    const int width = 40, height = 6;
+    uint32_t rgba[width * height];
+    uint8_t y[width * height], u[width * height / 4], v[width * height / 4];
+    uint8_t ey[width * height], eu[width * height / 4], ev[width * height / 4];
+
+    srand(2);
+    for(int i = 0; i < width * height; i++) rgba[i] = 0xFF000000 | (rand() & 0xFFFFFF);
+
+    // A white 2x2 block
+    rgba[0] = rgba[1] = rgba[width] = rgba[width + 1] = 0xFFFFFFFF;
+
+    convertI420(rgba, width, height, y, u, v);
+    convertI420Scalar(rgba, width, height, ey, eu, ev);
+
+    validate(!memcmp(y, ey, sizeof(y)) && !memcmp(u, eu, sizeof(u)) && !memcmp(v, ev, sizeof(v))
+             && ey[0] == 235 && eu[0] == 128 && ev[0] == 128, __func__);
+}
+
+// Just enough inflate for the fixed Huffman block deflateFixed writes
+static bool inflateFixed(const uint8_t *data, size_t size, std::vector<uint8_t> &out) {
+    static const uint16_t lengths[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const uint16_t distances[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+
+    size_t bit = 16; // After the zlib header
+    auto bits = [&](int count) {
+        uint32_t value = 0;
+        for(int i = 0; i < count && bit / 8 < size; i++, bit++) value |= ((data[bit / 8] >> (bit % 8)) & 1) << i;
+        return value;
+    };
+    auto code = [&](int count, uint32_t value) {
+        while(count--) value = (value << 1) | bits(1);
+        return value;
+    };
+
+    if(bits(3) != 3) return false; // Final, fixed
+
+    for(;;) {
+        if(bit / 8 >= size) return false;
+
+        int symbol;
+        uint32_t value = code(7, 0);
+        if(value < 0x18) symbol = 256 + value;
+        else if((value = code(1, value)) >= 0x30 && value < 0xC0) symbol = value - 0x30;
+        else if(value >= 0xC0 && value < 0xC8) symbol = 280 + value - 0xC0;
+        else symbol = 144 + code(1, value) - 0x190;
+
+        if(symbol < 256) {
+            out.push_back(symbol);
+            continue;
+        }
+        if(symbol == 256) break;
+
+        int index = symbol - 257;
+        size_t length = lengths[index] + bits(index < 8 || index == 28 ? 0 : (index - 4) / 4);
+        int distanceCode = code(5, 0);
+        size_t distance = distances[distanceCode] + bits(distanceCode < 4 ? 0 : (distanceCode - 2) / 2);
+        if(distance > out.size()) return false;
+
+        for(size_t i = 0; i < length; i++) out.push_back(out[out.size() - distance]);
+    }
+
+    size_t end = (bit + 7) / 8;
+    if(end + 4 != size) return false;
+
+    uint32_t check = (data[end] << 24) | (data[end + 1] << 16) | (data[end + 2] << 8) | data[end + 3];
+    return check == adler32(out.data(), out.size());
+}
+
+void test_png_snapshot_round_trips() {
+    // Tiles of a few colours, like a real frame
+    std::vector<uint8_t> pixels(PPU_WIDTH * PPU_HEIGHT);
+    for(int y = 0; y < PPU_HEIGHT; y++) {
+        for(int x = 0; x < PPU_WIDTH; x++) pixels[y * PPU_WIDTH + x] = ((x / 8 + y / 8) % 3) * 0x11 + (x % 8 == y % 8);
+    }
+
+    std::vector<uint8_t> png;
+    encodePNG(pixels.data(), PPU_WIDTH, PPU_HEIGHT, NES_PALETTE, NES_PALETTE_SIZE, png);
+
+    // Signature, IHDR, PLTE, then IDAT
+    bool header = png.size() > 8 + 25 + 204 + 12 && !memcmp(&png[1], "PNG", 3) && !memcmp(&png[12], "IHDR", 4)
+                  && png[18] == 0x01 && png[22] == 0x00 && png[23] == 0xF0 && png[24] == 8 && png[25] == 3
+                  && (uint32_t) ((png[29] << 24) | (png[30] << 16) | (png[31] << 8) | png[32]) == crc32(&png[12], 17);
+
+    size_t idat = 8 + 25 + 12 + NES_PALETTE_SIZE * 3;
+    size_t length = (png[idat] << 24) | (png[idat + 1] << 16) | (png[idat + 2] << 8) | png[idat + 3];
+    bool chunk = !memcmp(&png[idat + 4], "IDAT", 4) && png.size() == idat + 12 + length + 12;
+
+    std::vector<uint8_t> rows;
+    bool inflated = chunk && inflateFixed(&png[idat + 8], length, rows) && rows.size() == (PPU_WIDTH + 1) * PPU_HEIGHT;
+    for(int y = 0; inflated && y < PPU_HEIGHT; y++) {
+        inflated = rows[y * (PPU_WIDTH + 1)] == 0 && !memcmp(&rows[y * (PPU_WIDTH + 1) + 1], &pixels[y * PPU_WIDTH], PPU_WIDTH);
+    }
+
+    validate(header && inflated && length < pixels.size() / 10, __func__);
+}
+
+void test_video_writer_streams_y4m() {
+    FILE *file = tmpfile();
+    std::vector<uint8_t> pixels(VIDEO_FRAME_SIZE, 0x30); // White
+
+    uint64_t frames;
+    bool failed;
+    {
+        VideoWriter video(file, VIDEO_Y4M);
+        for(uint64_t frame = 1; frame <= 3; frame++) {
+            while(!video.write(pixels.data(), frame)) video.flush();
+        }
+        video.flush();
+        frames = video.frames;
+        failed = video.failed;
+    }
+
+    long size = ftell(file);
+    rewind(file);
+    char header[128] = {};
+    bool read = fgets(header, sizeof(header), file) != nullptr;
+
+    long headerSize = strlen(header);
+    long frameSize = 6 + VIDEO_FRAME_SIZE * 3 / 2;
+    fseek(file, headerSize + frameSize + 6, SEEK_SET);
+    int luma = fgetc(file);
+    fclose(file);
+
+    validate(read && !strncmp(header, "YUV4MPEG2 W256 H240 F5369319:89342 ", 35) && frames == 3 && !failed
+             && size == headerSize + 3 * frameSize && luma == 220, __func__);
+}
+
+int main(int argc, char** argv) {
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--klaus") && i + 1 < argc) {
+            klausROM = argv[++i];
+        } else if(!strcmp(argv[i], "--nestest") && i + 1 < argc) {
+            nestestROM = argv[++i];
+        } else {
+            fprintf(stderr, "usage: test [--klaus FILE] [--nestest FILE]\n");
+            return 2;
+        }
+    }
+
     test_adc_add_with_immediate();
     test_adc_add_with_carry();
     test_adc_add_with_overflow();
 
+    test_sbc_borrow();
+    test_cmp_clears_carry_and_zero();
+
     test_and_with_immediate();
     test_and_negative_flag();
     test_and_zero_flag();
@@ -951,6 +2407,8 @@ int main() {
     test_bpl_branch_with_negative_clear();
 
     test_brk();
+    test_brk_handler_sees_no_b_flag();
+    test_php_leaves_b_out_of_p();
 
     test_bvc_branch_with_overflow_clear();
     test_bvc_branch_with_overflow_set();
@@ -994,4 +2452,59 @@ int main() {
     test_inx_overflow();
 
     test_5_ops_working_together();
+
+    test_cycles_absolute_x_same_page();
+    test_cycles_absolute_x_page_crossed();
+    test_cycles_store_absolute_x_page_crossed();
+    test_cycles_branch_not_taken();
+    test_cycles_branch_taken();
+    test_cycles_branch_taken_new_page();
+
+    test_reset_from_cartridge();
+    test_cartridge_rejects_unsupported_mapper();
+
+    test_pattern_decode_matches_scalar();
+    test_ppu_buffered_read_and_vblank();
+    test_convert_frame_through_lut();
+
+    test_threaded_matches_switched();
+    test_cached_matches_switched_with_self_modifying_code();
+    test_dynarec_matches_interpreter();
+    test_dynarec_blocks_match_stepping_on_roms();
+
+    test_save_state_round_trip();
+    test_save_state_needs_room_for_the_whole_state();
+    test_load_state_rejects_a_damaged_header();
+    test_rewind_restores_earlier_frames();
+    test_rewind_stays_within_its_limits();
+    test_rewind_encoding_round_trips();
+    test_batch_runner_matches_serial_machines();
+    test_batch_runner_reports_jobs_that_fail_to_load();
+    test_env_steps_in_lockstep();
+    test_env_resets_only_masked_machines();
+    test_env_rejects_frame_observations_without_a_cartridge();
+    test_movie_replays_exactly();
+    test_movie_encodes_runs_of_input();
+    test_movie_refuses_truncated_files_and_other_images();
+    test_controller_shifts_out_buttons_in_order();
+    test_state_restores_input_mid_movie();
+    test_state_restores_controller_mid_read();
+    test_apu_length_counters_silence_channels();
+    test_apu_samples_at_the_output_rate();
+    test_apu_state_round_trip();
+    test_apu_chunk_may_only_be_missing_from_version_1_states();
+    test_pacer_locks_to_a_60_hz_host();
+    test_pacer_follows_a_faster_host();
+    test_pacer_drops_time_after_a_stall();
+    test_pacer_slows_samples_when_the_ring_fills();
+    test_scheduler_caps_next_at_the_deadline();
+    test_scheduler_fires_events_in_cycle_order();
+    test_nmi_and_irq_from_scheduled_events();
+    test_state_restores_the_event_schedule();
+    test_ppu_catches_up_on_register_access();
+    test_i420_matches_scalar();
+    test_png_snapshot_round_trips();
+    test_video_writer_streams_y4m();
+
+    return failures > 0;
 }
\ No newline at end of file